@@ -0,0 +1,197 @@
+#!/bin/bash
+#
+# Sarus
+#
+# Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+#
+# Please, refer to the LICENSE file in the root directory.
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Convert a sample image into squashfs images with different build profiles
+# (compressor, compression level, block size) and report for each profile the
+# build time, the size of the image and the cold-read throughput of its files.
+# The results help to choose the "squashfs" settings of sarus.json.
+
+usage() {
+    cat <<USAGE
+Usage: $(basename $0) [OPTIONS] SAMPLE [PROFILE...]
+
+SAMPLE is a directory, a tar archive or a squashfs image (e.g. an image
+of a Sarus repository). PROFILE is compressor[:level[:blockSize]], with
+the block size in KB, e.g. "zstd:3", "lz4::1024", "gzip:9:256".
+Default profiles: $default_profiles
+
+Options:
+  -m PATH   mksquashfs binary [mksquashfs]
+  -u PATH   unsquashfs binary [unsquashfs]
+  -p N      number of processors used by mksquashfs [all]
+  -M MB     memory used by mksquashfs [mksquashfs' default]
+  -t DIR    working directory [\${TMPDIR:-/tmp}]
+  -h        print this help
+USAGE
+}
+
+log() {
+    local message=$1
+    echo "[ LOG ]  $message" >&2
+}
+
+exit_with_error() {
+    local message=$1
+    echo "[ ERROR ]  $message" >&2
+    exit 1
+}
+
+now() {
+    date +%s.%N
+}
+
+elapsed_since() {
+    local start=$1
+    awk -v start=$start -v end=$(now) 'BEGIN { printf "%.2f", end - start }'
+}
+
+prepare_sample() {
+    local sample=$1
+    local sample_dir=$2
+
+    if [ -d "$sample" ]; then
+        echo "$sample"
+    elif $unsquashfs -s "$sample" >/dev/null 2>&1; then
+        log "extracting squashfs image $sample"
+        $unsquashfs -no-progress -d "$sample_dir" "$sample" >/dev/null || exit_with_error "failed to extract $sample"
+        echo "$sample_dir"
+    else
+        log "extracting tar archive $sample"
+        mkdir -p "$sample_dir"
+        tar -xf "$sample" -C "$sample_dir" 2>/dev/null || exit_with_error "failed to extract $sample"
+        echo "$sample_dir"
+    fi
+}
+
+# build the squashfs image of a profile, prints the build time
+build_image() {
+    local profile=$1
+    local image=$2
+    local compressor level block_size
+    IFS=: read compressor level block_size <<< "$profile"
+
+    local options="-comp $compressor"
+    [ -n "$level" ] && options+=" -Xcompression-level $level"
+    [ -n "$block_size" ] && options+=" -b $((block_size * 1024))"
+    [ -n "$processors" ] && options+=" -processors $processors"
+    [ -n "$memory" ] && options+=" -mem ${memory}M"
+
+    rm -f "$image"
+    local start=$(now)
+    $mksquashfs "$sample_dir" "$image" -noappend -no-progress $options >/dev/null \
+        || exit_with_error "failed to build squashfs image with profile $profile ($options)"
+    elapsed_since $start
+}
+
+# evict the image (and, as root, all the clean caches) from the page cache
+drop_caches() {
+    local image=$1
+    sync
+    if [ $(id -u) -eq 0 ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+    else
+        dd if="$image" iflag=nocache count=0 status=none 2>/dev/null
+    fi
+}
+
+# read all the files of the image with a cold page cache, prints the elapsed time
+read_image() {
+    local image=$1
+    local mount_point=$work_dir/mnt
+    mkdir -p $mount_point
+    drop_caches "$image"
+
+    local start elapsed
+    case $read_method in
+    kernel)
+        mount -t squashfs -o loop,ro "$image" $mount_point || exit_with_error "failed to mount $image"
+        start=$(now)
+        tar -C $mount_point -cf - . | cat >/dev/null
+        elapsed=$(elapsed_since $start)
+        umount $mount_point
+        ;;
+    squashfuse)
+        squashfuse "$image" $mount_point || exit_with_error "failed to mount $image"
+        start=$(now)
+        tar -C $mount_point -cf - . | cat >/dev/null
+        elapsed=$(elapsed_since $start)
+        fusermount -u $mount_point
+        ;;
+    unsquashfs)
+        rm -rf $work_dir/unsquashed
+        start=$(now)
+        $unsquashfs -no-progress -d $work_dir/unsquashed "$image" >/dev/null
+        elapsed=$(elapsed_since $start)
+        rm -rf $work_dir/unsquashed
+        ;;
+    esac
+    echo $elapsed
+}
+
+default_profiles="gzip lz4 zstd:3 zstd:15 xz"
+mksquashfs=mksquashfs
+unsquashfs=unsquashfs
+processors=
+memory=
+work_parent_dir=${TMPDIR:-/tmp}
+
+while getopts "m:u:p:M:t:h" option; do
+    case $option in
+    m) mksquashfs=$OPTARG ;;
+    u) unsquashfs=$OPTARG ;;
+    p) processors=$OPTARG ;;
+    M) memory=$OPTARG ;;
+    t) work_parent_dir=$OPTARG ;;
+    h) usage; exit 0 ;;
+    *) usage >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+[ $# -ge 1 ] || { usage >&2; exit 1; }
+sample=$1; shift
+profiles=${@:-$default_profiles}
+
+[ -e "$sample" ] || exit_with_error "sample $sample doesn't exist"
+command -v $mksquashfs >/dev/null || exit_with_error "mksquashfs not found (use -m)"
+command -v $unsquashfs >/dev/null || exit_with_error "unsquashfs not found (use -u)"
+
+if [ $(id -u) -eq 0 ]; then
+    read_method=kernel
+elif command -v squashfuse >/dev/null && command -v fusermount >/dev/null; then
+    read_method=squashfuse
+else
+    read_method=unsquashfs
+fi
+
+work_dir=$(mktemp -d $work_parent_dir/sarus-squashfs-benchmark.XXXXXX) || exit_with_error "failed to create working directory"
+trap "umount $work_dir/mnt 2>/dev/null; fusermount -u $work_dir/mnt 2>/dev/null; rm -rf $work_dir" EXIT
+
+sample_dir=$(prepare_sample "$sample" $work_dir/sample) || exit 1
+sample_size=$(du -sb --apparent-size "$sample_dir" | cut -f1)
+
+log "sample: $sample ($(awk -v s=$sample_size 'BEGIN { printf "%.1f", s / 1048576 }') MB)"
+log "cold read through: $read_method"
+
+printf "%-16s %14s %16s %8s %20s\n" "PROFILE" "BUILD TIME [s]" "IMAGE SIZE [MB]" "RATIO" "COLD READ [MB/s]"
+for profile in $profiles; do
+    image=$work_dir/image.squashfs
+    build_time=$(build_image $profile $image) || exit 1
+    image_size=$(stat -c %s $image)
+    read_time=$(read_image $image) || exit 1
+    awk -v profile=$profile -v build_time=$build_time -v image_size=$image_size \
+        -v sample_size=$sample_size -v read_time=$read_time 'BEGIN {
+        throughput = read_time > 0 ? sample_size / 1048576 / read_time : 0
+        printf "%-16s %14.2f %16.1f %8.2f %20.1f\n", profile, build_time, image_size / 1048576,
+            sample_size / image_size, throughput
+    }'
+done
+
+log "set the chosen profile in the \"squashfs\" object of sarus.json,"
+log "or with the --squashfs-* options of sarus pull and sarus load"
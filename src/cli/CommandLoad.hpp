@@ -58,8 +58,8 @@ public:
 
     void printHelpMessage() const override {
         auto printer = cli::HelpMessage()
-            .setUsage("sarus load [OPTIONS] file REPOSITORY[:TAG]")
-            .setDescription(getBriefDescription())
+            .setUsage("sarus load [OPTIONS] file|- REPOSITORY[:TAG]")
+            .setDescription(getBriefDescription() + " (use \"-\" to read the tarball from the standard input)")
             .setOptionsDescription(optionsDescription);
         std::cout << printer;
     }
@@ -70,6 +70,7 @@ private:
             ("temp-dir",   boost::program_options::value<std::string>(&conf->directories.tempFromCLI),
                 "Temporary directory where the image is expanded")
             ("centralized-repository", "Use centralized repository instead of the local one");
+        cli::utility::addSquashfsOptions(optionsDescription, conf->squashfs);
     }
 
     void parseCommandArguments(const std::deque<common::CLIArguments>& argsGroups) {
@@ -89,6 +90,8 @@ private:
                         .run(), values);
             boost::program_options::notify(values);
 
+            cli::utility::checkSquashfsOptions(values);
+
             parsePathOfArchiveToBeLoaded(argsGroups[1]);
 
             conf->imageID = cli::utility::parseImageID(argsGroups[2]);
@@ -109,6 +112,12 @@ private:
                                 " (archive's path is expected to be a single token without options)")
         }
 
+        // "-" means that the archive is read from the standard input
+        if(std::string{archiveArgs.argv()[0]} == "-") {
+            conf->archivePath = "-";
+            return;
+        }
+
         try {
             conf->archivePath = boost::filesystem::absolute(archiveArgs.argv()[0]);
         } catch(const std::exception& e) {
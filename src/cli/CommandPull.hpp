@@ -70,8 +70,12 @@ private:
             ("temp-dir",
                 boost::program_options::value<std::string>(&conf->directories.tempFromCLI),
                 "Temporary directory where the image is expanded")
+            ("max-concurrent-downloads",
+                boost::program_options::value<size_t>(&conf->commandPull.maxConcurrentDownloads),
+                "Max number of layers downloaded at the same time")
             ("login", "Enter user credentials for private repository")
             ("centralized-repository", "Use centralized repository instead of the local one");
+        cli::utility::addSquashfsOptions(optionsDescription, conf->squashfs);
     }
 
     void parseCommandArguments(const std::deque<common::CLIArguments>& argsGroups) {
@@ -91,6 +95,12 @@ private:
                         .run(), values);
             boost::program_options::notify(values);
 
+            if(values.count("max-concurrent-downloads") && conf->commandPull.maxConcurrentDownloads == 0) {
+                SARUS_THROW_ERROR("the value of --max-concurrent-downloads must be greater than zero");
+            }
+
+            cli::utility::checkSquashfsOptions(values);
+
             if(values.count("login")) {
                 conf->authentication.isAuthenticationNeeded = true;
                 readUserCredentialsFromCLI(conf->authentication);
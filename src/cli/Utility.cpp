@@ -134,6 +134,43 @@ common::ImageID parseImageID(const std::string &input) {
     return imageID;
 }
 
+/**
+ * Add the options of the squashfs image's build profile (overriding the "squashfs"
+ * object of the configuration file) to the options of a command
+ */
+void addSquashfsOptions(boost::program_options::options_description& optionsDescription,
+                        common::Config::Squashfs& squashfs) {
+    optionsDescription.add_options()
+        ("squashfs-compressor",
+            boost::program_options::value<std::string>(&squashfs.compressor),
+            "Compressor of the squashfs image (gzip, lz4, zstd or xz)")
+        ("squashfs-compression-level",
+            boost::program_options::value<size_t>(&squashfs.compressionLevel),
+            "Compression level of the squashfs image (gzip and zstd only)")
+        ("squashfs-block-size",
+            boost::program_options::value<size_t>(&squashfs.blockSize),
+            "Block size in KB of the squashfs image")
+        ("squashfs-processors",
+            boost::program_options::value<size_t>(&squashfs.processors),
+            "Number of processors used by mksquashfs")
+        ("squashfs-mem",
+            boost::program_options::value<size_t>(&squashfs.memory),
+            "Memory in MB used by mksquashfs");
+}
+
+/**
+ * Check the numeric options of the squashfs image's build profile (0 means
+ * that the option is not specified, hence it cannot be a valid value)
+ */
+void checkSquashfsOptions(const boost::program_options::variables_map& values) {
+    for(const auto* option : {"squashfs-compression-level", "squashfs-block-size", "squashfs-processors", "squashfs-mem"}) {
+        if(values.count(option) && values[option].as<size_t>() == 0) {
+            auto message = boost::format("the value of --%s must be greater than zero") % option;
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+}
+
 void printLog(const std::string& message, common::logType logType, std::ostream& outStream, std::ostream& errStream) {
     auto systemName = "CLI";
     common::Logger::getInstance().log(message, systemName, logType, outStream, errStream);
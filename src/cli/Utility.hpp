@@ -32,6 +32,11 @@ common::ImageID parseImageID(const common::CLIArguments& imageArgs);
 
 common::ImageID parseImageID(const std::string& input);
 
+void addSquashfsOptions(boost::program_options::options_description& optionsDescription,
+                        common::Config::Squashfs& squashfs);
+
+void checkSquashfsOptions(const boost::program_options::variables_map& values);
+
 void printLog(  const std::string& message, common::logType logType,
                 std::ostream& outStream=std::cout, std::ostream& errStream=std::cerr);
 
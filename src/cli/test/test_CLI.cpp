@@ -126,6 +126,11 @@ TEST(CLITestGroup, generated_config_for_CommandLoad) {
     CHECK_EQUAL(conf.imageID.tag, std::string{"tag"});
 }
 
+TEST(CLITestGroup, generated_config_for_CommandLoad_from_stdin) {
+    auto conf = generateConfig({"load", "-", "library/image:tag"});
+    CHECK_EQUAL(conf.archivePath.string(), std::string{"-"});
+}
+
 TEST(CLITestGroup, generated_config_for_CommandPull) {
     auto conf = generateConfig(
         {"pull",
@@ -136,6 +141,29 @@ TEST(CLITestGroup, generated_config_for_CommandPull) {
     CHECK(conf.imageID.repositoryNamespace == "user");
     CHECK(conf.imageID.image == "image");
     CHECK(conf.imageID.tag == "tag");
+    CHECK_EQUAL(conf.commandPull.maxConcurrentDownloads, 0);
+
+    auto confWithMaxConcurrentDownloads = generateConfig(
+        {"pull",
+        "--max-concurrent-downloads=5",
+        "image"});
+    CHECK_EQUAL(confWithMaxConcurrentDownloads.commandPull.maxConcurrentDownloads, 5);
+
+    auto confWithSquashfsOptions = generateConfig(
+        {"pull",
+        "--squashfs-compressor=zstd",
+        "--squashfs-compression-level=3",
+        "--squashfs-block-size=256",
+        "--squashfs-processors=2",
+        "--squashfs-mem=512",
+        "image"});
+    CHECK_EQUAL(confWithSquashfsOptions.squashfs.compressor, std::string{"zstd"});
+    CHECK_EQUAL(confWithSquashfsOptions.squashfs.compressionLevel, 3);
+    CHECK_EQUAL(confWithSquashfsOptions.squashfs.blockSize, 256);
+    CHECK_EQUAL(confWithSquashfsOptions.squashfs.processors, 2);
+    CHECK_EQUAL(confWithSquashfsOptions.squashfs.memory, 512);
+
+    CHECK_THROWS(common::Error, generateConfig({"pull", "--squashfs-processors=0", "image"}));
 }
 
 TEST(CLITestGroup, generated_config_for_CommandRmi) {
@@ -73,6 +73,19 @@ struct Config {
         std::string password;
     };
 
+    struct CommandPull {
+        size_t maxConcurrentDownloads = 0; // 0 means not specified in the CLI
+    };
+
+    struct Squashfs {
+        // empty or 0 means not specified in the CLI
+        std::string compressor;
+        size_t compressionLevel = 0;
+        size_t blockSize = 0; // KB
+        size_t processors = 0;
+        size_t memory = 0; // MB
+    };
+
     struct CommandRun {
         std::unordered_map<std::string, std::string> hostEnvironment;
         std::vector<std::string> userMounts;
@@ -93,6 +106,8 @@ struct Config {
     JSON json;
     UserIdentity userIdentity;
     Authentication authentication;
+    CommandPull commandPull;
+    Squashfs squashfs;
     CommandRun commandRun;
 
     boost::filesystem::path archivePath; // for CommandLoad
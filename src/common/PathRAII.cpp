@@ -42,6 +42,10 @@ PathRAII::~PathRAII() {
     }
 }
 
+bool PathRAII::hasPath() const {
+    return static_cast<bool>(path);
+}
+
 const boost::filesystem::path& PathRAII::getPath() const {
     return *path;
 }
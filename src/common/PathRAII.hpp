@@ -30,6 +30,7 @@ public:
     PathRAII& operator=(PathRAII&&);
     ~PathRAII();
 
+    bool hasPath() const;
     const boost::filesystem::path& getPath() const;
     void release();
 
@@ -0,0 +1,27 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "ArchiveFilters.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+void supportDecompressionFilters(::archive* arc) {
+    archive_read_support_filter_all(arc);
+
+#if ARCHIVE_VERSION_NUMBER < 3003003
+    static const char zstdMagicNumber[] = { '\x28', '\xb5', '\x2f', '\xfd' };
+    archive_read_support_filter_program_signature(arc, "zstd -d -q -c", zstdMagicNumber, sizeof(zstdMagicNumber));
+#endif
+}
+
+}
+}
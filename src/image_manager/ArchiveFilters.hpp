@@ -0,0 +1,35 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_ArchiveFilters_hpp
+#define sarus_image_manager_ArchiveFilters_hpp
+
+#include <archive.h> // libarchive
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * Enable all the decompression filters on an archive opened for reading.
+ *
+ * The compression of a layer is detected from its content (the schema 1 manifests
+ * don't carry media types), hence the zstd layers (OCI media type
+ * application/vnd.oci.image.layer.v1.tar+zstd) are handled like the gzip layers.
+ * libarchive decompresses zstd in process when it is built with libzstd and with the
+ * external zstd program otherwise. libarchive older than 3.3.3 doesn't know zstd at
+ * all, in which case the external program is registered explicitly.
+ */
+void supportDecompressionFilters(::archive* arc);
+
+}
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "CpprestHttpTransport.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+CpprestHttpTransport::CpprestHttpTransport(std::shared_ptr<const common::Config> config)
+    : config{std::move(config)}
+{}
+
+web::http::http_response CpprestHttpTransport::request(const std::string& baseUri,
+                                                       web::http::http_request request,
+                                                       bool useCredentials,
+                                                       std::chrono::seconds timeout) {
+    auto client = getClient(baseUri, useCredentials, timeout);
+    return client->request(request).get();
+}
+
+/**
+ * Get the client of the specified server (create it if necessary)
+ */
+std::shared_ptr<web::http::client::http_client> CpprestHttpTransport::getClient(const std::string& baseUri,
+                                                                                bool useCredentials,
+                                                                                std::chrono::seconds timeout) {
+    // the user's credentials are only set in the clients that need them,
+    // i.e. they are never sent to the storage services the registry redirects to
+    useCredentials = useCredentials && config->authentication.isAuthenticationNeeded;
+    auto key = (boost::format("%s|credentials=%d|timeout=%d") % baseUri % useCredentials % timeout.count()).str();
+
+    std::lock_guard<std::mutex> lock{clientsMutex};
+
+    auto it = clients.find(key);
+    if(it != clients.cend()) {
+        return it->second;
+    }
+
+    printLog(boost::format("Creating HTTP client for %s (credentials=%s)") % baseUri % useCredentials,
+             common::logType::DEBUG);
+
+    auto clientConfig = web::http::client::http_client_config{};
+    if(useCredentials) {
+        auto credentials = web::credentials{ U(config->authentication.username), U(config->authentication.password) };
+        clientConfig.set_credentials(credentials);
+    }
+    if(timeout.count() > 0) {
+        clientConfig.set_timeout(timeout);
+    }
+    auto client = std::make_shared<web::http::client::http_client>(U(baseUri), clientConfig);
+    clients[key] = client;
+    return client;
+}
+
+void CpprestHttpTransport::printLog(const boost::format& message, common::logType logType) const {
+    common::Logger::getInstance().log(message.str(), "CpprestHttpTransport", logType);
+}
+
+}
+}
@@ -0,0 +1,63 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_CpprestHttpTransport_hpp
+#define sarus_image_manager_CpprestHttpTransport_hpp
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <cpprest/http_client.h>
+#include <boost/format.hpp>
+
+#include "common/Config.hpp"
+#include "common/Logger.hpp"
+#include "image_manager/HttpTransport.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * HTTP transport based on cpprestsdk.
+ *
+ * One http_client is created per server and kept for the lifetime of the
+ * transport, so that all the requests to the same server (e.g. the layers
+ * downloaded by the different worker threads) share the client's pool of
+ * keep-alive connections instead of performing a new TCP + TLS handshake
+ * for every request.
+ */
+class CpprestHttpTransport : public HttpTransport {
+public:
+    CpprestHttpTransport(std::shared_ptr<const common::Config> config);
+
+    web::http::http_response request(const std::string& baseUri,
+                                     web::http::http_request request,
+                                     bool useCredentials=false,
+                                     std::chrono::seconds timeout=std::chrono::seconds{0}) override;
+
+private:
+    std::shared_ptr<web::http::client::http_client> getClient(const std::string& baseUri,
+                                                              bool useCredentials,
+                                                              std::chrono::seconds timeout);
+    void printLog(const boost::format& message, common::logType logType) const;
+
+private:
+    std::shared_ptr<const common::Config> config;
+    std::unordered_map<std::string, std::shared_ptr<web::http::client::http_client>> clients;
+    std::mutex clientsMutex;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "FileDeduplicator.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+#include <unistd.h>
+
+#include "common/Error.hpp"
+#include "common/Utility.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * Record the digest of the content of a file, or forget the inode if the digest is empty
+ * (the method is called by the threads that write the files)
+ */
+void FileDeduplicator::addFile(const struct stat& fileStat, const std::string& digest) {
+    auto inode = std::make_pair(fileStat.st_dev, fileStat.st_ino);
+    std::lock_guard<std::mutex> lock{mutex};
+    if(digest.empty()) {
+        digests.erase(inode);
+    }
+    else {
+        digests[inode] = digest;
+    }
+}
+
+FileDeduplicator::Statistics FileDeduplicator::deduplicate(const boost::filesystem::path& rootDirectory) {
+    using Key = std::tuple<std::string, off_t, mode_t, uid_t, gid_t, time_t, long>;
+
+    auto statistics = Statistics{};
+    auto files = std::map<Key, std::pair<ino_t, boost::filesystem::path>>{};
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    // the symbolic links are not followed
+    for(auto it = boost::filesystem::recursive_directory_iterator{rootDirectory};
+        it != boost::filesystem::recursive_directory_iterator{};
+        ++it) {
+        struct stat st;
+        if(lstat(it->path().c_str(), &st) != 0) {
+            if(errno == ENOENT) {
+                continue; // a hard link renamed over a duplicated file
+            }
+            auto message = boost::format("Failed to stat %s: %s") % it->path() % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        if(!S_ISREG(st.st_mode) || st.st_size == 0) {
+            continue;
+        }
+
+        auto digest = digests.find(std::make_pair(st.st_dev, st.st_ino));
+        if(digest == digests.cend()) {
+            continue;
+        }
+
+        auto key = Key{digest->second, st.st_size, st.st_mode, st.st_uid, st.st_gid,
+                       st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+        auto file = files.find(key);
+        if(file == files.cend()) {
+            files[key] = std::make_pair(st.st_ino, it->path());
+        }
+        else if(file->second.first != st.st_ino) {
+            replaceWithHardLink(it->path(), file->second.second);
+            // the space (and the inode, which might be reused by a new file)
+            // is freed when the last link to the duplicated inode is replaced
+            if(st.st_nlink == 1) {
+                statistics.savedBytes += st.st_size;
+                digests.erase(digest);
+            }
+            ++statistics.numberOfLinkedFiles;
+        }
+    }
+
+    log(boost::format("replaced %s duplicated files with hard links (%s bytes saved)")
+        % statistics.numberOfLinkedFiles % statistics.savedBytes, common::logType::INFO);
+
+    return statistics;
+}
+
+// Replace the file atomically with a hard link to the target
+// (the link is created next to the file, then renamed over the file)
+void FileDeduplicator::replaceWithHardLink( const boost::filesystem::path& file,
+                                            const boost::filesystem::path& target) const {
+    auto link = common::makeUniquePathWithRandomSuffix(file.parent_path() / ".sarus-dedup");
+    if(::link(target.c_str(), link.c_str()) != 0) {
+        auto message = boost::format("Failed to create hard link %s to %s: %s") % link % target % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    if(rename(link.c_str(), file.c_str()) != 0) {
+        auto errorCode = errno;
+        unlink(link.c_str());
+        auto message = boost::format("Failed to replace %s with hard link to %s: %s")
+            % file % target % strerror(errorCode);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+void FileDeduplicator::log(const boost::format& message, common::logType level) const {
+    common::Logger::getInstance().log(message.str(), "FileDeduplicator", level);
+}
+
+}
+}
@@ -0,0 +1,68 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_FileDeduplicator_hpp
+#define sarus_image_manager_FileDeduplicator_hpp
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include "common/Logger.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class replaces the byte-identical regular files of an expanded root filesystem
+ * with hard links to a single file, so that the duplicated files (e.g. the same shared
+ * libraries in multiple environments) take space only once in the temporary directory
+ * and are read only once by mksquashfs.
+ *
+ * The digests of the files are computed while the files are extracted (from the data
+ * already read from the layers) and are recorded by inode: a file replaced by an upper
+ * layer is a new inode, whose digest is recorded when it is written. Hence, the files
+ * whose inode has no recorded digest are never deduplicated.
+ *
+ * Only the files with the same digest, size, permissions, owner and modification time
+ * are linked, because the hard links share the metadata of the file.
+ */
+class FileDeduplicator {
+public:
+    struct Statistics {
+        size_t numberOfLinkedFiles = 0;
+        uintmax_t savedBytes = 0;
+    };
+
+public:
+    void addFile(const struct stat& fileStat, const std::string& digest);
+    Statistics deduplicate(const boost::filesystem::path& rootDirectory);
+
+private:
+    void replaceWithHardLink(   const boost::filesystem::path& file,
+                                const boost::filesystem::path& target) const;
+    void log(const boost::format& message, common::logType level) const;
+
+private:
+    std::mutex mutex;
+    std::map<std::pair<dev_t, ino_t>, std::string> digests;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_HttpTransport_hpp
+#define sarus_image_manager_HttpTransport_hpp
+
+#include <chrono>
+#include <string>
+
+#include <cpprest/http_client.h>
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class is the interface of the HTTP transport used to communicate with
+ * the registries (and with the storage services the registries redirect to).
+ *
+ * The requests and the responses are represented with the cpprestsdk types,
+ * which are the HTTP vocabulary of the image manager. An implementation based
+ * on a different HTTP library (e.g. libcurl with HTTP/2 multiplexing) has to
+ * convert from/to these types.
+ *
+ * Implementations must allow concurrent requests from multiple threads.
+ */
+class HttpTransport {
+public:
+    virtual ~HttpTransport() = default;
+
+    /**
+     * Sends the request to the server and returns the response as soon as the
+     * response's headers are received (the body can be read as a stream).
+     *
+     * @param baseUri           The scheme and the authority of the server (e.g. "https://registry-1.docker.io")
+     * @param request           The request (the request URI is relative to baseUri)
+     * @param useCredentials    Whether the user's credentials (sarus pull --login) are sent to the server
+     * @param timeout           The max time to wait for the server (zero = default timeout of the transport)
+     */
+    virtual web::http::http_response request(const std::string& baseUri,
+                                             web::http::http_request request,
+                                             bool useCredentials=false,
+                                             std::chrono::seconds timeout=std::chrono::seconds{0}) = 0;
+};
+
+}
+}
+
+#endif
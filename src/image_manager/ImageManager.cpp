@@ -20,7 +20,10 @@
 #include "common/Error.hpp"
 #include "common/Utility.hpp"
 #include "image_manager/LoadedImage.hpp"
+#include "image_manager/ScratchDirectorySelector.hpp"
+#include "image_manager/TrashDirectory.hpp"
 #include "image_manager/SquashfsImage.hpp"
+#include "image_manager/SquashfsOptions.hpp"
 
 
 namespace sarus {
@@ -41,8 +44,24 @@ namespace image_manager {
 
         printLog(boost::format("Pulling image %s") % config->imageID, common::logType::INFO);
 
-        auto pulledImage = puller.pull();
-        processImage(pulledImage);
+        // nothing to do if the repository already contains the same image
+        auto manifest = puller.getManifest();
+        auto image = PulledImage{config, manifest};
+        auto digest = image.getDigest();
+        if(isImageInRepository(digest)) {
+            printLog(boost::format("# image %s is up to date (digest %s)") % config->imageID % digest,
+                     common::logType::GENERAL);
+            return;
+        }
+
+        // fail before downloading the layers if the image cannot be expanded
+        // or the squashfs image cannot be built
+        auto scratchDirectory = selectScratchDirectory(image);
+        SquashfsOptions::validate(*config);
+
+        // the layers are expanded as soon as they are downloaded
+        auto pulledImage = puller.startPull();
+        processImage(pulledImage, scratchDirectory);
 
         printLog(boost::format("Successfully pulled image"), common::logType::INFO);
     }
@@ -54,10 +73,11 @@ namespace image_manager {
         issueErrorIfIsCentralizedRepositoryAndCentralizedRepositoryIsDisabled();
         issueWarningIfIsCentralizedRepositoryAndIsNotRootUser();
 
-        printLog(boost::format("Loading image archive %s") % archive, common::logType::INFO);
+        printLog(boost::format("Loading image archive %s") % (archive == "-" ? std::string{"from standard input"} : archive.string()), common::logType::INFO);
 
+        SquashfsOptions::validate(*config); // fail before expanding the image if the squashfs options are invalid
         auto loadedImage = LoadedImage{config, archive};
-        processImage(loadedImage);
+        processImage(loadedImage, selectScratchDirectory(loadedImage));
         
         printLog(boost::format("Successfully loaded image archive"), common::logType::INFO);
     }
@@ -90,18 +110,33 @@ namespace image_manager {
         printLog(boost::format("successfully removed image"), common::logType::INFO);
     }
 
-    void ImageManager::processImage(const InputImage& image) {
-        common::PathRAII expandedImage;
+    void ImageManager::processImage(InputImage& image, const boost::filesystem::path& scratchDirectory) {
+        image.setScratchDirectory(scratchDirectory);
+
+        // remove the trees left behind by previous commands, e.g. if interrupted
+        auto trash = TrashDirectory{config};
+        if(trash.isEnabled()) {
+            trash.emptyInBackground();
+        }
+
         common::ImageMetadata metadata;
         std::string digest;
-        std::tie(expandedImage, metadata, digest) = image.expand();
+        common::PathRAII squashfsRAII;
+        common::PathRAII expandedImage;
+
+        if(isStreamingToSquashfsEnabled()) {
+            std::tie(metadata, digest) = image.expandToSquashfs(config->getImageFile());
+            squashfsRAII = common::PathRAII{config->getImageFile()};
+        }
+        else {
+            std::tie(expandedImage, metadata, digest) = image.expand();
+            auto squashfs = SquashfsImage{*config, expandedImage.getPath(), config->getImageFile()};
+            squashfsRAII = common::PathRAII{squashfs.getPathOfImage()};
+        }
 
         metadata.write(config->getMetadataFileOfImage());
         auto metadataRAII = common::PathRAII{config->getMetadataFileOfImage()};
 
-        auto squashfs = SquashfsImage{*config, expandedImage.getPath(), config->getImageFile()};
-        auto squashfsRAII = common::PathRAII{squashfs.getPathOfImage()};
-
         auto imageSize = common::getFileSize(config->getImageFile());
         auto imageSizeString = common::SarusImage::createSizeString(imageSize);
         auto created = common::SarusImage::createTimeString(std::time(nullptr));
@@ -117,6 +152,55 @@ namespace image_manager {
 
         metadataRAII.release();
         squashfsRAII.release();
+
+        // the image is usable: remove the expanded image in background
+        trash.discard(expandedImage);
+        if(trash.isEnabled()) {
+            trash.emptyInBackground();
+        }
+    }
+
+    /**
+     * Select the directory where the image is expanded, according to the space that the
+     * expansion is estimated to need
+     */
+    boost::filesystem::path ImageManager::selectScratchDirectory(const InputImage& image) const {
+        auto requiredSpace = image.estimateScratchSpace(!isStreamingToSquashfsEnabled());
+        return ScratchDirectorySelector{config}.select(requiredSpace);
+    }
+
+    /**
+     * Check whether the squashfs image is built directly from the layers' tar streams
+     * (without expanding the layers into the temporary directory)
+     */
+    bool ImageManager::isStreamingToSquashfsEnabled() const {
+        const auto& json = config->json.get();
+        return json.HasMember("expansion")
+            && json["expansion"].HasMember("streamToSquashfs")
+            && json["expansion"]["streamToSquashfs"].GetBool();
+    }
+
+    /**
+     * Check whether the repository contains the image with the specified digest
+     * (and the image's files were not removed)
+     */
+    bool ImageManager::isImageInRepository(const std::string& digest) const {
+        auto image = imageStore.findImage(config->imageID);
+        if(!image) {
+            printLog(boost::format("image %s not found in repository") % config->imageID, common::logType::DEBUG);
+            return false;
+        }
+        if(image->digest != digest) {
+            printLog(boost::format("image %s in repository has different digest (%s)") % config->imageID % image->digest,
+                     common::logType::DEBUG);
+            return false;
+        }
+        if(!boost::filesystem::exists(image->imageFile) || !boost::filesystem::exists(image->metadataFile)) {
+            printLog(boost::format("files of image %s in repository are missing") % config->imageID,
+                     common::logType::DEBUG);
+            return false;
+        }
+        return true;
     }
 
     void ImageManager::issueErrorIfIsCentralizedRepositoryAndCentralizedRepositoryIsDisabled() const {
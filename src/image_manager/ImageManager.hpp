@@ -34,7 +34,10 @@ public:
     std::vector<common::SarusImage> listImages() const;
 
 private:
-    void processImage(const InputImage& image);
+    void processImage(InputImage& image, const boost::filesystem::path& scratchDirectory);
+    boost::filesystem::path selectScratchDirectory(const InputImage& image) const;
+    bool isImageInRepository(const std::string& digest) const;
+    bool isStreamingToSquashfsEnabled() const;
     void issueWarningIfIsCentralizedRepositoryAndIsNotRootUser() const;
     void issueErrorIfIsCentralizedRepositoryAndCentralizedRepositoryIsDisabled() const;
     void printLog(const boost::format& message, common::logType logType) const;
@@ -150,6 +150,19 @@ namespace image_manager {
         return images;
     }
 
+    /**
+     * Find the container image in the repository
+     */
+    boost::optional<common::SarusImage> ImageStore::findImage(const common::ImageID& imageID) const {
+        auto uniqueKey = imageID.getUniqueKey();
+        for(const auto& image : listImages()) {
+            if(image.imageID.getUniqueKey() == uniqueKey) {
+                return image;
+            }
+        }
+        return boost::none;
+    }
+
     rapidjson::Document ImageStore::readRepositoryMetadata() const {
         rj::Document metadata;
 
@@ -17,6 +17,7 @@
 #include <memory>
 
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 #include <rapidjson/document.h>
 
 #include "common/Config.hpp"
@@ -33,6 +34,7 @@ public:
     void addImage(const common::SarusImage&);
     void removeImage(const common::ImageID&);
     std::vector<common::SarusImage> listImages() const;
+    boost::optional<common::SarusImage> findImage(const common::ImageID&) const;
     const boost::filesystem::path& getMetadataFile() const { return metadataFile; }
 
 private:
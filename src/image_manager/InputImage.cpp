@@ -10,10 +10,24 @@
 
 #include "InputImage.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <map>
+#include <numeric>
+#include <utility>
+#include <unistd.h>
+#include <thread>
+#include <unordered_set>
+#include <sys/stat.h>
 #include <archive_entry.h> // libarchive
 
 #include "common/Utility.hpp"
+#include "image_manager/ArchiveFilters.hpp"
+#include "image_manager/LayerMergeIndex.hpp"
+#include "image_manager/LayerDecompressor.hpp"
+#include "image_manager/LayerSnapshotCache.hpp"
+#include "image_manager/RootfsWriter.hpp"
+#include "image_manager/SquashfsImage.hpp"
 
 
 namespace sarus {
@@ -21,14 +35,53 @@ namespace image_manager {
 
 InputImage::InputImage(std::shared_ptr<const common::Config> config)
     : config{std::move(config)}
+    , scratchDirectory{this->config->directories.temp}
 {}
 
+// Estimate the space needed in the scratch directory by the expansion of the image
+// (by default the space is unknown)
+boost::optional<uintmax_t> InputImage::estimateScratchSpace(bool) const {
+    return boost::none;
+}
+
+// Set the directory where the image is expanded (by default the temporary directory)
+void InputImage::setScratchDirectory(const boost::filesystem::path& directory) {
+    scratchDirectory = directory;
+}
+
+// Hook invoked right before the expansion of each layer: wait at most the specified
+// time and return whether the layer is available. By default the layers' archives
+// are expected to be already available on the filesystem.
+bool InputImage::waitUntilLayerIsAvailable(const boost::filesystem::path& layerArchive,
+                                           std::chrono::milliseconds timeout) const {
+    return true;
+}
+
 boost::filesystem::path InputImage::makeTemporaryExpansionDirectory() const {
-    auto tempExpansionDir = common::makeUniquePathWithRandomSuffix(config->directories.temp / "expansion-directory");
+    auto tempExpansionDir = common::makeUniquePathWithRandomSuffix(scratchDirectory / "expansion-directory");
     common::createFoldersIfNecessary(tempExpansionDir);
     return tempExpansionDir;
 }
 
+// Estimate the space needed in the scratch directory by the expansion of layers with the
+// specified (uncompressed) sizes: the root filesystem, if expanded, and the decompressed
+// layers staged by the decompression threads (all of them with the topDown merge strategy)
+uintmax_t InputImage::estimateScratchSpaceOfLayers(const std::vector<uintmax_t>& sizesOfLayers,
+                                                   bool isRootfsExpanded) const {
+    if(!isRootfsExpanded) {
+        return 0; // the layers are streamed into mksquashfs without being staged
+    }
+
+    auto sizeOfRootfs = std::accumulate(sizesOfLayers.cbegin(), sizesOfLayers.cend(), uintmax_t{0});
+    auto sizeOfLargestLayer = sizesOfLayers.empty()
+        ? uintmax_t{0}
+        : *std::max_element(sizesOfLayers.cbegin(), sizesOfLayers.cend());
+    auto sizeOfStagedLayers = isTopDownMergeEnabled()
+        ? sizeOfRootfs
+        : std::min(sizeOfRootfs, sizeOfLargestLayer * getNumberOfDecompressionThreads());
+    return sizeOfRootfs + sizeOfStagedLayers;
+}
+
 void InputImage::expandLayers(  const std::vector<boost::filesystem::path>& layersPaths,
                                 const boost::filesystem::path& expandDir) const {
     log(boost::format("expanding image layers"), common::logType::INFO);
@@ -36,56 +89,396 @@ void InputImage::expandLayers(  const std::vector<boost::filesystem::path>& laye
 
     auto timeStart = std::chrono::system_clock::now();
 
-    std::vector<std::string> excludePattern = {"^dev/", "^/", "../", ".wh.*"};
-    const std::string sha256OfEmptyTarArchive = "sha256:a3ed95caeb02ffe68cdd9fd84406680ae93d633cb16422d00e8a7c22955b46d4";
+    if(isTopDownMergeEnabled()) {
+        expandLayersTopDown(layersPaths, expandDir);
+    }
+    else {
+        expandLayersBottomUp(layersPaths, expandDir);
+    }
 
-    // expand layers (from parent to child)
-    for (const auto archivePath : layersPaths) {
-        // skip empty layer
-        if(archivePath.filename().string() == (sha256OfEmptyTarArchive + ".tar") ) {
-            continue;
-        }
+    log(boost::format("making expanded layers readable by the world"), common::logType::DEBUG);
+
+    auto timeEnd = std::chrono::system_clock::now();
+    auto timeElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(timeEnd - timeStart).count() / double(1000);
+    log(boost::format("Elapsed time expansion: %s [s]") % timeElapsed, common::logType::INFO);
+
+    log(boost::format("successfully expanded image layers"), common::logType::INFO);
+}
+
+// Extract the layers one after the other, from parent to child. The whiteouts of
+// each layer remove the files of the parent layers that were already extracted.
+void InputImage::expandLayersBottomUp(  const std::vector<boost::filesystem::path>& layersPaths,
+                                        const boost::filesystem::path& expandDir) const {
+    auto layers = getNonEmptyLayers(layersPaths);
+
+    RootfsWriter rootfs{expandDir, getNumberOfWriterThreads(), isFileDeduplicationEnabled()};
+
+    // start from the snapshot of the longest chain of base layers that was already expanded
+    auto snapshotCache = LayerSnapshotCache{config};
+    auto chainIDs = snapshotCache.isEnabled() ? getChainIDsOfLayers(layers) : std::vector<std::string>{};
+    auto numberOfRestoredLayers = chainIDs.empty() ? 0 : snapshotCache.restoreLongestChain(chainIDs, expandDir, rootfs);
+    if(numberOfRestoredLayers > 0) {
+        log(boost::format("> %-15.15s: %s of %s layers") % "restored" % numberOfRestoredLayers % layers.size(),
+            common::logType::GENERAL);
+    }
 
-        if(!boost::filesystem::exists(archivePath) ) {
-            SARUS_THROW_ERROR("Missing layer archive: " + archivePath.string());
+    auto layersToExtract = std::vector<boost::filesystem::path>(layers.cbegin() + numberOfRestoredLayers, layers.cend());
+    auto numberOfThreads = getNumberOfDecompressionThreads();
+    LayerDecompressor decompressor{layersToExtract, makeStagingDirectory(), numberOfThreads, numberOfThreads,
+                                   [this](const boost::filesystem::path& layer, std::chrono::milliseconds timeout) {
+                                       return waitUntilLayerIsAvailable(layer, timeout);
+                                   },
+                                   [this](::archive* arc, const boost::filesystem::path& layer, size_t blockSize) {
+                                       return openArchive(arc, layer, blockSize);
+                                   }};
+
+    for(size_t i = 0; i < layersToExtract.size(); ++i) {
+        auto layer = numberOfRestoredLayers + i;
+        auto archivePath = decompressor.getDecompressedLayer(i);
+
+        log(boost::format("> %-15.15s: %s") % "extracting" % layers[layer], common::logType::GENERAL);
+
+        // extract layer tarfile & apply whiteouts (in a single pass)
+        extractLayer(archivePath, rootfs);
+
+        decompressor.releaseDecompressedLayer(i);
+
+        // snapshot the base layers of the image, i.e. all the layers but the top one,
+        // which are likely to be shared with other images (the directories keep their
+        // temporary permissions until the top layer is extracted)
+        if(!chainIDs.empty() && layer + 2 == layers.size()) {
+            rootfs.flush();
+            snapshotCache.store(chainIDs[layer], expandDir, rootfs);
         }
+    }
 
-        log(boost::format("> %-15.15s: %s") % "extracting" % archivePath, common::logType::GENERAL);
+    rootfs.finish();
+}
 
-        // extract layer tarfile & get whiteouts list
-        auto whiteouts = readWhiteoutsInLayer(archivePath);
-        applyWhiteouts(whiteouts, expandDir);
+// Index the headers of all the layers first, then extract from each layer only
+// the entries that belong to the merged file set, i.e. the entries that are
+// neither whited out nor replaced by an upper layer. Each file is written once,
+// at the cost of reading each layer's archive twice (the compressed archives are
+// decompressed once into the staging directory, unless the decompression threads
+// are disabled).
+void InputImage::expandLayersTopDown(   const std::vector<boost::filesystem::path>& layersPaths,
+                                        const boost::filesystem::path& expandDir) const {
+    auto layers = getNonEmptyLayers(layersPaths);
+    LayerDecompressor decompressor{layers, makeStagingDirectory(), getNumberOfDecompressionThreads(), 0,
+                                   [this](const boost::filesystem::path& layer, std::chrono::milliseconds timeout) {
+                                       return waitUntilLayerIsAvailable(layer, timeout);
+                                   },
+                                   [this](::archive* arc, const boost::filesystem::path& layer, size_t blockSize) {
+                                       return openArchive(arc, layer, blockSize);
+                                   }};
+    auto index = LayerMergeIndex{};
+
+    for(size_t layer = 0; layer < layers.size(); ++layer) {
+        auto archivePath = decompressor.getDecompressedLayer(layer);
+
+        log(boost::format("> %-15.15s: %s") % "indexing" % layers[layer], common::logType::GENERAL);
+
+        indexLayer(archivePath, layer, index);
+    }
 
-        extractArchiveWithExcludePatterns(archivePath, excludePattern, expandDir);
+    index.finalize();
+    log(boost::format("merged file set of the layers has %s entries") % index.getNumberOfEntries(),
+        common::logType::DEBUG);
 
-        // change permissions for this user (+rw for files, +rwx for directories)
-        for(auto it = boost::filesystem::recursive_directory_iterator{expandDir};
-            it != boost::filesystem::recursive_directory_iterator{};
-            ++it) {
-            if(boost::filesystem::is_symlink(it->path())) {
-                continue; // skip symbolik links
+    RootfsWriter rootfs{expandDir, getNumberOfWriterThreads(), isFileDeduplicationEnabled()};
+
+    for(size_t layer = 0; layer < layers.size(); ++layer) {
+        auto archivePath = decompressor.getDecompressedLayer(layer);
+
+        log(boost::format("> %-15.15s: %s") % "extracting" % layers[layer], common::logType::GENERAL);
+
+        extractArchiveEntries(archivePath, LAYER_EXCLUDE_PATTERNS, rootfs, [&](::archive_entry* entry) {
+            if(!selectEntryOfMergedLayers(index, layer, entry)) {
+                return false;
             }
+            addOwnerPermissions(entry);
+            return true;
+        });
+
+        decompressor.releaseDecompressedLayer(layer);
+    }
+
+    rootfs.finish();
+}
 
-            boost::filesystem::permissions(it->path(), boost::filesystem::add_perms
-                                                    | boost::filesystem::owner_read
-                                                    | boost::filesystem::owner_write);
+// Build the squashfs image directly from the merged layers, without expanding the
+// layers into the temporary directory. The headers of all the layers are indexed
+// first, then the entries that belong to the merged file set are streamed to
+// mksquashfs as a single tar archive (the directories first, so that the parent
+// directories always precede their contents).
+void InputImage::streamLayersToSquashfs(const std::vector<boost::filesystem::path>& layersPaths,
+                                        const boost::filesystem::path& pathOfImage) const {
+    log(boost::format("streaming image layers to squashfs image %s") % pathOfImage, common::logType::INFO);
+    log(boost::format("> expanding image layers ..."), common::logType::GENERAL);
+
+    auto timeStart = std::chrono::system_clock::now();
 
-            if(boost::filesystem::is_directory(it->path())) {
-                boost::filesystem::permissions(it->path(),  boost::filesystem::add_perms | boost::filesystem::owner_exe);
+    // the layers are not staged: the temporary directory might be too small
+    auto layers = getNonEmptyLayers(layersPaths);
+    LayerDecompressor decompressor{layers, makeStagingDirectory(), 0, 0,
+                                   [this](const boost::filesystem::path& layer, std::chrono::milliseconds timeout) {
+                                       return waitUntilLayerIsAvailable(layer, timeout);
+                                   },
+                                   [this](::archive* arc, const boost::filesystem::path& layer, size_t blockSize) {
+                                       return openArchive(arc, layer, blockSize);
+                                   }};
+    auto index = LayerMergeIndex{};
+    auto directories = std::map<std::string, std::pair<size_t, std::shared_ptr<::archive_entry>>>{};
+
+    for(size_t layer = 0; layer < layers.size(); ++layer) {
+        auto archivePath = decompressor.getDecompressedLayer(layer);
+
+        log(boost::format("> %-15.15s: %s") % "indexing" % layers[layer], common::logType::GENERAL);
+
+        indexLayer(archivePath, layer, index, [&](::archive_entry* entry) {
+            if(archive_entry_filetype(entry) == AE_IFDIR) {
+                auto entryPath = normalizeArchiveEntryPath(archive_entry_pathname(entry)).string();
+                auto clone = std::shared_ptr<::archive_entry>{archive_entry_clone(entry), archive_entry_free};
+                directories[entryPath] = std::make_pair(layer, std::move(clone));
             }
-        }
+        });
     }
 
-    log(boost::format("making expanded layers readable by the world"), common::logType::DEBUG);
+    index.finalize();
+    log(boost::format("merged file set of the layers has %s entries") % index.getNumberOfEntries(),
+        common::logType::DEBUG);
+
+    SquashfsImage{*config, [&](FILE* tarStream) {
+        auto out = std::unique_ptr<::archive, int(*)(::archive*)>{archive_write_new(), archive_write_free};
+        archive_write_set_format_pax_restricted(out.get());
+        if(archive_write_open_FILE(out.get(), tarStream) != ARCHIVE_OK) {
+            auto message = boost::format("failed to open tar stream (%s)") % archive_error_string(out.get());
+            SARUS_THROW_ERROR(message.str());
+        }
+
+        // std::map iterates the paths in lexicographic order, i.e. the parents first
+        for(const auto& directory : directories) {
+            if(directory.first == "." || !index.isOwnedBy(directory.first, directory.second.first)) {
+                continue;
+            }
+            writeEntryToTarStream(out.get(), nullptr, directory.second.second.get());
+        }
+
+        for(size_t layer = 0; layer < layers.size(); ++layer) {
+            auto archivePath = decompressor.getDecompressedLayer(layer);
+
+            log(boost::format("> %-15.15s: %s") % "streaming" % layers[layer], common::logType::GENERAL);
+
+            readArchive(archivePath, LAYER_EXCLUDE_PATTERNS, [&](::archive* in, ::archive_entry* entry) {
+                if(archive_entry_filetype(entry) == AE_IFDIR || !selectEntryOfMergedLayers(index, layer, entry)) {
+                    return;
+                }
+                writeEntryToTarStream(out.get(), in, entry);
+            });
+
+            decompressor.releaseDecompressedLayer(layer);
+        }
+
+        if(archive_write_close(out.get()) != ARCHIVE_OK) {
+            auto message = boost::format("failed to close tar stream (%s)") % archive_error_string(out.get());
+            SARUS_THROW_ERROR(message.str());
+        }
+    }, pathOfImage};
 
     auto timeEnd = std::chrono::system_clock::now();
     auto timeElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(timeEnd - timeStart).count() / double(1000);
-    log(boost::format("Elapsed time expansion: %s [s]") % timeElapsed, common::logType::INFO);
+    log(boost::format("Elapsed time expansion and mksquashfs: %s [s]") % timeElapsed, common::logType::INFO);
 
-    log(boost::format("successfully expanded image layers"), common::logType::INFO);
+    log(boost::format("successfully streamed image layers to squashfs image"), common::logType::INFO);
+}
+
+// Write the entry (and its data, read from the input archive) to the tar stream. The
+// entry is owned by the current user, as if it was extracted to the filesystem.
+void InputImage::writeEntryToTarStream(::archive* out, ::archive* in, ::archive_entry* entry) const {
+    archive_entry_set_uid(entry, geteuid());
+    archive_entry_set_gid(entry, getegid());
+    archive_entry_set_uname(entry, nullptr);
+    archive_entry_set_gname(entry, nullptr);
+    addOwnerPermissions(entry);
+
+    auto isHardlink = archive_entry_hardlink(entry) != nullptr;
+    if(isHardlink) {
+        archive_entry_set_size(entry, 0);
+    }
+
+    if(archive_write_header(out, entry) < ARCHIVE_WARN) {
+        auto message = boost::format("failed to write header of entry %s to tar stream (%s)")
+            % archive_entry_pathname(entry) % archive_error_string(out);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    if(in == nullptr || isHardlink || archive_entry_size(entry) <= 0) {
+        return;
+    }
+
+    char buffer[1 << 16];
+    while(true) {
+        auto size = archive_read_data(in, buffer, sizeof(buffer));
+        if(size == 0) {
+            break;
+        }
+        else if(size < 0) {
+            auto message = boost::format("failed to read data of entry %s (%s)")
+                % archive_entry_pathname(entry) % archive_error_string(in);
+            SARUS_THROW_ERROR(message.str());
+        }
+        if(archive_write_data(out, buffer, size) < 0) {
+            auto message = boost::format("failed to write data of entry %s to tar stream (%s)")
+                % archive_entry_pathname(entry) % archive_error_string(out);
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+}
+
+// Add the entries of the layer's archive to the index of the merged layers. The specified
+// function (if any) is invoked for each entry that is not a whiteout.
+void InputImage::indexLayer(const boost::filesystem::path& archivePath,
+                            size_t layer,
+                            LayerMergeIndex& index,
+                            const std::function<void(::archive_entry*)>& processEntry) const {
+    readArchive(archivePath, LAYER_EXCLUDE_PATTERNS, [&](::archive*, ::archive_entry* entry) {
+        auto entryPath = normalizeArchiveEntryPath(archive_entry_pathname(entry));
+        auto hardlink = archive_entry_hardlink(entry);
+        if(isWhiteout(entryPath)) {
+            index.addWhiteout(layer, entryPath.string());
+            return;
+        }
+        else if(hardlink) {
+            index.addHardlink(layer, entryPath.string(), normalizeArchiveEntryPath(hardlink).string());
+        }
+        else {
+            index.addEntry(layer, entryPath.string(), archive_entry_filetype(entry) == AE_IFDIR);
+        }
+        if(processEntry) {
+            processEntry(entry);
+        }
+    });
+}
+
+// Select the entries of the layer's archive that belong to the merged layers. The path
+// of the entry is modified if the entry provides the data of a hard link of the merged
+// layers, but the entry itself is hidden by an upper layer.
+bool InputImage::selectEntryOfMergedLayers( const LayerMergeIndex& index,
+                                            size_t layer,
+                                            ::archive_entry* entry) const {
+    auto entryPath = normalizeArchiveEntryPath(archive_entry_pathname(entry)).string();
+    auto hardlink = archive_entry_hardlink(entry);
+
+    if(isWhiteout(entryPath)) {
+        return false;
+    }
+    else if(hardlink) {
+        if(!index.isOwnedBy(entryPath, layer)) {
+            return false;
+        }
+        auto target = index.getRedirectedHardlinkTarget(layer, normalizeArchiveEntryPath(hardlink).string());
+        if(target && *target == entryPath) {
+            return false; // the target's data was already extracted to this path
+        }
+        else if(target) {
+            archive_entry_set_hardlink(entry, target->c_str());
+        }
+    }
+    else if(!index.isOwnedBy(entryPath, layer)) {
+        // the entry is hidden by an upper layer, but its data might still
+        // be needed by a hard link that belongs to the merged file set
+        auto target = index.getRedirectedHardlinkTarget(layer, entryPath);
+        if(!target) {
+            return false;
+        }
+        archive_entry_set_pathname(entry, target->c_str());
+    }
+
+    return true;
+}
+
+// Open the archive for reading (the archives are regular files, unless a derived
+// class provides them otherwise, e.g. as entries of another archive)
+int InputImage::openArchive(::archive* arc, const boost::filesystem::path& archivePath, size_t blockSize) const {
+    return archive_read_open_filename(arc, archivePath.c_str(), blockSize);
+}
+
+// Get the digest that identifies the content of the layer's archive (if known)
+boost::optional<std::string> InputImage::getLayerDigest(const boost::filesystem::path&) const {
+    return boost::none;
+}
+
+// Get the chain IDs of the layers (empty if the digest of any layer is unknown)
+std::vector<std::string> InputImage::getChainIDsOfLayers(const std::vector<boost::filesystem::path>& layers) const {
+    auto layerDigests = std::vector<std::string>{};
+    for(const auto& layer : layers) {
+        auto digest = getLayerDigest(layer);
+        if(!digest) {
+            log(boost::format("digest of layer %s is unknown: not using the layer snapshot cache") % layer,
+                common::logType::DEBUG);
+            return {};
+        }
+        layerDigests.push_back(*digest);
+    }
+    return LayerSnapshotCache::computeChainIDs(layerDigests);
+}
+
+std::vector<boost::filesystem::path> InputImage::getNonEmptyLayers(
+    const std::vector<boost::filesystem::path>& layersPaths) const {
+    auto layers = std::vector<boost::filesystem::path>{};
+    for(const auto& layer : layersPaths) {
+        if(!isEmptyLayer(layer)) {
+            layers.push_back(layer);
+        }
+    }
+    return layers;
+}
+
+boost::filesystem::path InputImage::makeStagingDirectory() const {
+    return common::makeUniquePathWithRandomSuffix(scratchDirectory / "staged-layers");
+}
+
+// Get the number of threads that decompress the layers (zero means that the
+// layers are decompressed by the expansion thread while they are extracted)
+size_t InputImage::getNumberOfDecompressionThreads() const {
+    const auto& json = config->json.get();
+    if(json.HasMember("expansion") && json["expansion"].HasMember("decompressionThreads")) {
+        return json["expansion"]["decompressionThreads"].GetUint();
+    }
+    auto hardwareConcurrency = size_t{std::thread::hardware_concurrency()};
+    return std::max(size_t{1}, std::min(DEFAULT_MAX_DECOMPRESSION_THREADS, hardwareConcurrency));
 }
 
-// Extract the specified archive into the current working directory
+// Get the number of threads that create the small files of the layers (zero means
+// that the files are created by the expansion thread while the layers are read)
+size_t InputImage::getNumberOfWriterThreads() const {
+    const auto& json = config->json.get();
+    if(json.HasMember("expansion") && json["expansion"].HasMember("writerThreads")) {
+        return json["expansion"]["writerThreads"].GetUint();
+    }
+    return DEFAULT_WRITER_THREADS;
+}
+
+bool InputImage::isFileDeduplicationEnabled() const {
+    const auto& json = config->json.get();
+    return json.HasMember("expansion")
+        && json["expansion"].HasMember("deduplicateFiles")
+        && json["expansion"]["deduplicateFiles"].GetBool();
+}
+
+bool InputImage::isTopDownMergeEnabled() const {
+    const auto& json = config->json.get();
+    return json.HasMember("expansion")
+        && json["expansion"].HasMember("mergeStrategy")
+        && json["expansion"]["mergeStrategy"].GetString() == std::string{"topDown"};
+}
+
+bool InputImage::isEmptyLayer(const boost::filesystem::path& layerArchive) const {
+    const std::string sha256OfEmptyTarArchive = "sha256:a3ed95caeb02ffe68cdd9fd84406680ae93d633cb16422d00e8a7c22955b46d4";
+    return layerArchive.filename().string() == (sha256OfEmptyTarArchive + ".tar");
+}
+
+// Extract the specified archive into the specified expand directory
 void InputImage::extractArchive(const boost::filesystem::path& archivePath,
                                 const boost::filesystem::path& expandDir) const {
     auto excludePatterns = std::vector<std::string>{};
@@ -97,25 +490,85 @@ void InputImage::extractArchive(const boost::filesystem::path& archivePath,
 void InputImage::extractArchiveWithExcludePatterns( const boost::filesystem::path& archivePath,
                                                     const std::vector<std::string> &excludePattern,
                                                     const boost::filesystem::path& expandDir) const {
+    RootfsWriter rootfs{expandDir, getNumberOfWriterThreads()};
+    extractArchiveEntries(archivePath, excludePattern, rootfs, [](::archive_entry*) {
+        return true;
+    });
+    rootfs.finish();
+}
+
+// Extract the specified layer archive into the root filesystem and apply the
+// layer's whiteouts to the content of the parent layers, which is already in
+// the root filesystem. The archive is decompressed only once: each whiteout is
+// applied as soon as it is read.
+void InputImage::extractLayer(  const boost::filesystem::path& layerArchive,
+                                RootfsWriter& rootfs) const {
+    // the paths extracted from the layer so far (including the implicit parent
+    // directories of the entries, which the archive might not list): a whiteout
+    // only applies to the parent layers, hence it must not remove the entries of
+    // its own layer that precede it in the archive
+    auto pathsInLayer = std::unordered_set<std::string>{};
+
+    extractArchiveEntries(layerArchive, LAYER_EXCLUDE_PATTERNS, rootfs, [&](::archive_entry* entry) {
+        auto entryPath = normalizeArchiveEntryPath(archive_entry_pathname(entry));
+
+        if(isWhiteout(entryPath)) {
+            log(boost::format("archive: entry is whiteout"), common::logType::DEBUG);
+            applyWhiteout(entryPath, rootfs, pathsInLayer);
+            return false;
+        }
+
+        for(auto path = entryPath; !path.empty(); path = path.parent_path()) {
+            if(!pathsInLayer.insert(path.string()).second) {
+                break; // the ancestors were already added
+            }
+        }
+
+        // make the entry accessible to this user (+rw for files, +rwx for directories),
+        // so that the upper layers and the squashfs conversion can access it
+        addOwnerPermissions(entry);
+        return true;
+    });
+}
+
+// Extract the entries of the specified archive that don't match the exclude patterns
+// and that are selected by the specified function (which can also modify the entry).
+void InputImage::extractArchiveEntries( const boost::filesystem::path& archivePath,
+                                        const std::vector<std::string> &excludePattern,
+                                        RootfsWriter& rootfs,
+                                        const std::function<bool(::archive_entry*)>& selectEntry) const {
     log(boost::format("extracting archive %s") % archivePath, common::logType::DEBUG);
 
-    auto cwd = boost::filesystem::current_path();
-    common::changeDirectory(expandDir);
+    readArchive(archivePath, excludePattern, [&](::archive* arc, ::archive_entry* entry) {
+        if(!selectEntry(entry)) {
+            log(boost::format("archive: skipping entry"), common::logType::DEBUG);
+            return;
+        }
+
+        // write entry
+        log(boost::format("archive: writing entry"), common::logType::DEBUG);
+        try {
+            rootfs.writeEntry(arc, entry);
+        }
+        catch(common::Error& e) {
+            auto message = boost::format("archive %s: error while writing entry %s")
+                % archivePath % archive_entry_pathname(entry);
+            SARUS_RETHROW_ERROR(e, message.str());
+        }
+    });
 
-    /* Select which attributes we want to restore */
-    int flags = ARCHIVE_EXTRACT_TIME
-                | ARCHIVE_EXTRACT_PERM
-                | ARCHIVE_EXTRACT_ACL
-                | ARCHIVE_EXTRACT_FFLAGS;
-    
+    log(boost::format("successfully extracted archive %s") % archivePath, common::logType::DEBUG);
+}
+
+// Read the headers of the specified archive's entries and pass the entries that don't
+// match the exclude patterns to the specified function (which can read the entry's data)
+void InputImage::readArchive(   const boost::filesystem::path& archivePath,
+                                const std::vector<std::string> &excludePattern,
+                                const std::function<void(::archive*, ::archive_entry*)>& processEntry) const {
     ::archive* arc = archive_read_new();
     archive_read_support_format_all(arc);
-    archive_read_support_filter_all(arc);
+    supportDecompressionFilters(arc);
 
-    ::archive* ext = archive_write_disk_new();
-    archive_write_disk_set_options(ext, flags);
-    archive_write_disk_set_standard_lookup(ext);
-    
     // define pattern to exclude files
     ::archive* matchToExclude = archive_match_new();
     for(const auto &pattern: excludePattern) {
@@ -126,11 +579,11 @@ void InputImage::extractArchiveWithExcludePatterns( const boost::filesystem::pat
     }
     
     //  open archive
-    if ( archive_read_open_filename(arc, archivePath.string().c_str(), 10240) != ARCHIVE_OK ) {
+    if ( openArchive(arc, archivePath, 10240) != ARCHIVE_OK ) {
         auto message = boost::format("failed to open archive %s") % archivePath;
         SARUS_THROW_ERROR(message.str());
     }
-    
+
     // for all archive entries
     while(true)
     {
@@ -162,175 +615,89 @@ void InputImage::extractArchiveWithExcludePatterns( const boost::filesystem::pat
             log(boost::format("archive: skipping (excluded) entry"), common::logType::DEBUG);
             continue;
         }
-        
-        // write entry
-        log(boost::format("archive: writing entry"), common::logType::DEBUG);
-        r = archive_write_header(ext, entry);
-        if (r < ARCHIVE_OK) {
-            auto message = boost::format("archive %s: error while writing header of entry %s (%s)")
-                % archivePath % archive_entry_pathname(entry) % archive_error_string(arc);
-            SARUS_THROW_ERROR(message.str());
-        }
-        else if (archive_entry_size(entry) > 0) {
-            log(boost::format("archive: copying data of entry"), common::logType::DEBUG);
-            copyDataOfArchiveEntry(archivePath, arc, ext, entry);
-        }
-    
-        r = archive_write_finish_entry(ext);
-        if (r < ARCHIVE_WARN) {
-            auto message = boost::format("archive %s: error while finishing to write entry %s (%s)")
-                        % archivePath % archive_entry_pathname(entry) % archive_error_string(arc);
-            SARUS_THROW_ERROR(message.str());
-        }
-        else if(r < ARCHIVE_OK) {
-            log(   boost::format("archive %s: error while finishing to write entry %s (%s)")
-                        % archivePath % archive_entry_pathname(entry) % archive_error_string(arc),
-                        common::logType::INFO);
-        }
+
+        processEntry(arc, entry);
     }
 
     archive_match_free(matchToExclude);
     archive_read_close(arc);
     archive_read_free(arc);
-    archive_write_close(ext);
-    archive_write_free(ext);
-
-    common::changeDirectory(cwd); // move back to original working dir
-
-    log(boost::format("successfully extracted archive %s") % archivePath, common::logType::DEBUG);
 }
 
-std::vector<boost::filesystem::path> InputImage::readWhiteoutsInLayer(const boost::filesystem::path& layerArchive) const {
-    log(boost::format("reading whiteout files in layer archive %s") % layerArchive, common::logType::DEBUG);
-
-    auto whiteouts = std::vector<boost::filesystem::path>{};
-
-    ::archive* arc = archive_read_new();
-    archive_read_support_format_all(arc);
-    archive_read_support_filter_all(arc);
-
-    ::archive* match = archive_match_new();
-    if(archive_match_exclude_pattern(match, ".wh.*" ) != ARCHIVE_OK) {
-        auto message = boost::format("invalid libarchive exclude pattern");
-        SARUS_THROW_ERROR(message.str());
-    }
-
-    if (archive_read_open_filename(arc, layerArchive.string().c_str(), 10240) != ARCHIVE_OK ) {
-        auto message = boost::format("failed to open archive %s") % layerArchive;
-        SARUS_THROW_ERROR(message.str());
+// Add the permissions needed by this user to the archive entry's mode (symbolic links are skipped)
+void InputImage::addOwnerPermissions(::archive_entry* entry) const {
+    auto type = archive_entry_filetype(entry);
+    if(type == AE_IFLNK) {
+        return;
     }
-    
-    // for each archive entry
-    while(true) {
-        ::archive_entry *entry;
-        int r = archive_read_next_header(arc, &entry);
-        if (r == ARCHIVE_EOF) {
-            break;
-        }
-        else if (r < ARCHIVE_WARN) {
-            auto message = boost::format("archive %s: error while reading header of entry %s (%s)")
-                        % layerArchive % archive_entry_pathname(entry) % archive_error_string(arc);
-            SARUS_THROW_ERROR(message.str());
-        }
-        else if (r < ARCHIVE_OK) {
-            // appearently, even if something goes wrong while reading the entry's header,
-            // it might still be possible to write / copy data of the entry. So let's just
-            // issue an INFO log message at this stage. If a failure happens later while
-            // copying the data, then we will issue an error.
-            log(boost::format("archive: error while reading header of entry %s (%s)")
-                % archive_entry_pathname(entry) % archive_error_string(arc),
-                common::logType::INFO);
-        }
-
-        log(boost::format("archive: processing entry %s") % archive_entry_pathname(entry), common::logType::DEBUG);
-    
-        if(archive_match_excluded(match, entry)) {
-            log(boost::format("archive: entry is whiteout"), common::logType::DEBUG);
-            whiteouts.push_back(archive_entry_pathname(entry));
-        }
+    auto permissions = archive_entry_perm(entry) | S_IRUSR | S_IWUSR;
+    if(type == AE_IFDIR) {
+        permissions |= S_IXUSR;
     }
+    archive_entry_set_perm(entry, permissions);
+}
 
-    archive_match_free(match);
-    archive_read_close(arc);
-    archive_read_free(arc);
-
-    log(boost::format("successfully read whiteout files"), common::logType::DEBUG);
-
-    return whiteouts;
+bool InputImage::isWhiteout(const boost::filesystem::path& entryPath) const {
+    return entryPath.filename().string().compare(0, 4, ".wh.") == 0;
 }
 
-void InputImage::applyWhiteouts(const std::vector<boost::filesystem::path>& whiteouts,
-                                const boost::filesystem::path& expandDir) const {
-    log(boost::format("Applying whiteouts"), common::logType::INFO);
-
-    for(const auto& whiteout : whiteouts) {
-        auto whiteoutFile = expandDir / whiteout;
-
-        // opaque whiteouts:
-        // remove all the contents of the whiteout's parent directory
-        bool isOpaqueWhiteout = whiteoutFile.filename() == ".wh..wh..opq";
-        if(isOpaqueWhiteout) {
-            auto target = whiteoutFile.parent_path();
-            log(boost::format("Applying opaque whiteout to target directory %s") % target, common::logType::DEBUG);
-            if(!boost::filesystem::is_directory(target)) {
-                log(boost::format("Skipping whiteout because target %s is not a directory") % target,
-                    common::logType::DEBUG);
-                continue;
-            }
-            for(boost::filesystem::directory_iterator end, it(target); it != end; ++it) {
-                if(!boost::filesystem::remove_all(it->path())) {
-                    log(boost::format("Failed to whiteout %s") % it->path(), common::logType::ERROR);
-                }
-            }
-        }
-        // regular whiteout:
-        // remove the single file or folder that corresponds to the whiteout
-        else {
-            auto target = whiteoutFile.parent_path();
-            target /= whiteoutFile.filename().c_str() + 4; // remove leading ".wh." characters in filename
-            log(boost::format("Applying regular whiteout to %s") % target, common::logType::DEBUG);
-            if(!boost::filesystem::remove_all(target)) {
-                log(boost::format("Failed to whiteout %s") % target, common::logType::ERROR);
-            }
-        }
+// Remove the leading "./" and the trailing "/" (directories) from the archive entry's path
+boost::filesystem::path InputImage::normalizeArchiveEntryPath(const std::string& entryPath) const {
+    auto path = entryPath;
+    while(path.compare(0, 2, "./") == 0) {
+        path.erase(0, 2);
     }
-
-    log(boost::format("Successfully applied whiteouts"), common::logType::INFO);
+    while(path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    return path;
 }
 
-void InputImage::copyDataOfArchiveEntry(const boost::filesystem::path& archivePath,
-                                        ::archive* in,
-                                        ::archive* out,
-                                        ::archive_entry *entry) const {
-    int r;
-    const void *buff;
-    size_t size;
-    la_int64_t offset;
-
-    while(true) {
-        r = archive_read_data_block(in, &buff, &size, &offset);
-        if(r == ARCHIVE_EOF) {
+void InputImage::applyWhiteout( const boost::filesystem::path& whiteout,
+                                RootfsWriter& rootfs,
+                                const std::unordered_set<std::string>& pathsInLayer) const {
+    // opaque whiteout:
+    // remove all the contents of the whiteout's parent directory (except the
+    // contents already extracted from the whiteout's own layer)
+    bool isOpaqueWhiteout = whiteout.filename() == ".wh..wh..opq";
+    if(isOpaqueWhiteout) {
+        auto target = whiteout.parent_path();
+        log(boost::format("Applying opaque whiteout to target directory %s") % target, common::logType::DEBUG);
+        if(!rootfs.listDirectory(target)) {
+            log(boost::format("Skipping whiteout because target %s is not a directory") % target,
+                common::logType::DEBUG);
             return;
         }
-        else if(r < ARCHIVE_OK) {
-            break;
+        removeContentOfParentLayers(rootfs, target, pathsInLayer);
+    }
+    // regular whiteout:
+    // remove the single file or folder that corresponds to the whiteout
+    else {
+        auto target = whiteout.parent_path() / (whiteout.filename().c_str() + 4); // remove leading ".wh." characters in filename
+        if(pathsInLayer.count(target.string())) {
+            log(boost::format("Skipping whiteout because target %s belongs to the same layer") % target,
+                common::logType::DEBUG);
+            return;
         }
-    
-        r = archive_write_data_block(out, buff, size, offset);
-        if (r < ARCHIVE_OK) {
-            break;
+        log(boost::format("Applying regular whiteout to %s") % target, common::logType::DEBUG);
+        if(!rootfs.remove(target)) {
+            log(boost::format("Failed to whiteout %s") % target, common::logType::ERROR);
         }
     }
+}
 
-    if (r < ARCHIVE_WARN) {
-        auto message = boost::format("Failed to copy data from archive %s. Error while copying entry %s: %s")
-            % archivePath % archive_entry_pathname(entry) % archive_error_string(in);
-        SARUS_THROW_ERROR(message.str());
-    }
-    else if (r < ARCHIVE_OK) {
-        auto message = boost::format("Failed to copy data from archive %s. Error while copying entry %s: %s")
-            % archivePath % archive_entry_pathname(entry) % archive_error_string(in);
-        log(message, common::logType::INFO);
+// Remove the contents of the directory that were extracted from the parent layers
+void InputImage::removeContentOfParentLayers(   RootfsWriter& rootfs,
+                                                const boost::filesystem::path& directory,
+                                                const std::unordered_set<std::string>& pathsInLayer) const {
+    for(const auto& filename : *rootfs.listDirectory(directory)) {
+        auto pathInLayer = directory / filename;
+        if(!pathsInLayer.count(pathInLayer.string())) {
+            rootfs.remove(pathInLayer);
+        }
+        else if(rootfs.listDirectory(pathInLayer)) {
+            removeContentOfParentLayers(rootfs, pathInLayer, pathsInLayer);
+        }
     }
 }
 
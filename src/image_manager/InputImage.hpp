@@ -11,15 +11,23 @@
 #ifndef sarus_image_manger_InputImage_hpp
 #define sarus_image_manger_InputImage_hpp
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
 #include <tuple>
+#include <unordered_set>
 #include <vector>
 #include <archive.h> // libarchive
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 
 #include "common/Config.hpp"
 #include "common/PathRAII.hpp"
 #include "common/ImageMetadata.hpp"
+#include "image_manager/LayerMergeIndex.hpp"
+#include "image_manager/RootfsWriter.hpp"
 
 namespace sarus {
 namespace image_manager {
@@ -31,28 +39,79 @@ class InputImage {
 public:
     InputImage(std::shared_ptr<const common::Config> config);
     virtual std::tuple<common::PathRAII, common::ImageMetadata, std::string> expand() const = 0;
+    virtual std::tuple<common::ImageMetadata, std::string> expandToSquashfs(
+        const boost::filesystem::path& pathOfImage) const = 0;
+    virtual boost::optional<uintmax_t> estimateScratchSpace(bool isRootfsExpanded) const;
+    void setScratchDirectory(const boost::filesystem::path& directory);
 
 protected:
+    virtual bool waitUntilLayerIsAvailable(const boost::filesystem::path& layerArchive,
+                                           std::chrono::milliseconds timeout) const;
+    virtual boost::optional<std::string> getLayerDigest(const boost::filesystem::path& layerArchive) const;
+    virtual int openArchive(::archive* arc, const boost::filesystem::path& archivePath, size_t blockSize) const;
     boost::filesystem::path makeTemporaryExpansionDirectory() const;
+    uintmax_t estimateScratchSpaceOfLayers( const std::vector<uintmax_t>& sizesOfLayers,
+                                            bool isRootfsExpanded) const;
     void expandLayers(  const std::vector<boost::filesystem::path>& layersPaths,
                         const boost::filesystem::path& expandDir) const;
+    void expandLayersBottomUp(  const std::vector<boost::filesystem::path>& layersPaths,
+                                const boost::filesystem::path& expandDir) const;
+    void expandLayersTopDown(   const std::vector<boost::filesystem::path>& layersPaths,
+                                const boost::filesystem::path& expandDir) const;
+    void streamLayersToSquashfs(const std::vector<boost::filesystem::path>& layersPaths,
+                                const boost::filesystem::path& pathOfImage) const;
+    void writeEntryToTarStream(::archive* out, ::archive* in, ::archive_entry* entry) const;
+    void indexLayer(const boost::filesystem::path& archivePath,
+                    size_t layer,
+                    LayerMergeIndex& index,
+                    const std::function<void(::archive_entry*)>& processEntry = nullptr) const;
+    bool selectEntryOfMergedLayers( const LayerMergeIndex& index,
+                                    size_t layer,
+                                    ::archive_entry* entry) const;
+    std::vector<std::string> getChainIDsOfLayers(const std::vector<boost::filesystem::path>& layers) const;
+    std::vector<boost::filesystem::path> getNonEmptyLayers(const std::vector<boost::filesystem::path>& layersPaths) const;
+    boost::filesystem::path makeStagingDirectory() const;
+    size_t getNumberOfDecompressionThreads() const;
+    size_t getNumberOfWriterThreads() const;
+    bool isTopDownMergeEnabled() const;
+    bool isFileDeduplicationEnabled() const;
+    bool isEmptyLayer(const boost::filesystem::path& layerArchive) const;
     void extractArchive(const boost::filesystem::path& archivePath,
                         const boost::filesystem::path& expandDir) const;
     void extractArchiveWithExcludePatterns( const boost::filesystem::path& archivePath,
                                             const std::vector<std::string> &excludePattern,
                                             const boost::filesystem::path& expandDir) const;
-    std::vector<boost::filesystem::path> readWhiteoutsInLayer(const boost::filesystem::path& layerArchive) const;
-    void applyWhiteouts(const std::vector<boost::filesystem::path>& whiteouts,
-                        const boost::filesystem::path& expandDir) const;
-    void copyDataOfArchiveEntry(const boost::filesystem::path& archivePath,
-                                ::archive* in,
-                                ::archive* out,
-                                ::archive_entry *entry) const;
+    void extractLayer(  const boost::filesystem::path& layerArchive,
+                        RootfsWriter& rootfs) const;
+    void extractArchiveEntries( const boost::filesystem::path& archivePath,
+                                const std::vector<std::string> &excludePattern,
+                                RootfsWriter& rootfs,
+                                const std::function<bool(::archive_entry*)>& selectEntry) const;
+    void readArchive(   const boost::filesystem::path& archivePath,
+                        const std::vector<std::string> &excludePattern,
+                        const std::function<void(::archive*, ::archive_entry*)>& processEntry) const;
+    bool isWhiteout(const boost::filesystem::path& entryPath) const;
+    void addOwnerPermissions(::archive_entry* entry) const;
+    boost::filesystem::path normalizeArchiveEntryPath(const std::string& entryPath) const;
+    void applyWhiteout( const boost::filesystem::path& whiteout,
+                        RootfsWriter& rootfs,
+                        const std::unordered_set<std::string>& pathsInLayer) const;
+    void removeContentOfParentLayers(   RootfsWriter& rootfs,
+                                        const boost::filesystem::path& directory,
+                                        const std::unordered_set<std::string>& pathsInLayer) const;
     void log(const boost::format &message, common::logType level) const;
     void log(const std::string& message, common::logType level) const;
 
 protected:
     std::shared_ptr<const common::Config> config;
+    boost::filesystem::path scratchDirectory;
+
+    /** entries of the layers' archives that are never extracted */
+    const std::vector<std::string> LAYER_EXCLUDE_PATTERNS = {"^dev/", "^/", "../"};
+
+    /** max number of threads that decompress the layers (if not specified in the configuration) */
+    const size_t DEFAULT_MAX_DECOMPRESSION_THREADS = 4;
+    const size_t DEFAULT_WRITER_THREADS = 4;
 };
 
 }
@@ -0,0 +1,222 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "LayerDecompressor.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <archive.h> // libarchive
+#include <archive_entry.h> // libarchive
+
+#include "common/Error.hpp"
+#include "common/Utility.hpp"
+#include "image_manager/ArchiveFilters.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+LayerDecompressor::LayerDecompressor(   const std::vector<boost::filesystem::path>& layers,
+                                        const boost::filesystem::path& stagingDirectory,
+                                        size_t numberOfThreads,
+                                        size_t maxStagedLayers,
+                                        WaitFunction waitUntilLayerIsAvailable,
+                                        OpenFunction openArchive)
+    : layers(layers)
+    , stagingDirectory{stagingDirectory}
+    , maxStagedLayers{maxStagedLayers}
+    , waitUntilLayerIsAvailable{std::move(waitUntilLayerIsAvailable)}
+    , openArchive{std::move(openArchive)}
+    , promises(layers.size())
+    , stagedFiles(layers.size())
+{
+    if(!this->openArchive) {
+        this->openArchive = [](::archive* arc, const boost::filesystem::path& archivePath, size_t blockSize) {
+            return archive_read_open_filename(arc, archivePath.c_str(), blockSize);
+        };
+    }
+
+    common::createFoldersIfNecessary(stagingDirectory);
+
+    for(auto& promise : promises) {
+        decompressedLayers.push_back(promise.get_future().share());
+    }
+
+    log(boost::format("decompressing %s layers with %s threads") % layers.size() % numberOfThreads,
+        common::logType::DEBUG);
+    for(size_t i = 0; i < numberOfThreads && i < layers.size(); ++i) {
+        workers.emplace_back(&LayerDecompressor::runWorker, this);
+    }
+}
+
+LayerDecompressor::~LayerDecompressor() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stop = true;
+    }
+    releasedLayerOrStop.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * Wait for the decompression of the layer and get the path of the uncompressed archive
+ * (the method can be called multiple times for the same layer)
+ */
+boost::filesystem::path LayerDecompressor::getDecompressedLayer(size_t layer) {
+    if(workers.empty()) {
+        waitForLayer(layer);
+        return layers[layer];
+    }
+
+    try {
+        return decompressedLayers[layer].get();
+    }
+    catch(std::exception& e) {
+        auto message = boost::format("Failed to decompress layer %s") % layers[layer];
+        SARUS_RETHROW_ERROR(e, message.str());
+    }
+}
+
+/**
+ * Remove the staged uncompressed archive of the layer, which is no longer needed
+ * (the layers are expected to be released in order)
+ */
+void LayerDecompressor::releaseDecompressedLayer(size_t layer) {
+    if(!stagedFiles[layer].empty()) {
+        auto ec = boost::system::error_code{};
+        boost::filesystem::remove(stagedFiles[layer], ec);
+        if(ec) {
+            log(boost::format("failed to remove staged layer %s (%s)") % stagedFiles[layer] % ec.message(),
+                common::logType::WARN);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        ++numberOfReleasedLayers;
+    }
+    releasedLayerOrStop.notify_all();
+}
+
+void LayerDecompressor::runWorker() {
+    while(true) {
+        size_t layer;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            releasedLayerOrStop.wait(lock, [this]() {
+                return stop
+                    || nextLayer == layers.size()
+                    || maxStagedLayers == 0
+                    || nextLayer < numberOfReleasedLayers + maxStagedLayers;
+            });
+            if(stop || nextLayer == layers.size()) {
+                return;
+            }
+            layer = nextLayer++;
+        }
+
+        try {
+            promises[layer].set_value(decompressLayer(layer));
+        }
+        catch(...) {
+            promises[layer].set_exception(std::current_exception());
+        }
+    }
+}
+
+boost::filesystem::path LayerDecompressor::decompressLayer(size_t layer) {
+    const auto& archivePath = layers[layer];
+
+    waitForLayer(layer);
+
+    log(boost::format("decompressing layer %s") % archivePath, common::logType::DEBUG);
+
+    auto arc = std::unique_ptr<::archive, int(*)(::archive*)>{archive_read_new(), archive_read_free};
+    supportDecompressionFilters(arc.get());
+    archive_read_support_format_raw(arc.get());
+
+    if(openArchive(arc.get(), archivePath, 1 << 20) != ARCHIVE_OK) {
+        auto message = boost::format("failed to open archive %s: %s") % archivePath % archive_error_string(arc.get());
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    ::archive_entry* entry;
+    if(archive_read_next_header(arc.get(), &entry) != ARCHIVE_OK) {
+        auto message = boost::format("failed to read archive %s: %s") % archivePath % archive_error_string(arc.get());
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    // the archive is not compressed: the layer can be extracted directly
+    if(archive_filter_code(arc.get(), 0) == ARCHIVE_FILTER_NONE) {
+        log(boost::format("layer %s is not compressed") % archivePath, common::logType::DEBUG);
+        return archivePath;
+    }
+
+    log(boost::format("layer %s is compressed with %s") % archivePath % archive_filter_name(arc.get(), 0),
+        common::logType::DEBUG);
+
+    auto stagedFile = stagingDirectory.getPath() / (boost::format("layer-%s.tar") % layer).str();
+    auto file = std::unique_ptr<FILE, int(*)(FILE*)>{std::fopen(stagedFile.c_str(), "wb"), std::fclose};
+    if(!file) {
+        auto message = boost::format("failed to create file %s") % stagedFile;
+        SARUS_THROW_ERROR(message.str());
+    }
+    stagedFiles[layer] = stagedFile;
+
+    auto buffer = std::unique_ptr<char[]>{new char[1 << 20]};
+    while(true) {
+        if(stop) {
+            SARUS_THROW_ERROR("decompression cancelled");
+        }
+        auto size = archive_read_data(arc.get(), buffer.get(), 1 << 20);
+        if(size == 0) {
+            break;
+        }
+        else if(size < 0) {
+            auto message = boost::format("failed to decompress archive %s: %s")
+                % archivePath % archive_error_string(arc.get());
+            SARUS_THROW_ERROR(message.str());
+        }
+        if(std::fwrite(buffer.get(), 1, size, file.get()) != static_cast<size_t>(size)) {
+            auto message = boost::format("failed to write file %s") % stagedFile;
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+
+    if(std::fclose(file.release()) != 0) {
+        auto message = boost::format("failed to write file %s") % stagedFile;
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    log(boost::format("decompressed layer %s into %s") % archivePath % stagedFile, common::logType::DEBUG);
+
+    return stagedFile;
+}
+
+/**
+ * Wait until the layer is available (e.g. downloaded). The wait is interrupted
+ * when the decompressor is destroyed.
+ */
+void LayerDecompressor::waitForLayer(size_t layer) const {
+    while(!waitUntilLayerIsAvailable(layers[layer], std::chrono::milliseconds{100})) {
+        if(stop) {
+            auto message = boost::format("stopped waiting for layer %s") % layers[layer];
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+}
+
+void LayerDecompressor::log(const boost::format& message, common::logType level) const {
+    common::Logger::getInstance().log(message.str(), "LayerDecompressor", level);
+}
+
+}
+}
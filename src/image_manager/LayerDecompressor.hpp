@@ -0,0 +1,102 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_LayerDecompressor_hpp
+#define sarus_image_manager_LayerDecompressor_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <archive.h> // libarchive
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include "common/Logger.hpp"
+#include "common/PathRAII.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class decompresses the layers' archives into a staging directory with a
+ * pool of threads, so that multiple layers are decompressed concurrently while
+ * the layers are extracted (in order) from the staged uncompressed archives.
+ *
+ * If the number of threads is zero, the layers are not staged and the compressed
+ * archives are extracted directly.
+ *
+ * The archives are opened with the specified function (by default, the archives
+ * are regular files).
+ *
+ * The layers are decompressed from the base layer to the top layer. In order to
+ * bound the disk space used by the staged archives, a thread doesn't start to
+ * decompress a layer while the specified max number of staged layers is not yet
+ * released. The archives that are not compressed are not staged.
+ *
+ * The function that waits for a layer (e.g. for its download) is called with a
+ * timeout, so that the threads stop promptly when the decompressor is destroyed
+ * (e.g. the extraction failed), also while they decompress a large layer.
+ */
+class LayerDecompressor {
+public:
+    using WaitFunction = std::function<bool(const boost::filesystem::path&, std::chrono::milliseconds timeout)>;
+    using OpenFunction = std::function<int(::archive*, const boost::filesystem::path&, size_t blockSize)>;
+
+    LayerDecompressor(  const std::vector<boost::filesystem::path>& layers,
+                        const boost::filesystem::path& stagingDirectory,
+                        size_t numberOfThreads,
+                        size_t maxStagedLayers,
+                        WaitFunction waitUntilLayerIsAvailable,
+                        OpenFunction openArchive = nullptr);
+    LayerDecompressor(const LayerDecompressor&) = delete;
+    LayerDecompressor& operator=(const LayerDecompressor&) = delete;
+    ~LayerDecompressor();
+
+    boost::filesystem::path getDecompressedLayer(size_t layer);
+    void releaseDecompressedLayer(size_t layer);
+
+private:
+    void runWorker();
+    boost::filesystem::path decompressLayer(size_t layer);
+    void waitForLayer(size_t layer) const;
+    void log(const boost::format& message, common::logType level) const;
+
+private:
+    std::vector<boost::filesystem::path> layers;
+    common::PathRAII stagingDirectory;
+    size_t maxStagedLayers;
+    WaitFunction waitUntilLayerIsAvailable;
+    OpenFunction openArchive;
+
+    std::vector<std::promise<boost::filesystem::path>> promises;
+    std::vector<std::shared_future<boost::filesystem::path>> decompressedLayers;
+    std::vector<boost::filesystem::path> stagedFiles;
+
+    std::mutex mutex;
+    std::condition_variable releasedLayerOrStop;
+    size_t nextLayer = 0;
+    size_t numberOfReleasedLayers = 0;
+    std::atomic<bool> stop{false};
+
+    std::vector<std::thread> workers;
+};
+
+}
+}
+
+#endif
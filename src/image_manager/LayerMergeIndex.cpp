@@ -0,0 +1,116 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "LayerMergeIndex.hpp"
+
+#include <iterator>
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * Add an entry of the layer. A non-directory entry hides the descendants
+ * of the same path in the lower layers (if the path was a directory).
+ */
+void LayerMergeIndex::addEntry(size_t layer, const std::string& path, bool isDirectory) {
+    if(!isDirectory) {
+        removeDescendantsOfLowerLayers(layer, path);
+    }
+    owners[path] = layer;
+}
+
+/**
+ * Add a whiteout of the layer. The whiteouts only hide the entries of the
+ * lower layers: the entries of the whiteout's layer are preserved.
+ */
+void LayerMergeIndex::addWhiteout(size_t layer, const std::string& whiteout) {
+    auto separator = whiteout.rfind('/');
+    auto parent = separator == std::string::npos ? std::string{} : whiteout.substr(0, separator);
+    auto filename = separator == std::string::npos ? whiteout : whiteout.substr(separator + 1);
+
+    // opaque whiteout: hide the contents of the parent directory
+    if(filename == ".wh..wh..opq") {
+        if(parent.empty()) {
+            for(auto it = owners.begin(); it != owners.end();) {
+                it = it->second < layer ? owners.erase(it) : std::next(it);
+            }
+        }
+        else {
+            removeDescendantsOfLowerLayers(layer, parent);
+        }
+    }
+    // regular whiteout: hide the path without the ".wh." prefix
+    else {
+        auto target = filename.substr(4);
+        if(!parent.empty()) {
+            target = parent + "/" + target;
+        }
+        removeEntriesOfLowerLayers(layer, target);
+    }
+}
+
+void LayerMergeIndex::addHardlink(size_t layer, const std::string& path, const std::string& target) {
+    addEntry(layer, path, false);
+    hardlinks.push_back(Hardlink{layer, path, target});
+}
+
+/**
+ * Compute the redirections of the hard links' targets, once all the layers were added
+ */
+void LayerMergeIndex::finalize() {
+    redirectedHardlinkTargets.clear();
+    for(const auto& hardlink : hardlinks) {
+        if(!isOwnedBy(hardlink.path, hardlink.layer) || isOwnedBy(hardlink.target, hardlink.layer)) {
+            continue;
+        }
+        auto key = std::make_pair(hardlink.layer, hardlink.target);
+        if(!redirectedHardlinkTargets.count(key)) {
+            redirectedHardlinkTargets[key] = hardlink.path;
+        }
+    }
+}
+
+bool LayerMergeIndex::isOwnedBy(const std::string& path, size_t layer) const {
+    auto it = owners.find(path);
+    return it != owners.cend() && it->second == layer;
+}
+
+/**
+ * Get the path where the data of the hard link's target has to be extracted to,
+ * if the target is not owned by the layer of the hard link
+ */
+boost::optional<std::string> LayerMergeIndex::getRedirectedHardlinkTarget(size_t layer, const std::string& target) const {
+    auto it = redirectedHardlinkTargets.find(std::make_pair(layer, target));
+    if(it == redirectedHardlinkTargets.cend()) {
+        return boost::none;
+    }
+    return it->second;
+}
+
+void LayerMergeIndex::removeEntriesOfLowerLayers(size_t layer, const std::string& path) {
+    auto it = owners.find(path);
+    if(it != owners.end() && it->second < layer) {
+        owners.erase(it);
+    }
+    removeDescendantsOfLowerLayers(layer, path);
+}
+
+void LayerMergeIndex::removeDescendantsOfLowerLayers(size_t layer, const std::string& path) {
+    // the descendants are contiguous in the (lexicographically sorted) map
+    auto prefix = path + "/";
+    auto it = owners.lower_bound(prefix);
+    while(it != owners.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+        it = it->second < layer ? owners.erase(it) : std::next(it);
+    }
+}
+
+}
+}
@@ -0,0 +1,79 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_LayerMergeIndex_hpp
+#define sarus_image_manager_LayerMergeIndex_hpp
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class represents the file set of an image, i.e. the result of merging
+ * the image's layers, built from the headers of the layers' archive entries.
+ *
+ * The layers are added from the base layer to the top layer (layer 0 is the
+ * base layer). Each path of the merged file set is owned by the topmost layer
+ * that contains it, and the paths hidden by the whiteouts, or replaced by a
+ * non-directory entry of an upper layer, are removed from the file set. Hence
+ * the image can be expanded by extracting from each layer only the entries
+ * that the layer owns.
+ *
+ * The paths are relative to the root of the image, without leading "./" and
+ * without trailing "/".
+ */
+class LayerMergeIndex {
+public:
+    void addEntry(size_t layer, const std::string& path, bool isDirectory);
+    void addWhiteout(size_t layer, const std::string& whiteout);
+    void addHardlink(size_t layer, const std::string& path, const std::string& target);
+    void finalize();
+
+    bool isOwnedBy(const std::string& path, size_t layer) const;
+    boost::optional<std::string> getRedirectedHardlinkTarget(size_t layer, const std::string& target) const;
+    size_t getNumberOfEntries() const { return owners.size(); }
+
+private:
+    void removeEntriesOfLowerLayers(size_t layer, const std::string& path);
+    void removeDescendantsOfLowerLayers(size_t layer, const std::string& path);
+
+private:
+    struct Hardlink {
+        size_t layer;
+        std::string path;
+        std::string target;
+    };
+
+    /** the layer that owns each path of the merged file set */
+    std::map<std::string, size_t> owners;
+
+    /** the hard links, in the order of the archives' entries */
+    std::vector<Hardlink> hardlinks;
+
+    /**
+     * The targets of hard links that are not owned by the layer of the link (i.e. the
+     * target is whited out or replaced by an upper layer, but the link survives).
+     * The data of such targets is extracted to the first surviving link instead.
+     */
+    std::map<std::pair<size_t, std::string>, std::string> redirectedHardlinkTargets;
+};
+
+}
+}
+
+#endif
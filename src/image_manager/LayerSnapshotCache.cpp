@@ -0,0 +1,452 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "LayerSnapshotCache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "common/Error.hpp"
+#include "common/Lockfile.hpp"
+#include "common/Utility.hpp"
+#include "image_manager/Sha256Hasher.hpp"
+
+
+namespace rj = rapidjson;
+
+namespace sarus {
+namespace image_manager {
+
+LayerSnapshotCache::LayerSnapshotCache(std::shared_ptr<const common::Config> config)
+    : config{config}
+    , snapshotsDirectory{config->directories.repository / "layer-snapshots"}
+    , indexFile{snapshotsDirectory / "index.json"}
+    , quota{readQuota()}
+{}
+
+bool LayerSnapshotCache::isEnabled() const {
+    return quota > 0;
+}
+
+/**
+ * Compute the chain IDs of the layers, i.e. the keys of the snapshots of
+ * the chains that start from the base layer and end at each layer
+ */
+std::vector<std::string> LayerSnapshotCache::computeChainIDs(const std::vector<std::string>& layerDigests) {
+    auto chainIDs = std::vector<std::string>{};
+    for(const auto& digest : layerDigests) {
+        if(chainIDs.empty()) {
+            chainIDs.push_back(digest);
+            continue;
+        }
+        auto hasher = Sha256Hasher{};
+        auto chain = chainIDs.back() + " " + digest;
+        hasher.update(chain.c_str(), chain.size());
+        chainIDs.push_back("sha256:" + hasher.finalize());
+    }
+    return chainIDs;
+}
+
+/**
+ * Clone into the (empty) expand directory the snapshot of the longest chain of layers
+ * available in the cache. Returns the number of layers of the restored chain (zero if
+ * no snapshot is available). The permissions and the times of the restored directories
+ * are set by the RootfsWriter when the extraction of the remaining layers is finished.
+ */
+size_t LayerSnapshotCache::restoreLongestChain( const std::vector<std::string>& chainIDs,
+                                                const boost::filesystem::path& expandDir,
+                                                RootfsWriter& rootfs) const {
+    if(!isEnabled() || !boost::filesystem::exists(indexFile)) {
+        return 0;
+    }
+
+    auto numberOfLayers = chainIDs.size();
+    {
+        common::Lockfile lock{indexFile};
+        auto index = readIndex();
+        for(; numberOfLayers > 0; --numberOfLayers) {
+            const auto& chainID = chainIDs[numberOfLayers - 1];
+            if(index["snapshots"].HasMember(chainID.c_str())
+               && boost::filesystem::is_directory(snapshotsDirectory / chainID)) {
+                break;
+            }
+        }
+    }
+    if(numberOfLayers == 0) {
+        return 0;
+    }
+
+    // clone outside of the lock: a copy might take a while
+    const auto& chainID = chainIDs[numberOfLayers - 1];
+    printLog(boost::format("restoring snapshot %s of %s layers") % chainID % numberOfLayers,
+             common::logType::DEBUG);
+    auto restoredDirectories = std::vector<Directory>{};
+    try {
+        auto linkedFiles = LinkedFiles{};
+        cloneTree(snapshotsDirectory / chainID, expandDir, "", linkedFiles, &restoredDirectories);
+    }
+    catch(std::exception& e) {
+        printLog(boost::format("failed to restore snapshot %s, expanding all the layers") % chainID,
+                 common::logType::WARN);
+        clearDirectory(expandDir);
+        return 0;
+    }
+
+    {
+        common::Lockfile lock{indexFile};
+        auto index = readIndex();
+        auto& snapshots = index["snapshots"];
+
+        // the snapshot might have been evicted (and removed) while it was cloned
+        if(!snapshots.HasMember(chainID.c_str())) {
+            printLog(boost::format("snapshot %s was evicted while being restored, expanding all the layers") % chainID,
+                     common::logType::WARN);
+            clearDirectory(expandDir);
+            return 0;
+        }
+
+        auto now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        snapshots[chainID.c_str()]["lastAccess"].SetInt64(now);
+        writeIndex(index);
+    }
+
+    struct stat st;
+    if(lstat((snapshotsDirectory / chainID).c_str(), &st) == 0) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        rootfs.addDirectoryFixup("", st.st_mode & 07777, times);
+    }
+    for(const auto& directory : restoredDirectories) {
+        rootfs.addDirectoryFixup(directory.pathInRoot, directory.mode, directory.times);
+    }
+
+    return numberOfLayers;
+}
+
+/**
+ * Store in the cache the snapshot of the chain of layers expanded in the expand directory,
+ * where the permissions and the times of the directories are not set yet (they are set in
+ * the snapshot with the directory fixups of the RootfsWriter). A failure is not fatal, the
+ * snapshots are only an optimization.
+ */
+void LayerSnapshotCache::store( const std::string& chainID,
+                                const boost::filesystem::path& expandDir,
+                                const RootfsWriter& rootfs) const {
+    if(!isEnabled()) {
+        return;
+    }
+
+    auto snapshotDir = snapshotsDirectory / chainID;
+    auto incompleteSnapshotDir = common::makeUniquePathWithRandomSuffix(snapshotsDirectory / (chainID + "-incomplete"));
+    auto evictedSnapshotDirs = std::vector<boost::filesystem::path>{};
+
+    try {
+        if(boost::filesystem::exists(snapshotDir)) {
+            return;
+        }
+
+        printLog(boost::format("storing snapshot %s") % chainID, common::logType::DEBUG);
+
+        // clone outside of the lock: a copy might take a while
+        common::createFoldersIfNecessary(incompleteSnapshotDir);
+        auto linkedFiles = LinkedFiles{};
+        auto size = cloneTree(expandDir, incompleteSnapshotDir, "", linkedFiles, nullptr);
+        rootfs.applyDirectoryFixups(incompleteSnapshotDir);
+
+        if(size > quota) {
+            printLog(boost::format("not storing snapshot %s: size of %s bytes exceeds the quota") % chainID % size,
+                     common::logType::DEBUG);
+            removeSnapshot(incompleteSnapshotDir);
+            return;
+        }
+
+        {
+            common::Lockfile lock{indexFile};
+            auto index = readIndex();
+            auto& snapshots = index["snapshots"];
+            auto& allocator = index.GetAllocator();
+
+            if(snapshots.HasMember(chainID.c_str())) {
+                evictedSnapshotDirs.push_back(incompleteSnapshotDir); // stored concurrently by somebody else
+            }
+            else {
+                // leftover of a snapshot that was evicted but not removed
+                if(boost::filesystem::exists(snapshotDir)) {
+                    auto leftover = common::makeUniquePathWithRandomSuffix(snapshotsDirectory / (chainID + "-evicted"));
+                    boost::filesystem::rename(snapshotDir, leftover);
+                    evictedSnapshotDirs.push_back(leftover);
+                }
+                boost::filesystem::rename(incompleteSnapshotDir, snapshotDir);
+
+                auto now = std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                auto entry = rj::Value{rj::kObjectType};
+                entry.AddMember("size", rj::Value{static_cast<uint64_t>(size)}, allocator);
+                entry.AddMember("lastAccess", rj::Value{static_cast<int64_t>(now)}, allocator);
+                snapshots.AddMember(rj::Value{chainID.c_str(), allocator}, entry, allocator);
+
+                auto evicted = evictLeastRecentlyUsed(index, chainID);
+                evictedSnapshotDirs.insert(evictedSnapshotDirs.end(), evicted.cbegin(), evicted.cend());
+                writeIndex(index);
+
+                printLog(boost::format("stored snapshot %s (%s bytes)") % chainID % size, common::logType::INFO);
+            }
+        }
+    }
+    catch(std::exception& e) {
+        printLog(boost::format("failed to store snapshot %s") % chainID, common::logType::WARN);
+        evictedSnapshotDirs.push_back(incompleteSnapshotDir);
+    }
+
+    // remove outside of the lock: a removal might take a while
+    for(const auto& directory : evictedSnapshotDirs) {
+        removeSnapshot(directory);
+    }
+}
+
+rapidjson::Document LayerSnapshotCache::readIndex() const {
+    if(boost::filesystem::exists(indexFile)) {
+        return common::readJSON(indexFile);
+    }
+    auto index = rj::Document{rj::kObjectType};
+    index.AddMember("snapshots", rj::kObjectType, index.GetAllocator());
+    return index;
+}
+
+void LayerSnapshotCache::writeIndex(const rapidjson::Document& index) const {
+    auto indexFileTemp = common::makeUniquePathWithRandomSuffix(indexFile);
+    common::writeJSON(index, indexFileTemp);
+    boost::filesystem::rename(indexFileTemp, indexFile); // atomically replace old index
+}
+
+// Evict the least recently used snapshots until the snapshots fit into the quota. The
+// evicted snapshots are renamed, returns their new paths (to be removed by the caller).
+std::vector<boost::filesystem::path> LayerSnapshotCache::evictLeastRecentlyUsed(
+    rapidjson::Document& index, const std::string& chainIDToKeep) const {
+    auto& snapshots = index["snapshots"];
+    auto evictedSnapshotDirs = std::vector<boost::filesystem::path>{};
+
+    while(true) {
+        uintmax_t totalSize = 0;
+        auto leastRecentlyUsed = snapshots.MemberEnd();
+        for(auto it = snapshots.MemberBegin(); it != snapshots.MemberEnd(); ++it) {
+            totalSize += it->value["size"].GetUint64();
+            if(it->name.GetString() == chainIDToKeep) {
+                continue;
+            }
+            if(leastRecentlyUsed == snapshots.MemberEnd()
+               || it->value["lastAccess"].GetInt64() < leastRecentlyUsed->value["lastAccess"].GetInt64()) {
+                leastRecentlyUsed = it;
+            }
+        }
+
+        if(totalSize <= quota || leastRecentlyUsed == snapshots.MemberEnd()) {
+            return evictedSnapshotDirs;
+        }
+
+        auto chainID = std::string{leastRecentlyUsed->name.GetString()};
+        printLog(boost::format("evicting snapshot %s") % chainID, common::logType::DEBUG);
+        auto snapshotDir = snapshotsDirectory / chainID;
+        if(boost::filesystem::exists(snapshotDir)) {
+            auto evictedSnapshotDir = common::makeUniquePathWithRandomSuffix(snapshotsDirectory / (chainID + "-evicted"));
+            boost::filesystem::rename(snapshotDir, evictedSnapshotDir);
+            evictedSnapshotDirs.push_back(evictedSnapshotDir);
+        }
+        snapshots.RemoveMember(chainID.c_str());
+    }
+}
+
+// Remove a snapshot, whose directories might be read-only
+void LayerSnapshotCache::removeSnapshot(const boost::filesystem::path& snapshotDir) const {
+    boost::system::error_code ec;
+    chmod(snapshotDir.c_str(), S_IRWXU);
+    for(auto it = boost::filesystem::recursive_directory_iterator{snapshotDir, ec};
+        !ec && it != boost::filesystem::recursive_directory_iterator{};
+        it.increment(ec)) {
+        struct stat st;
+        if(lstat(it->path().c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            chmod(it->path().c_str(), S_IRWXU);
+        }
+    }
+    boost::filesystem::remove_all(snapshotDir, ec);
+    if(ec) {
+        printLog(boost::format("failed to remove snapshot directory %s: %s") % snapshotDir % ec.message(),
+                 common::logType::WARN);
+    }
+}
+
+// Remove the content of a directory (e.g. the expand directory after a failed restore)
+void LayerSnapshotCache::clearDirectory(const boost::filesystem::path& directory) const {
+    for(boost::filesystem::directory_iterator end, it(directory); it != end; ++it) {
+        boost::filesystem::remove_all(it->path());
+    }
+}
+
+// Clone the contents of the source directory into the destination directory.
+// Returns the total size of the regular files. If the restored directories are
+// requested, the directories are left writable and their permissions and times
+// are returned instead of being set.
+uintmax_t LayerSnapshotCache::cloneTree(const boost::filesystem::path& source,
+                                        const boost::filesystem::path& destination,
+                                        const std::string& pathInRoot,
+                                        LinkedFiles& linkedFiles,
+                                        std::vector<Directory>* restoredDirectories) const {
+    uintmax_t size = 0;
+
+    for(boost::filesystem::directory_iterator end, it(source); it != end; ++it) {
+        auto sourcePath = it->path();
+        auto destinationPath = destination / sourcePath.filename();
+        auto pathOfEntryInRoot = pathInRoot.empty()
+            ? sourcePath.filename().string()
+            : pathInRoot + "/" + sourcePath.filename().string();
+
+        struct stat st;
+        if(lstat(sourcePath.c_str(), &st) != 0) {
+            auto message = boost::format("Failed to stat %s: %s") % sourcePath % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+
+        if(S_ISDIR(st.st_mode)) {
+            if(mkdir(destinationPath.c_str(), S_IRWXU) != 0) {
+                auto message = boost::format("Failed to create directory %s: %s") % destinationPath % strerror(errno);
+                SARUS_THROW_ERROR(message.str());
+            }
+            size += cloneTree(sourcePath, destinationPath, pathOfEntryInRoot, linkedFiles, restoredDirectories);
+            if(restoredDirectories) {
+                auto directory = Directory{};
+                directory.pathInRoot = pathOfEntryInRoot;
+                directory.mode = st.st_mode & 07777;
+                directory.times[0] = st.st_atim;
+                directory.times[1] = st.st_mtim;
+                restoredDirectories->push_back(directory);
+                continue;
+            }
+            if(chmod(destinationPath.c_str(), st.st_mode & 07777) != 0) {
+                auto message = boost::format("Failed to set permissions of %s: %s") % destinationPath % strerror(errno);
+                SARUS_THROW_ERROR(message.str());
+            }
+        }
+        else if(S_ISLNK(st.st_mode)) {
+            boost::filesystem::create_symlink(boost::filesystem::read_symlink(sourcePath), destinationPath);
+        }
+        else if(S_ISREG(st.st_mode)) {
+            // preserve the hard links between the files of the tree
+            auto inode = std::make_pair(st.st_dev, st.st_ino);
+            auto linkedFile = st.st_nlink > 1 ? linkedFiles.find(inode) : linkedFiles.end();
+            if(linkedFile != linkedFiles.end()) {
+                boost::filesystem::create_hard_link(linkedFile->second, destinationPath);
+                continue;
+            }
+            cloneFile(sourcePath, destinationPath, st);
+            if(st.st_nlink > 1) {
+                linkedFiles[inode] = destinationPath;
+            }
+            size += st.st_size;
+        }
+        else if(mknod(destinationPath.c_str(), st.st_mode, st.st_rdev) != 0) {
+            auto message = boost::format("Failed to create special file %s: %s") % destinationPath % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        if(utimensat(AT_FDCWD, destinationPath.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) {
+            auto message = boost::format("Failed to set times of %s: %s") % destinationPath % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+
+    return size;
+}
+
+// Clone the file with a reflink if possible, otherwise with a copy
+void LayerSnapshotCache::cloneFile( const boost::filesystem::path& source,
+                                    const boost::filesystem::path& destination,
+                                    const struct stat& sourceStat) const {
+    auto sourceFd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if(sourceFd < 0) {
+        auto message = boost::format("Failed to open %s: %s") % source % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    auto destinationFd = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(destinationFd < 0) {
+        close(sourceFd);
+        auto message = boost::format("Failed to create %s: %s") % destination % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    if(ioctl(destinationFd, FICLONE, sourceFd) == 0) {
+        printLog(boost::format("reflinked %s") % destination, common::logType::DEBUG);
+    }
+    else {
+        try {
+            copyFileData(sourceFd, destinationFd, source);
+        }
+        catch(std::exception&) {
+            close(destinationFd);
+            close(sourceFd);
+            throw;
+        }
+    }
+
+    auto success = fchmod(destinationFd, sourceStat.st_mode & 07777) == 0;
+    success = close(destinationFd) == 0 && success;
+    close(sourceFd);
+    if(!success) {
+        auto message = boost::format("Failed to clone %s to %s: %s") % source % destination % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+void LayerSnapshotCache::copyFileData(int sourceFd, int destinationFd, const boost::filesystem::path& source) const {
+    char buffer[1 << 16];
+    while(true) {
+        auto size = read(sourceFd, buffer, sizeof(buffer));
+        if(size == 0) {
+            return;
+        }
+        else if(size < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            auto message = boost::format("Failed to read %s: %s") % source % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        for(ssize_t written = 0; written < size;) {
+            auto result = write(destinationFd, buffer + written, size - written);
+            if(result < 0 && errno != EINTR) {
+                auto message = boost::format("Failed to copy %s: %s") % source % strerror(errno);
+                SARUS_THROW_ERROR(message.str());
+            }
+            written += std::max(result, ssize_t{0});
+        }
+    }
+}
+
+// Read the quota of the snapshots (in MB) from the configuration (zero disables the cache)
+uintmax_t LayerSnapshotCache::readQuota() const {
+    const auto& json = config->json.get();
+    if(json.HasMember("expansion") && json["expansion"].HasMember("layerSnapshotCacheQuota")) {
+        return uintmax_t{json["expansion"]["layerSnapshotCacheQuota"].GetUint64()} << 20;
+    }
+    return 0;
+}
+
+void LayerSnapshotCache::printLog(const boost::format& message, common::logType logType) const {
+    common::Logger::getInstance().log(message.str(), "LayerSnapshotCache", logType);
+}
+
+}
+}
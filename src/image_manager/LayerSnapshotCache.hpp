@@ -0,0 +1,109 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_LayerSnapshotCache_hpp
+#define sarus_image_manager_LayerSnapshotCache_hpp
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+
+#include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <rapidjson/document.h>
+
+#include "common/Config.hpp"
+#include "common/Logger.hpp"
+#include "image_manager/RootfsWriter.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class caches the expanded root filesystems of chains of layers, so that the
+ * expansion of an image can start from the snapshot of its longest chain of base
+ * layers that was already expanded (e.g. by another image with the same base image)
+ * and extract only the remaining layers.
+ *
+ * A snapshot is keyed by the chain ID of its layers (the same scheme as the OCI chain
+ * IDs: the digest of the base layer, then recursively sha256(<parent chain ID> + " " +
+ * <layer digest>)). The snapshots are stored in <repository>/layer-snapshots and are
+ * cloned with reflinks where the filesystem supports them, with a copy otherwise (never
+ * with hard links, which would let the extraction of the later layers write into the
+ * snapshots).
+ *
+ * The directories of a snapshot have their final permissions and times. When a snapshot
+ * is restored, its directories are left writable and their permissions and times are
+ * set by the RootfsWriter that extracts the remaining layers.
+ *
+ * The size of the snapshots is bounded by a quota: the least recently used snapshots
+ * are evicted first. The index of the snapshots (size and time of last access) is a
+ * JSON file protected by a lock file, hence the cache can be shared by concurrent
+ * expansions. The snapshots are copied and removed outside of the lock: an evicted
+ * snapshot is renamed first, so that a concurrent restore of the snapshot fails
+ * instead of restoring an incomplete tree.
+ */
+class LayerSnapshotCache {
+public:
+    LayerSnapshotCache(std::shared_ptr<const common::Config> config);
+
+    bool isEnabled() const;
+    static std::vector<std::string> computeChainIDs(const std::vector<std::string>& layerDigests);
+    size_t restoreLongestChain( const std::vector<std::string>& chainIDs,
+                                const boost::filesystem::path& expandDir,
+                                RootfsWriter& rootfs) const;
+    void store( const std::string& chainID,
+                const boost::filesystem::path& expandDir,
+                const RootfsWriter& rootfs) const;
+
+private:
+    using LinkedFiles = std::map<std::pair<dev_t, ino_t>, boost::filesystem::path>;
+
+    // a restored directory, whose permissions and times are set after the extraction
+    struct Directory {
+        std::string pathInRoot;
+        mode_t mode;
+        struct timespec times[2];
+    };
+
+    rapidjson::Document readIndex() const;
+    void writeIndex(const rapidjson::Document& index) const;
+    std::vector<boost::filesystem::path> evictLeastRecentlyUsed(rapidjson::Document& index,
+                                                                const std::string& chainIDToKeep) const;
+    void removeSnapshot(const boost::filesystem::path& snapshotDir) const;
+    void clearDirectory(const boost::filesystem::path& directory) const;
+    uintmax_t cloneTree(const boost::filesystem::path& source,
+                        const boost::filesystem::path& destination,
+                        const std::string& pathInRoot,
+                        LinkedFiles& linkedFiles,
+                        std::vector<Directory>* restoredDirectories) const;
+    void cloneFile( const boost::filesystem::path& source,
+                    const boost::filesystem::path& destination,
+                    const struct stat& sourceStat) const;
+    void copyFileData(int sourceFd, int destinationFd, const boost::filesystem::path& source) const;
+    uintmax_t readQuota() const;
+    void printLog(const boost::format& message, common::logType logType) const;
+
+private:
+    std::shared_ptr<const common::Config> config;
+    boost::filesystem::path snapshotsDirectory;
+    boost::filesystem::path indexFile;
+    uintmax_t quota;
+};
+
+}
+}
+
+#endif
@@ -10,12 +10,72 @@
 
 #include "LoadedImage.hpp"
 
+#include <unistd.h>
+#include <archive.h> // libarchive
+#include <archive_entry.h> // libarchive
+#include <rapidjson/error/en.h>
+
 #include "common/Utility.hpp"
+#include "image_manager/ArchiveFilters.hpp"
+#include "image_manager/TrashDirectory.hpp"
 
 
 namespace sarus {
 namespace image_manager {
 
+// libarchive callbacks that read the data of an entry of the (outer) image archive,
+// so that a layer's archive can be read directly from the image archive
+struct EntryOfImageArchive {
+    std::unique_ptr<::archive, int(*)(::archive*)> imageArchive;
+};
+
+static la_ssize_t readDataOfEntry(::archive* arc, void* clientData, const void** buffer) {
+    auto* entry = static_cast<EntryOfImageArchive*>(clientData);
+    size_t size;
+    la_int64_t offset;
+    auto r = archive_read_data_block(entry->imageArchive.get(), buffer, &size, &offset);
+    if(r == ARCHIVE_EOF) {
+        return 0;
+    }
+    else if(r < ARCHIVE_WARN) {
+        archive_set_error(arc, archive_errno(entry->imageArchive.get()), "%s", archive_error_string(entry->imageArchive.get()));
+        return -1;
+    }
+    return size;
+}
+
+static int closeEntry(::archive*, void* clientData) {
+    delete static_cast<EntryOfImageArchive*>(clientData);
+    return ARCHIVE_OK;
+}
+
+// Resolve the target of a symlink of the image archive into the path of an entry
+// of the image archive (the target is relative to the symlink's directory)
+static boost::filesystem::path resolveSymlinkTarget(const boost::filesystem::path& symlink,
+                                                    const std::string& target) {
+    auto combined = target.compare(0, 1, "/") == 0
+        ? boost::filesystem::path{target}
+        : symlink.parent_path() / target;
+    auto resolved = boost::filesystem::path{};
+    for(const auto& component : combined) {
+        if(component == "/" || component == "." || component.empty()) {
+            continue;
+        }
+        else if(component == "..") {
+            if(resolved.empty()) {
+                auto message = boost::format("symlink %s -> %s points outside of the image archive")
+                    % symlink % target;
+                SARUS_THROW_ERROR(message.str());
+            }
+            resolved = resolved.parent_path();
+        }
+        else {
+            resolved /= component;
+        }
+    }
+    return resolved;
+}
+
 LoadedImage::LoadedImage(   std::shared_ptr<const common::Config> config,
                             const boost::filesystem::path& imageArchive)
     : InputImage{std::move(config)}
@@ -25,10 +85,98 @@ LoadedImage::LoadedImage(   std::shared_ptr<const common::Config> config,
 std::tuple<common::PathRAII, common::ImageMetadata, std::string> LoadedImage::expand() const {
     log(boost::format("expanding loaded image from archive %s") % imageArchive, common::logType::INFO);
 
-    auto initialWorkingDir = boost::filesystem::current_path();
-    auto tempArchiveDir = common::PathRAII{makeTemporaryExpansionDirectory()};
+    common::PathRAII tempArchiveDir;
     auto expansionDir = common::PathRAII{makeTemporaryExpansionDirectory()};
 
+    std::vector<boost::filesystem::path> layerArchives;
+    common::ImageMetadata metadata;
+    std::string digest;
+    std::tie(layerArchives, metadata, digest) = openImageArchive(tempArchiveDir);
+
+    expandLayers(layerArchives, expansionDir.getPath());
+    TrashDirectory{config}.discard(tempArchiveDir);
+
+    log(boost::format("successfully expanded loaded image from archive %s") % imageArchive, common::logType::INFO);
+
+    return std::tuple<common::PathRAII, common::ImageMetadata, std::string>{
+        std::move(expansionDir), std::move(metadata), digest
+    };
+}
+
+std::tuple<common::ImageMetadata, std::string> LoadedImage::expandToSquashfs(
+    const boost::filesystem::path& pathOfImage) const {
+    log(boost::format("expanding loaded image from archive %s to squashfs image") % imageArchive,
+        common::logType::INFO);
+
+    common::PathRAII tempArchiveDir;
+
+    std::vector<boost::filesystem::path> layerArchives;
+    common::ImageMetadata metadata;
+    std::string digest;
+    std::tie(layerArchives, metadata, digest) = openImageArchive(tempArchiveDir);
+
+    streamLayersToSquashfs(layerArchives, pathOfImage);
+    TrashDirectory{config}.discard(tempArchiveDir);
+
+    log(boost::format("successfully expanded loaded image from archive %s") % imageArchive, common::logType::INFO);
+
+    return std::tuple<common::ImageMetadata, std::string>{std::move(metadata), digest};
+}
+
+/**
+ * The layers of an uncompressed image archive are read directly from the archive, hence the
+ * expanded root filesystem is at most as large as the archive. The size of the content of a
+ * compressed archive (or of an archive read from the standard input) is unknown.
+ */
+boost::optional<uintmax_t> LoadedImage::estimateScratchSpace(bool isRootfsExpanded) const {
+    if(isReadFromStandardInput() || isImageArchiveCompressed()) {
+        return boost::none;
+    }
+    return isRootfsExpanded ? common::getFileSize(imageArchive) : 0;
+}
+
+/**
+ * Open the layers' archives inside the image archive (i.e. the path of a layer's archive is
+ * <image archive>/<entry of the image archive>), which are read directly from the image archive.
+ */
+int LoadedImage::openArchive(::archive* arc, const boost::filesystem::path& archivePath, size_t blockSize) const {
+    if(archivePath == "-") {
+        return archive_read_open_fd(arc, STDIN_FILENO, blockSize);
+    }
+    auto prefix = imageArchive.string() + "/";
+    if(archivePath.string().compare(0, prefix.size(), prefix) != 0) {
+        return InputImage::openArchive(arc, archivePath, blockSize);
+    }
+    auto* entry = new EntryOfImageArchive{openEntryOfImageArchive(archivePath.string().substr(prefix.size()))};
+    return archive_read_open(arc, entry, nullptr, readDataOfEntry, closeEntry);
+}
+
+// Read the manifest, the metadata and the digest of the image. The layers are read directly from the
+// image archive, unless the image archive is compressed or is read from the standard input: then
+// seeking to the layers would require to decompress the image archive over and over again (or would
+// be impossible), hence the image archive is extracted into the temporary directory in a single pass.
+std::tuple<std::vector<boost::filesystem::path>, common::ImageMetadata, std::string>
+LoadedImage::openImageArchive(common::PathRAII& tempArchiveDir) const {
+    if(isReadFromStandardInput() || isImageArchiveCompressed()) {
+        log(boost::format("archive %s is not seekable: extracting it into the temporary directory") % imageArchive,
+            common::logType::INFO);
+        tempArchiveDir = extractImageArchive();
+        auto directory = tempArchiveDir.getPath();
+        return readImageArchiveIndex(directory, [&directory](const std::string& file) {
+            return common::readJSON(directory / file);
+        });
+    }
+
+    return readImageArchiveIndex(imageArchive, [this](const std::string& file) {
+        return readJSONOfImageArchive(file);
+    });
+}
+
+// Extract the image archive (i.e. the layers' archives, the manifest and the
+// image's configuration) into a temporary directory
+common::PathRAII LoadedImage::extractImageArchive() const {
+    auto tempArchiveDir = common::PathRAII{makeTemporaryExpansionDirectory()};
+
     try {
         extractArchive(imageArchive, tempArchiveDir.getPath());
     }
@@ -36,11 +184,17 @@ std::tuple<common::PathRAII, common::ImageMetadata, std::string> LoadedImage::ex
         auto message = boost::format("failed to extract archive %s") % imageArchive;
         SARUS_RETHROW_ERROR(e, message.str());
     }
-    common::changeDirectory( initialWorkingDir );
 
+    return tempArchiveDir;
+}
+
+// Read the layers' archives, the metadata and the digest of the image from the manifest
+// and the configuration of the image (the layers' archives are in the specified directory)
+std::tuple<std::vector<boost::filesystem::path>, common::ImageMetadata, std::string>
+LoadedImage::readImageArchiveIndex( const boost::filesystem::path& layersDirectory,
+                                    const std::function<rapidjson::Document(const std::string&)>& readJSON) const {
     // read manifest.json to construct metadata
-    boost::filesystem::path manifestFilePath( tempArchiveDir.getPath() / "manifest.json" );
-    auto loadedManifest = common::readJSON(manifestFilePath);
+    auto loadedManifest = readJSON("manifest.json");
     log("manifest.json: " + common::serializeJSON(loadedManifest), common::logType::DEBUG);
 
     // if archive contains more than 1 container manifest or empty, throw error
@@ -56,8 +210,8 @@ std::tuple<common::PathRAII, common::ImageMetadata, std::string> LoadedImage::ex
     auto& RepoTags = manifest["RepoTags"];
 
     // parse config json
-    auto configFile = tempArchiveDir.getPath() / manifest["Config"].GetString();
-    auto imageConfig = common::readJSON(configFile);
+    auto configFile = boost::filesystem::path{manifest["Config"].GetString()};
+    auto imageConfig = readJSON(configFile.string());
     if (!imageConfig.HasMember("config")) {
         auto message = boost::format(   "Image configuration file %s is malformed: "
                                         "no \"config\" field detected") % configFile;
@@ -73,18 +227,118 @@ std::tuple<common::PathRAII, common::ImageMetadata, std::string> LoadedImage::ex
     std::vector<boost::filesystem::path> layerArchives;
     for(const auto& layer: layers.GetArray()) {
         std::string layerArchive = layer.GetString();
-        boost::filesystem::path layerArchivePath(tempArchiveDir.getPath() / layerArchive);
+        boost::filesystem::path layerArchivePath(layersDirectory / layerArchive);
         layerArchives.push_back(layerArchivePath);
     }
 
-    expandLayers(layerArchives, expansionDir.getPath());
-
-    log(boost::format("successfully expanded loaded image from archive %s") % imageArchive, common::logType::INFO);
-
     auto digest = configFile.stem().string();
-    return std::tuple<common::PathRAII, common::ImageMetadata, std::string>{
-        std::move(expansionDir), std::move(metadata), digest
+    return std::tuple<std::vector<boost::filesystem::path>, common::ImageMetadata, std::string>{
+        std::move(layerArchives), std::move(metadata), digest
     };
 }
 
+bool LoadedImage::isReadFromStandardInput() const {
+    return imageArchive == "-";
+}
+
+bool LoadedImage::isImageArchiveCompressed() const {
+    auto arc = std::unique_ptr<::archive, int(*)(::archive*)>{archive_read_new(), archive_read_free};
+    supportDecompressionFilters(arc.get());
+    archive_read_support_format_all(arc.get());
+
+    ::archive_entry* entry;
+    if(archive_read_open_filename(arc.get(), imageArchive.c_str(), 10240) != ARCHIVE_OK
+       || archive_read_next_header(arc.get(), &entry) < ARCHIVE_WARN) {
+        auto message = boost::format("failed to read archive %s (%s)") % imageArchive % archive_error_string(arc.get());
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    return archive_filter_code(arc.get(), 0) != ARCHIVE_FILTER_NONE;
+}
+
+// Open the image archive and move to the data of the specified entry (the data of the
+// previous entries is skipped, i.e. the file offset is moved forward without reading the data).
+// Symlinks and hardlinks are followed, e.g. the legacy "docker save" format stores the layers
+// shared by multiple images as "<id>/layer.tar -> ../<other id>/layer.tar", which has no data.
+std::unique_ptr<::archive, int(*)(::archive*)> LoadedImage::openEntryOfImageArchive(const std::string& entryPath,
+                                                                                   size_t followedLinks) const {
+    if(followedLinks > MAX_FOLLOWED_LINKS) {
+        auto message = boost::format("too many levels of links while opening %s of archive %s")
+            % entryPath % imageArchive;
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    auto arc = std::unique_ptr<::archive, int(*)(::archive*)>{archive_read_new(), archive_read_free};
+    supportDecompressionFilters(arc.get());
+    archive_read_support_format_all(arc.get());
+
+    if(archive_read_open_filename(arc.get(), imageArchive.c_str(), 10240) != ARCHIVE_OK) {
+        auto message = boost::format("failed to open archive %s (%s)") % imageArchive % archive_error_string(arc.get());
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    auto normalizedEntryPath = normalizeArchiveEntryPath(entryPath);
+    while(true) {
+        ::archive_entry* entry;
+        auto r = archive_read_next_header(arc.get(), &entry);
+        if(r == ARCHIVE_EOF) {
+            break;
+        }
+        else if(r < ARCHIVE_WARN) {
+            auto message = boost::format("failed to read archive %s (%s)") % imageArchive % archive_error_string(arc.get());
+            SARUS_THROW_ERROR(message.str());
+        }
+        if(normalizeArchiveEntryPath(archive_entry_pathname(entry)) != normalizedEntryPath) {
+            continue;
+        }
+        if(const auto* hardlink = archive_entry_hardlink(entry)) {
+            auto target = normalizeArchiveEntryPath(hardlink);
+            log(boost::format("following hardlink %s -> %s of archive %s") % entryPath % target % imageArchive,
+                common::logType::DEBUG);
+            return openEntryOfImageArchive(target.string(), followedLinks + 1);
+        }
+        if(archive_entry_filetype(entry) == AE_IFLNK) {
+            auto target = resolveSymlinkTarget(normalizedEntryPath, archive_entry_symlink(entry));
+            log(boost::format("following symlink %s -> %s of archive %s") % entryPath % target % imageArchive,
+                common::logType::DEBUG);
+            return openEntryOfImageArchive(target.string(), followedLinks + 1);
+        }
+        return arc;
+    }
+
+    auto message = boost::format("archive %s doesn't contain %s") % imageArchive % entryPath;
+    SARUS_THROW_ERROR(message.str());
+}
+
+rapidjson::Document LoadedImage::readJSONOfImageArchive(const std::string& entryPath) const {
+    auto arc = openEntryOfImageArchive(entryPath);
+
+    auto content = std::string{};
+    auto buffer = std::vector<char>(1 << 16);
+    while(true) {
+        auto size = archive_read_data(arc.get(), buffer.data(), buffer.size());
+        if(size == 0) {
+            break;
+        }
+        else if(size < 0) {
+            auto message = boost::format("failed to read %s from archive %s (%s)")
+                % entryPath % imageArchive % archive_error_string(arc.get());
+            SARUS_THROW_ERROR(message.str());
+        }
+        content.append(buffer.data(), size);
+    }
+
+    rapidjson::Document json;
+    json.Parse(content.c_str());
+    if(json.HasParseError()) {
+        auto message = boost::format("File %s of archive %s is not a valid JSON.\n"
+                                     "Error(offset %u): %s")
+            % entryPath % imageArchive
+            % static_cast<unsigned>(json.GetErrorOffset())
+            % rapidjson::GetParseError_En(json.GetParseError());
+        SARUS_THROW_ERROR(message.str());
+    }
+    return json;
+}
+
 }} // namespace
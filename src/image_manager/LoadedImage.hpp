@@ -11,9 +11,15 @@
 #ifndef sarus_image_manger_LoadedImage_hpp
 #define sarus_image_manger_LoadedImage_hpp
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
 
+#include <archive.h> // libarchive
 #include <boost/filesystem.hpp>
+#include <rapidjson/document.h>
 
 #include "InputImage.hpp"
 
@@ -28,9 +34,31 @@ class LoadedImage : public InputImage {
 public:
     LoadedImage(std::shared_ptr<const common::Config> config, const boost::filesystem::path& imageArchive);
     std::tuple<common::PathRAII, common::ImageMetadata, std::string> expand() const override;
+    std::tuple<common::ImageMetadata, std::string> expandToSquashfs(
+        const boost::filesystem::path& pathOfImage) const override;
+    boost::optional<uintmax_t> estimateScratchSpace(bool isRootfsExpanded) const override;
+
+protected:
+    int openArchive(::archive* arc, const boost::filesystem::path& archivePath, size_t blockSize) const override;
+
+private:
+    std::tuple<std::vector<boost::filesystem::path>, common::ImageMetadata, std::string>
+    openImageArchive(common::PathRAII& tempArchiveDir) const;
+    common::PathRAII extractImageArchive() const;
+    std::tuple<std::vector<boost::filesystem::path>, common::ImageMetadata, std::string>
+    readImageArchiveIndex(  const boost::filesystem::path& layersDirectory,
+                            const std::function<rapidjson::Document(const std::string&)>& readJSON) const;
+    bool isReadFromStandardInput() const;
+    bool isImageArchiveCompressed() const;
+    std::unique_ptr<::archive, int(*)(::archive*)> openEntryOfImageArchive(const std::string& entryPath,
+                                                                           size_t followedLinks = 0) const;
+    rapidjson::Document readJSONOfImageArchive(const std::string& entryPath) const;
 
 private:
     boost::filesystem::path imageArchive;
+
+    /** max number of links followed to open an entry of the image archive (prevents loops) */
+    static const size_t MAX_FOLLOWED_LINKS = 40;
 };
 
 }
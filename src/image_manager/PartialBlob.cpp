@@ -0,0 +1,299 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "PartialBlob.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <rapidjson/document.h>
+
+#include "common/Error.hpp"
+#include "common/Utility.hpp"
+
+
+namespace rj = rapidjson;
+
+namespace sarus {
+namespace image_manager {
+
+PartialBlob::PartialBlob(const boost::filesystem::path& blobFile)
+    : blobFile{blobFile}
+    , partialFile{blobFile.string() + ".partial"}
+    , stateFile{blobFile.string() + ".partial.state"}
+{
+    openPartialFile();
+    if(isLocked) {
+        restoreState();
+    }
+}
+
+PartialBlob::~PartialBlob() {
+    if(fd == -1) {
+        return;
+    }
+
+    if(isLocked && !isCommitted) {
+        try {
+            persistState();
+        }
+        catch(common::Error& e) {
+            log(boost::format("failed to persist state of partial blob %s") % partialFile, common::logType::WARN);
+        }
+    }
+
+    close(fd); // also releases the lock
+
+    if(!isLocked && !isCommitted) {
+        // private temporary file cannot be resumed
+        boost::system::error_code ec;
+        boost::filesystem::remove(partialFile, ec);
+        if(ec) {
+            log(boost::format("failed to remove partial blob %s (%s)") % partialFile % ec.message(),
+                common::logType::WARN);
+        }
+    }
+}
+
+void PartialBlob::openPartialFile() {
+    fd = open(partialFile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd != -1) {
+        if(flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            isLocked = true;
+            return;
+        }
+        log(boost::format("partial blob %s is locked by another process or the filesystem doesn't support"
+                          " locking (%s). Falling back to a non-resumable download.") % partialFile % strerror(errno),
+            common::logType::DEBUG);
+        close(fd);
+    }
+
+    partialFile = common::makeUniquePathWithRandomSuffix(blobFile);
+    fd = open(partialFile.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1) {
+        auto message = boost::format("Failed to open file %s: %s") % partialFile % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+void PartialBlob::restoreState() {
+    if(!boost::filesystem::exists(stateFile)) {
+        reset();
+        return;
+    }
+
+    try {
+        auto state = common::readJSON(stateFile);
+        if(!state.IsObject()
+            || !state.HasMember("offset") || !state["offset"].IsUint64()
+            || !state.HasMember("sha256Context") || !state["sha256Context"].IsString()) {
+            SARUS_THROW_ERROR("malformed state file");
+        }
+
+        auto persistedOffset = static_cast<size_t>(state["offset"].GetUint64());
+        auto fileSize = lseek(fd, 0, SEEK_END);
+        if(fileSize == -1 || static_cast<size_t>(fileSize) < persistedOffset) {
+            SARUS_THROW_ERROR("partial file is smaller than the persisted offset");
+        }
+
+        hasher = Sha256Hasher{state["sha256Context"].GetString(), persistedOffset};
+
+        // drop bytes written after the last persisted state
+        if(ftruncate(fd, persistedOffset) != 0 || lseek(fd, persistedOffset, SEEK_SET) == -1) {
+            auto message = boost::format("failed to truncate partial file: %s") % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        offset = offsetOfPersistedState = persistedOffset;
+    }
+    catch(common::Error& e) {
+        log(boost::format("discarding partial blob %s (%s)") % partialFile % e.getErrorTrace().front().errorMessage,
+            common::logType::DEBUG);
+        reset();
+        return;
+    }
+
+    log(boost::format("> %-15.15s: %s (%d bytes)") % "resuming" % blobFile.filename().string() % offset,
+        common::logType::GENERAL);
+}
+
+/**
+ * Appends the specified bytes to the partial file and updates the digest
+ */
+void PartialBlob::append(const void* data, size_t size) {
+    const auto* bytes = static_cast<const char*>(data);
+    size_t bytesWritten = 0;
+    while(bytesWritten < size) {
+        auto r = write(fd, bytes + bytesWritten, size - bytesWritten);
+        if(r == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            auto message = boost::format("Failed to write to file %s: %s") % partialFile % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        bytesWritten += r;
+    }
+
+    hasher.update(data, size);
+    offset += size;
+
+    if(isLocked && offset - offsetOfPersistedState >= PERSIST_INTERVAL) {
+        persistState();
+    }
+}
+
+/**
+ * Discards the downloaded bytes and allocates a file of the specified
+ * size where the data can be written in arbitrary order with writeRange()
+ */
+void PartialBlob::beginRangedWrite(size_t size) {
+    reset();
+
+    // reserve the disk space upfront (if supported by the filesystem)
+    // to avoid a fragmented file and to fail early if the disk is full
+    if(fallocate(fd, 0, 0, size) != 0 && errno != EOPNOTSUPP) {
+        auto message = boost::format("Failed to allocate %d bytes for file %s: %s") % size % partialFile % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    if(ftruncate(fd, size) != 0) {
+        auto message = boost::format("Failed to resize file %s: %s") % partialFile % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    rangedWriteSize = size;
+}
+
+/**
+ * Writes the specified bytes at the specified position. Can be called concurrently
+ * by multiple threads (on non-overlapping ranges).
+ */
+void PartialBlob::writeRange(const void* data, size_t size, size_t position) {
+    const auto* bytes = static_cast<const char*>(data);
+    size_t bytesWritten = 0;
+    while(bytesWritten < size) {
+        auto r = pwrite(fd, bytes + bytesWritten, size - bytesWritten, position + bytesWritten);
+        if(r == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            auto message = boost::format("Failed to write to file %s: %s") % partialFile % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        bytesWritten += r;
+    }
+}
+
+/**
+ * Computes the digest of the data written with writeRange()
+ */
+void PartialBlob::endRangedWrite() {
+    auto buffer = std::vector<char>(1 << 20);
+    hasher = Sha256Hasher{};
+    for(size_t position = 0; position < rangedWriteSize; ) {
+        auto r = pread(fd, buffer.data(), std::min(buffer.size(), rangedWriteSize - position), position);
+        if(r == -1 && errno == EINTR) {
+            continue;
+        }
+        if(r <= 0) {
+            auto message = boost::format("Failed to read from file %s: %s") % partialFile
+                % (r == 0 ? "unexpected end of file" : strerror(errno));
+            SARUS_THROW_ERROR(message.str());
+        }
+        hasher.update(buffer.data(), r);
+        position += r;
+    }
+
+    offset = rangedWriteSize;
+    if(lseek(fd, offset, SEEK_SET) == -1) {
+        auto message = boost::format("Failed to seek file %s: %s") % partialFile % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    rangedWriteSize = 0;
+}
+
+/**
+ * Discards the downloaded bytes, e.g. because the server doesn't support
+ * range requests or the downloaded data turned out to be corrupted
+ */
+void PartialBlob::reset() {
+    if(ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) == -1) {
+        auto message = boost::format("Failed to truncate file %s: %s") % partialFile % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    hasher = Sha256Hasher{};
+    offset = offsetOfPersistedState = 0;
+    rangedWriteSize = 0;
+    if(isLocked) {
+        removeStateFile();
+    }
+}
+
+/**
+ * Atomically writes the number of downloaded bytes and the state of the digest computation
+ */
+void PartialBlob::persistState() {
+    if(!isLocked) {
+        return;
+    }
+
+    auto state = rj::Document{rj::kObjectType};
+    auto& allocator = state.GetAllocator();
+    state.AddMember("offset", rj::Value{static_cast<uint64_t>(offset)}, allocator);
+    state.AddMember("sha256Context", rj::Value{hasher.getState().c_str(), allocator}, allocator);
+
+    auto stateFileTemp = common::makeUniquePathWithRandomSuffix(stateFile);
+    try {
+        common::writeJSON(state, stateFileTemp);
+        boost::filesystem::rename(stateFileTemp, stateFile); // atomically create/replace state file
+    }
+    catch(std::exception& e) {
+        boost::system::error_code ec;
+        boost::filesystem::remove(stateFileTemp, ec); // don't mask the original error
+        auto message = boost::format("Failed to persist state of partial blob %s") % partialFile;
+        SARUS_RETHROW_ERROR(e, message.str());
+    }
+    offsetOfPersistedState = offset;
+}
+
+/**
+ * Returns the digest of the bytes downloaded so far, e.g. "sha256:<hex digest>"
+ */
+std::string PartialBlob::getDigest() const {
+    auto hasherCopy = hasher;
+    return "sha256:" + hasherCopy.finalize();
+}
+
+/**
+ * Atomically moves the downloaded data to the final blob file
+ */
+void PartialBlob::commit() {
+    boost::filesystem::rename(partialFile, blobFile); // atomically create/replace blob file
+    isCommitted = true;
+    if(isLocked) {
+        removeStateFile();
+    }
+}
+
+void PartialBlob::removeStateFile() const {
+    boost::system::error_code ec;
+    boost::filesystem::remove(stateFile, ec);
+}
+
+void PartialBlob::log(const boost::format& message, common::logType level) const {
+    common::Logger::getInstance().log(message.str(), "PartialBlob", level);
+}
+
+}
+}
@@ -0,0 +1,91 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_PartialBlob_hpp
+#define sarus_image_manager_PartialBlob_hpp
+
+#include <string>
+#include <cstddef>
+
+#include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+
+#include "common/Logger.hpp"
+#include "image_manager/Sha256Hasher.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class represents a blob (e.g. a layer's archive) that is being downloaded.
+ *
+ * The downloaded bytes are stored in a partial file next to the final blob file,
+ * i.e. "<blob file>.partial", and the SHA-256 digest of the bytes is computed
+ * while they are appended. The number of downloaded bytes and the state of the
+ * digest computation are periodically persisted in "<blob file>.partial.state",
+ * so that a later download attempt (also by another Sarus process) can resume
+ * the download from where it was interrupted.
+ *
+ * The partial file is locked with flock(2) for the whole lifetime of the object,
+ * hence the lock is automatically released by the kernel if the process dies.
+ * If the partial file is already locked by another process, or the filesystem
+ * doesn't support locking, the download falls back to a private temporary
+ * file that cannot be resumed.
+ *
+ * Alternatively, the blob can be written in arbitrary order (e.g. by multiple
+ * threads downloading different byte ranges) between beginRangedWrite() and
+ * endRangedWrite(). In this case the digest is computed at the end, reading
+ * back the whole file, and the download cannot be resumed.
+ */
+class PartialBlob {
+public:
+    PartialBlob(const boost::filesystem::path& blobFile);
+    PartialBlob(const PartialBlob&) = delete;
+    PartialBlob& operator=(const PartialBlob&) = delete;
+    ~PartialBlob();
+
+    size_t getOffset() const { return offset; }
+    bool isResumable() const { return isLocked; }
+    void append(const void* data, size_t size);
+    void beginRangedWrite(size_t size);
+    void writeRange(const void* data, size_t size, size_t position);
+    void endRangedWrite();
+    void reset();
+    void persistState();
+    std::string getDigest() const;
+    void commit();
+
+private:
+    void openPartialFile();
+    void restoreState();
+    void removeStateFile() const;
+    void log(const boost::format& message, common::logType level) const;
+
+private:
+    boost::filesystem::path blobFile;
+    boost::filesystem::path partialFile;
+    boost::filesystem::path stateFile;
+    int fd = -1;
+    bool isLocked = false;
+    bool isCommitted = false;
+    size_t offset = 0;
+    size_t offsetOfPersistedState = 0;
+    size_t rangedWriteSize = 0;
+    Sha256Hasher hasher;
+
+    /** number of downloaded bytes after which the state is persisted again */
+    const size_t PERSIST_INTERVAL = 64 << 20;
+};
+
+}
+}
+
+#endif
@@ -20,6 +20,21 @@ PulledImage::PulledImage(std::shared_ptr<const common::Config> config, web::json
     initializeListOfLayersAndMetadata(manifest);
 }
 
+/**
+ * Construct a pulled image whose layers might still be in the process of being downloaded.
+ * The expansion of each layer waits for the completion of the corresponding download,
+ * thus allowing the expansion of the lower layers to overlap with the download of the
+ * upper layers.
+ */
+PulledImage::PulledImage(   std::shared_ptr<const common::Config> config,
+                            web::json::value& manifest,
+                            LayerDownloads layerDownloads)
+    : InputImage{std::move(config)}
+    , layerDownloads{std::move(layerDownloads)}
+{
+    initializeListOfLayersAndMetadata(manifest);
+}
+
 std::tuple<common::PathRAII, common::ImageMetadata, std::string> PulledImage::expand() const {
     auto expansionDir = common::PathRAII{makeTemporaryExpansionDirectory()};
     expandLayers(layers, expansionDir.getPath());
@@ -28,6 +43,49 @@ std::tuple<common::PathRAII, common::ImageMetadata, std::string> PulledImage::ex
     );
 }
 
+std::tuple<common::ImageMetadata, std::string> PulledImage::expandToSquashfs(
+    const boost::filesystem::path& pathOfImage) const {
+    streamLayersToSquashfs(layers, pathOfImage);
+    return std::tuple<common::ImageMetadata, std::string>(metadata, digest);
+}
+
+// The uncompressed sizes of the layers are the (optional) "Size" fields of the
+// manifest's v1 compatibility data
+boost::optional<uintmax_t> PulledImage::estimateScratchSpace(bool isRootfsExpanded) const {
+    if(!sizesOfLayers) {
+        return boost::none;
+    }
+    return estimateScratchSpaceOfLayers(*sizesOfLayers, isRootfsExpanded);
+}
+
+bool PulledImage::waitUntilLayerIsAvailable(const boost::filesystem::path& layerArchive,
+                                            std::chrono::milliseconds timeout) const {
+    auto it = layerDownloads.find(layerArchive.string());
+    if(it == layerDownloads.cend()) {
+        return true; // layer is not being downloaded, i.e. it is expected to be already in the cache
+    }
+
+    if(it->second.wait_for(timeout) != std::future_status::ready) {
+        return false;
+    }
+
+    try {
+        it->second.get();
+    }
+    catch(common::Error& e) {
+        auto message = boost::format("Failed to download layer %s") % layerArchive;
+        SARUS_RETHROW_ERROR(e, message.str());
+    }
+
+    log(boost::format("layer %s is available") % layerArchive, common::logType::DEBUG);
+    return true;
+}
+
+// The layers' archives are stored in the cache as <digest>.tar
+boost::optional<std::string> PulledImage::getLayerDigest(const boost::filesystem::path& layerArchive) const {
+    return layerArchive.stem().string();
+}
+
 /**
  * Construct the orderd layer metadata from image manifest
  */
@@ -119,6 +177,7 @@ void PulledImage::initializeListOfLayersAndMetadata(web::json::value &manifest)
     metadata = common::ImageMetadata(metadataDoc["config"]);
 
     const std::string EMPTY_TAR_SHA256 = "sha256:a3ed95caeb02ffe68cdd9fd84406680ae93d633cb16422d00e8a7c22955b46d4";
+    sizesOfLayers = std::vector<uintmax_t>{};
     for (size_t idx = 0; idx < orderdLayers.size(); ++idx) {
         std::string digest = orderdLayers[idx].at(U("fsLayer")).at(U("blobSum")).serialize();
         digest = common::eraseFirstAndLastDoubleQuote(digest);
@@ -129,6 +188,15 @@ void PulledImage::initializeListOfLayersAndMetadata(web::json::value &manifest)
 
         std::string filename = digest + ".tar";
         this->layers.push_back(config->directories.cache / filename);
+
+        // the size is optional: without the sizes of all the layers the space
+        // needed by the expansion is unknown
+        if(sizesOfLayers && orderdLayers[idx].has_field(U("Size")) && orderdLayers[idx].at(U("Size")).is_number()) {
+            sizesOfLayers->push_back(orderdLayers[idx].at(U("Size")).as_number().to_uint64());
+        }
+        else {
+            sizesOfLayers = boost::none;
+        }
     }
 
     log(boost::format("successfully initialized list of layers and metadata from image's manifest"),
@@ -13,6 +13,9 @@
 
 #include <vector>
 #include <memory>
+#include <string>
+#include <future>
+#include <unordered_map>
 #include <boost/filesystem.hpp>
 #include <cpprest/json.h>
 
@@ -26,15 +29,33 @@ namespace image_manager {
  * This class represents a pulled image that has not been expanded yet.
  */
 class PulledImage : public InputImage {
+public:
+    // pending downloads of the layers' archives (key = path of the layer's archive)
+    using LayerDownloads = std::unordered_map<std::string, std::shared_future<void>>;
+
 public:
     PulledImage(std::shared_ptr<const common::Config> config, web::json::value& manifest);
+    PulledImage(std::shared_ptr<const common::Config> config,
+                web::json::value& manifest,
+                LayerDownloads layerDownloads);
     std::tuple<common::PathRAII, common::ImageMetadata, std::string> expand() const override;
+    std::tuple<common::ImageMetadata, std::string> expandToSquashfs(
+        const boost::filesystem::path& pathOfImage) const override;
+    boost::optional<uintmax_t> estimateScratchSpace(bool isRootfsExpanded) const override;
+    const std::string& getDigest() const { return digest; }
+
+protected:
+    bool waitUntilLayerIsAvailable(const boost::filesystem::path& layerArchive,
+                                   std::chrono::milliseconds timeout) const override;
+    boost::optional<std::string> getLayerDigest(const boost::filesystem::path& layerArchive) const override;
 
 private:
     void initializeListOfLayersAndMetadata(web::json::value &manifest);
 
 private:
     std::vector<boost::filesystem::path> layers;
+    boost::optional<std::vector<uintmax_t>> sizesOfLayers; // uncompressed sizes (if in the manifest)
+    LayerDownloads layerDownloads;
     common::ImageMetadata metadata;
     std::string digest;
 };
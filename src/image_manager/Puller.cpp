@@ -25,10 +25,13 @@
 #include <memory>
 #include <array>
 #include <chrono>
+#include <algorithm>
+#include <iterator>
 
 #include <cpprest/http_client.h>
 #include <cpprest/filestream.h>
 #include <boost/regex.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/program_options.hpp>
@@ -37,6 +40,7 @@
 #include "common/Logger.hpp"
 #include "common/Utility.hpp"
 #include "image_manager/ImageManager.hpp"
+#include "image_manager/CpprestHttpTransport.hpp"
 
 using namespace web;                        // Common features like URIs.
 using namespace web::http;                  // Common HTTP functionality
@@ -46,9 +50,25 @@ namespace sarus {
 namespace image_manager {
 
     Puller::Puller(std::shared_ptr<const common::Config> config)
-        : config{std::move(config)}
+        : config{config}
+        , transport{std::make_shared<CpprestHttpTransport>(config)}
+        , registryCache{config}
+        , registryMirrors{config, this->transport}
+        , retryPolicy{std::make_shared<RetryPolicy>(RetryPolicy::readParameters(*config))}
     {}
 
+    Puller::Puller(std::shared_ptr<const common::Config> config, std::shared_ptr<HttpTransport> transport)
+        : config{config}
+        , transport{std::move(transport)}
+        , registryCache{config}
+        , registryMirrors{config, this->transport}
+        , retryPolicy{std::make_shared<RetryPolicy>(RetryPolicy::readParameters(*config))}
+    {}
+
+    Puller::~Puller() {
+        joinDownloadWorkers();
+    }
+
     /**
      * Pull the container image layer tarfile using configurations (config)
      */
@@ -74,7 +94,8 @@ namespace image_manager {
 
         start = std::chrono::system_clock::now();
 
-        saveImage(fsLayers);
+        auto downloads = saveImage(fsLayers);
+        waitForDownloads(downloads);
 
         end = std::chrono::system_clock::now();
         elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / double(1000);
@@ -86,37 +107,216 @@ namespace image_manager {
     }
 
     /**
-     * Save the container image using parallel threads
+     * Start pulling the container image and return as soon as the download threads
+     * are launched. The returned image waits for the download of each layer right
+     * before expanding it, so that the expansion of the lower layers overlaps with
+     * the download of the upper layers.
+     */
+    PulledImage Puller::startPull() {
+        printLog(boost::format("Start pulling image"), common::logType::INFO);
+
+        printLog( boost::format("# image            : %s") % config->imageID, common::logType::GENERAL);
+        printLog( boost::format("# cache directory  : %s") % config->directories.cache, common::logType::GENERAL);
+        printLog( boost::format("# temp directory   : %s") % config->directories.temp, common::logType::GENERAL);
+        printLog( boost::format("# images directory : %s") % config->directories.images, common::logType::GENERAL);
+
+        manifest = getManifest();
+
+        if (!manifest.has_field(U("fsLayers"))) {
+            SARUS_THROW_ERROR("manifest does not have \"fsLayers\" field.");
+        }
+        web::json::value fsLayers = manifest[U("fsLayers")];
+
+        auto downloads = saveImage(fsLayers);
+
+        printLog(boost::format("Successfully started pulling image"), common::logType::INFO);
+
+        return PulledImage{config, manifest, std::move(downloads)};
+    }
+
+    /**
+     * Save the container image using a fixed-size pool of worker threads
      * 
      * @param fsLaters      The list of digests of container images (manifest[fslayers])
+     * @return              The pending downloads of the layers
      */
-    void Puller::saveImage(json::value fsLayers)
+    PulledImage::LayerDownloads Puller::saveImage(json::value fsLayers)
     {
         printLog( boost::format("> save image layers ..."), common::logType::GENERAL);
         printLog( boost::format("Create download threads."), common::logType::DEBUG);
     
         common::createFoldersIfNecessary(config->directories.cache);
-    
-        std::vector<std::future<void>> results;
-        for(size_t idx = 0; idx < fsLayers.size(); ++idx)
+
+        joinDownloadWorkers(); // in case of a previous pull
+        downloadQueue.reset(new LayerDownloadQueue{});
+        retryPolicy->resumeWaits();
+
+        auto downloads = PulledImage::LayerDownloads{};
+        auto layerSizes = getLayerSizes();
+
+        // collect the download jobs from the base layer to the top layer (fsLayers
+        // lists the layers from top to base), so that the lower layers, which are
+        // the first ones to be expanded, are downloaded first among the layers of
+        // unknown size
+        for(size_t i = fsLayers.size(); i > 0; --i)
         {
-            std::string digest = fsLayers[idx]["blobSum"].serialize();
+            std::string digest = fsLayers[i-1]["blobSum"].serialize();
             digest = common::eraseFirstAndLastDoubleQuote(digest);
     
             // EMPTY_TAR_SHA256 has no members, can be skipped.
             if(digest == EMPTY_TAR_SHA256 ) {
                 continue;
             }
-            // launch download thread
-            results.push_back(
-                std::async(std::launch::async, &Puller::saveLayer, this, digest)
-            );
+
+            // the same layer might be referenced multiple times by the manifest
+            auto layerFile = config->directories.cache / boost::filesystem::path(digest + ".tar");
+            if(downloads.count(layerFile.string())) {
+                continue;
+            }
+
+            auto size = layerSizes.count(digest) ? layerSizes[digest] : size_t{0};
+            auto promise = std::make_shared<std::promise<void>>();
+            downloads[layerFile.string()] = promise->get_future().share();
+            downloadQueue->jobs.push_back(LayerDownloadJob{digest, size, std::move(promise)});
+        }
+
+        // start the largest layers first, so that the total download time is
+        // bound by the largest layer rather than by the layer started last
+        std::stable_sort(downloadQueue->jobs.begin(), downloadQueue->jobs.end(),
+            [](const LayerDownloadJob& lhs, const LayerDownloadJob& rhs) {
+                return lhs.size > rhs.size;
+            });
+
+        // launch download threads
+        auto numberOfWorkers = std::min(getMaxConcurrentDownloads(), downloadQueue->jobs.size());
+        printLog( boost::format("Downloading %s layers with %s threads") % downloadQueue->jobs.size() % numberOfWorkers,
+                  common::logType::DEBUG);
+        for(size_t i = 0; i < numberOfWorkers; ++i) {
+            downloadWorkers.emplace_back(&Puller::runDownloadWorker, this);
+        }
+
+        return downloads;
+    }
+
+    /**
+     * Get the sizes of the layers' blobs as reported by the manifest (if available)
+     * 
+     * @return              The map digest -> size of the layers with known size
+     */
+    std::unordered_map<std::string, size_t> Puller::getLayerSizes() {
+        auto sizes = std::unordered_map<std::string, size_t>{};
+
+        if(!manifest.has_field(U("history")) || !manifest.has_field(U("fsLayers"))) {
+            return sizes;
+        }
+        const auto& fsLayers = manifest.at(U("fsLayers"));
+        const auto& history = manifest.at(U("history"));
+
+        // the "Size" field of the v1 compatibility data is optional, hence
+        // the sizes are just a hint for the scheduling of the downloads
+        for(size_t i = 0; i < fsLayers.size() && i < history.size(); ++i) {
+            try {
+                auto digest = fsLayers.at(i).at(U("blobSum")).as_string();
+                auto v1Compatibility = web::json::value::parse(history.at(i).at(U("v1Compatibility")).as_string());
+                if(v1Compatibility.has_field(U("Size")) && v1Compatibility.at(U("Size")).is_number()) {
+                    sizes[digest] = static_cast<size_t>(v1Compatibility.at(U("Size")).as_number().to_uint64());
+                }
+            }
+            catch(std::exception& e) {
+                printLog( boost::format("Failed to get size of layer from manifest: %s") % e.what(),
+                          common::logType::DEBUG);
+            }
+        }
+
+        return sizes;
+    }
+
+    /**
+     * Get the max number of layers to download at the same time. The value specified
+     * in the CLI takes precedence over the value specified in the configuration file.
+     */
+    size_t Puller::getMaxConcurrentDownloads() const {
+        if(config->commandPull.maxConcurrentDownloads > 0) {
+            return config->commandPull.maxConcurrentDownloads;
+        }
+
+        const auto& json = config->json.get();
+        if(json.HasMember("pull") && json["pull"].HasMember("maxConcurrentDownloads")) {
+            return json["pull"]["maxConcurrentDownloads"].GetUint();
+        }
+
+        return DEFAULT_MAX_CONCURRENT_DOWNLOADS;
+    }
+
+    /**
+     * Download the layers of the job queue until the queue is empty or the downloads are cancelled
+     */
+    void Puller::runDownloadWorker() {
+        while(true) {
+            LayerDownloadJob job;
+            {
+                std::lock_guard<std::mutex> lock{downloadQueue->mutex};
+                if(downloadQueue->isCancelled || downloadQueue->nextJob == downloadQueue->jobs.size()) {
+                    return;
+                }
+                job = downloadQueue->jobs[downloadQueue->nextJob++];
+            }
+
+            try {
+                saveLayer(job.digest, job.size);
+                job.promise->set_value();
+            }
+            catch(...) {
+                job.promise->set_exception(std::current_exception());
+            }
+        }
+    }
+
+    /**
+     * Cancel the downloads that are still in progress (e.g. the expansion of the image
+     * failed) and wait for the termination of the download threads. The workers stop
+     * between jobs, between retries and between the chunks of a blob, whereas the
+     * jobs that were not started yet fail.
+     */
+    void Puller::joinDownloadWorkers() {
+        if(downloadWorkers.empty()) {
+            return;
+        }
+        downloadQueue->isCancelled = true;
+        retryPolicy->cancelWaits();
+        for(auto& worker : downloadWorkers) {
+            worker.join();
+        }
+        downloadWorkers.clear();
+
+        for(auto job = downloadQueue->nextJob; job < downloadQueue->jobs.size(); ++job) {
+            try {
+                auto message = boost::format("Download of layer %s cancelled") % downloadQueue->jobs[job].digest;
+                SARUS_THROW_ERROR(message.str());
+            }
+            catch(...) {
+                downloadQueue->jobs[job].promise->set_exception(std::current_exception());
+            }
+        }
+        downloadQueue->nextJob = downloadQueue->jobs.size();
+
+        retryPolicy->logStatistics();
+    }
+
+    void Puller::throwIfDownloadsCancelled() const {
+        if(downloadQueue->isCancelled) {
+            SARUS_THROW_ERROR("Downloads cancelled");
         }
+    }
 
+    /**
+     * Wait for the completion of the specified downloads
+     */
+    void Puller::waitForDownloads(const PulledImage::LayerDownloads& downloads) {
         try {
             // check that all download threads exited normally (without throwing exceptions)
-            for (auto &result : results){ 
-                result.get();
+            for (const auto& download : downloads){
+                download.second.get();
             }
         }
         catch(common::Error& e) {
@@ -127,65 +327,148 @@ namespace image_manager {
     }
 
     /**
-     * Download the layer tarfile (handle error response, retry)
+     * Download the layer tarfile (fall back to the next endpoint if the selected one fails)
      * 
      * @param digest        The digest of the target download layer
+     * @param sizeHint      The size of the layer reported by the manifest (zero if unknown)
      */
-    void Puller::saveLayer(const std::string &digest)
+    void Puller::saveLayer(const std::string &digest, size_t sizeHint)
     {
         printLog( boost::format("Download the layer: %s") % digest, common::logType::DEBUG);
 
         auto layerFile = config->directories.cache / boost::filesystem::path(digest + ".tar");
-        auto layerFileTemp = common::makeUniquePathWithRandomSuffix(layerFile);
 
         // check if layer is already in cache
         if(boost::filesystem::exists(layerFile)) {
             printLog( boost::format("> %-15.15s: %s") % "found in cache" % digest, common::logType::GENERAL);
             return;
         }
-    
-        web::http::client::http_client       client( getUri(config->imageID.server) );
-        web::http::http_request              request(methods::GET);
-        web::http::http_response             response;
 
-        for(int retry = 0; retry < RETRY_MAX; ++retry) {
-            if ( retry > 0 ) {
+        // the partially downloaded data (if any) is kept across retries and Sarus invocations
+        PartialBlob partialLayer{layerFile};
+
+        // if the selected endpoint fails to serve the blob (e.g. a mirror that lacks it),
+        // resume the download from the next endpoint
+        while(true) {
+            auto endpoint = getSelectedEndpoint();
+            try {
+                downloadLayer(digest, sizeHint, endpoint, partialLayer);
+                return;
+            }
+            catch(common::Error& e) {
+                if(downloadQueue->isCancelled || !fallBackToNextEndpoint(endpoint)) {
+                    throw;
+                }
+                printLog( boost::format("Failed to download layer %s from %s, falling back to %s: %s")
+                            % digest % endpoint % getSelectedEndpoint() % e.getErrorTrace().front().errorMessage,
+                          common::logType::INFO);
+            }
+        }
+    }
+
+    /**
+     * Download the layer tarfile from the specified endpoint (handle error response, retry)
+     *
+     * @param digest        The digest of the target download layer
+     * @param sizeHint      The size of the layer reported by the manifest (zero if unknown)
+     * @param endpoint      The endpoint (registry or mirror) to request the blob to
+     * @param partialLayer  The partially downloaded data of the layer
+     */
+    void Puller::downloadLayer(const std::string &digest, size_t sizeHint,
+                               const std::string &endpoint, PartialBlob &partialLayer)
+    {
+        auto failedAttempts = size_t{0};
+        auto retryAfter = boost::optional<std::chrono::milliseconds>{};
+
+        for(size_t attempt = 0; attempt < retryPolicy->getMaxAttempts(); ++attempt) {
+            throwIfDownloadsCancelled();
+            if ( attempt > 0 ) {
                 printLog( boost::format("> %-15.15s: %s") % "retry" % digest, common::logType::GENERAL);
+                if(failedAttempts > 0) {
+                    retryPolicy->waitBeforeRetry(endpoint, failedAttempts, retryAfter);
+                }
             }
+            retryPolicy->waitUntilCircuitIsClosed(endpoint);
+            throwIfDownloadsCancelled();
+            retryAfter = boost::none;
             
             std::string path = (boost::format("v2/%s/%s/blobs/%s")
                                 % config->imageID.repositoryNamespace
                                 % config->imageID.image
                                 % digest).str();
+            auto usedToken = getAuthToken();
+            web::http::http_request request(methods::GET);
             request.set_request_uri(path);
-
-            request.headers().clear();
-            std::string header = (boost::format("Bearer %s") % token).str();
+            std::string header = (boost::format("Bearer %s") % usedToken).str();
             request.headers().add(header_names::authorization, U(header) );
 
+            // in case the registry serves the blob directly (without redirect)
+            if(partialLayer.getOffset() > 0) {
+                request.headers().add(U("Range"), (boost::format("bytes=%d-") % partialLayer.getOffset()).str());
+            }
+
             printLog( boost::format("httpclient: uri=%s, path=%s, header=%25.25s..., digest=%25.25s...")
-                        % getUri(config->imageID.server) % path % header % digest, common::logType::DEBUG);
+                        % endpoint % path % header % digest, common::logType::DEBUG);
 
-            response = client.request(request).get();
+            web::http::http_response response;
+            try {
+                response = transport->request(endpoint, request);
+            }
+            catch(std::exception& e) {
+                printLog( boost::format("> %-15.15s: %s") % "failed" % digest, common::logType::GENERAL);
+                printLog( boost::format("Request to %s failed: %s") % endpoint % e.what(), common::logType::DEBUG);
+                retryPolicy->recordFailure(endpoint, "connection error");
+                ++failedAttempts;
+                continue;
+            }
             printLog( boost::format("Received http_response status code (%s): %s, digest=%s")
                 % response.status_code() % response.reason_phrase() % digest, common::logType::DEBUG);
 
-            if ( response.status_code() == status_codes::OK ) {
-                break;
+            std::string actualDigest;
+
+            // the registry serves the blob directly (e.g. a mirror with filesystem storage)
+            if ( response.status_code() == status_codes::OK || response.status_code() == 206 ) {
+                retryPolicy->recordSuccess(endpoint);
+                printLog( boost::format("> %-15.15s: %s") % "pulling" % digest, common::logType::GENERAL);
+                try {
+                    actualDigest = receiveBlob(response, partialLayer);
+                }
+                catch(common::Error& e) {
+                    printLog( boost::format("> %-15.15s: %s") % "failed" % digest, common::logType::GENERAL);
+                    common::Logger::getInstance().logErrorTrace(e, sysname);
+                    retryPolicy->recordFailure(endpoint, "download error");
+                    ++failedAttempts;
+                    continue; // retry download
+                }
             }
             // when unauthorized response arrived, request new token
             else if (response.status_code() == 401) {
                 printLog( boost::format("> %-15.15s: %s") % "tokenExpired" % digest, common::logType::GENERAL);
 
                 try {
-                    token = requestAuthToken();
+                    refreshAuthToken(usedToken);
                 } catch (const std::exception &e) {
                     printLog( boost::format("Failed to get authorized token."), common::logType::ERROR);
                 }
                 continue;
             }
+            // the registry is rate limiting the requests or is (temporarily) unavailable
+            else if (response.status_code() == 429
+                     || response.status_code() == 408
+                     || response.status_code() >= 500) {
+                printLog( boost::format("> %-15.15s: %s (%s %s)") % "failed" % digest
+                            % response.status_code() % response.reason_phrase(), common::logType::GENERAL);
+                auto retryAfterHeader = std::string{};
+                if(response.headers().match(U("Retry-After"), retryAfterHeader)) {
+                    retryAfter = RetryPolicy::parseRetryAfter(retryAfterHeader);
+                }
+                retryPolicy->recordFailure(endpoint, std::to_string(response.status_code()), retryAfter);
+                ++failedAttempts;
+                continue;
+            }
             // handle redirect to download layer
             else if (response.status_code() > 300 && response.status_code() < 309) {
+                retryPolicy->recordSuccess(endpoint);
                 // parse redirected location
                 std::string location = response.headers()[U("Location")];
                 boost::cmatch matches;
@@ -200,80 +483,320 @@ namespace image_manager {
                 printLog( boost::format("> %-15.15s: %s") % "pulling" % digest, common::logType::GENERAL);
 
                 try {
-                    downloadStream(downloadUri, path, layerFileTemp);
+                    actualDigest = downloadStream(downloadUri, path, sizeHint, partialLayer);
                 }
                 catch(common::Error& e) {
                     printLog( boost::format("> %-15.15s: %s") % "failed" % digest, common::logType::GENERAL);
                     common::Logger::getInstance().logErrorTrace(e, sysname);
+                    retryPolicy->recordFailure(downloadUri, "download error");
+                    ++failedAttempts;
                     continue; // retry download
                 }
-
-                if(!checkSum(digest, layerFileTemp)) {
-                    printLog( boost::format("> %-15.15s: %s") % "bad checksum" % digest, common::logType::GENERAL);
-                    boost::filesystem::remove(layerFileTemp);
-                    continue; // retry download
-                }
-                // if checksum succeeded, finish download process
-                boost::filesystem::rename(layerFileTemp, layerFile); // atomically create/replace layer file
-                printLog( boost::format("> %-15.15s: %s") % "completed" % digest, common::logType::GENERAL);
-                printLog( boost::format("Success to download : %s") % digest, common::logType::DEBUG);
-                return;
+                retryPolicy->recordSuccess(downloadUri);
             }
-            // other http response means irregal status
+            // other http response means irregal status (retrying wouldn't help)
             else {
-                printLog( boost::format("Unexpected http_response (%s): %s, digest=%s")
-                    % response.status_code() % response.reason_phrase() % digest, common::logType::ERROR);
-                continue;
+                auto message = boost::format("Failed to download image layer %s. Unexpected http_response (%s): %s")
+                    % digest % response.status_code() % response.reason_phrase();
+                SARUS_THROW_ERROR(message.str());
             }
+
+            if(!checkSum(digest, actualDigest)) {
+                printLog( boost::format("> %-15.15s: %s") % "bad checksum" % digest, common::logType::GENERAL);
+                partialLayer.reset();
+                ++failedAttempts;
+                continue; // retry download
+            }
+            // if checksum succeeded, finish download process
+            partialLayer.commit(); // atomically create/replace layer file
+            printLog( boost::format("> %-15.15s: %s") % "completed" % digest, common::logType::GENERAL);
+            printLog( boost::format("Success to download : %s") % digest, common::logType::DEBUG);
+            return;
         }
-        auto message = boost::format("Failed to download image layer %s. Exceeded max number of retries (%s).") % digest % RETRY_MAX;
+        auto message = boost::format("Failed to download image layer %s. Exceeded max number of attempts (%s).")
+            % digest % retryPolicy->getMaxAttempts();
         SARUS_THROW_ERROR(message.str());
     }
     
     /**
-     * Download the http response body
+     * Download the http response body. The SHA-256 digest of the body is computed
+     * in process while the bytes are received, so that the verification of the
+     * downloaded data requires neither an additional read pass nor an external program.
+     * If the blob was already partially downloaded, only the missing bytes are
+     * requested through an HTTP range request. In case of error the bytes received
+     * so far are kept, so that a later attempt can resume the download.
+     * A large blob that was not partially downloaded is fetched in multiple
+     * ranges concurrently (see downloadRanges). The size of the blob is probed
+     * with a one-byte range request only if the size reported by the manifest
+     * is unknown or above the threshold, so that the other blobs are fetched
+     * with a single request.
      * 
      * @param uri       The base uri location of HTTP client
      * @param path          The request uri of the download stream
-     * @param filename      The filename to save
+     * @param sizeHint      The size of the layer reported by the manifest (zero if unknown)
+     * @param blob          The (partially downloaded) blob where the body is appended
+     * @return              The digest of the downloaded blob (e.g. "sha256:<hex digest>")
      */
-    void Puller::downloadStream(const std::string &uri, const std::string &path, const boost::filesystem::path &filename)
+    std::string Puller::downloadStream(const std::string &uri, const std::string &path,
+                                       size_t sizeHint, PartialBlob &blob)
     {
-        printLog( boost::format("Start downloadStream: uri=%s, path=%s, filename=%s") % uri % path % filename, common::logType::DEBUG);
-        auto fileStream = std::make_shared<ostream>();
-        
-        // Open stream
-        pplx::task<void> requestTask = fstream::open_ostream(U(filename.string())).then([=](ostream outFile) {
-            *fileStream = outFile;
-            web::http::client::http_client client( uri );
-            web::http::http_request        request(methods::GET);
+        printLog( boost::format("Start downloadStream: uri=%s, path=%s, offset=%s") % uri % path % blob.getOffset(),
+                  common::logType::DEBUG);
 
+        try {
+            // large blobs are split in ranges that are downloaded in parallel
+            auto isPossiblyLarge = sizeHint == 0 || sizeHint >= getMultiRangeDownloadSizeThreshold();
+            if(blob.getOffset() == 0 && getNumberOfDownloadRanges() > 1 && isPossiblyLarge) {
+                auto response = requestRange(uri, path, 0, 0);
+                if(response.status_code() == status_codes::OK) {
+                    // the server ignored the range request and sends the whole blob
+                    appendResponseBody(response, blob);
+                    printLog( boost::format("Finished download Stream: uri=%s, path=%s") % uri % path,
+                              common::logType::DEBUG);
+                    return blob.getDigest();
+                }
+                auto blobSize = getBlobSizeFromContentRange(response);
+                if(blobSize && *blobSize >= getMultiRangeDownloadSizeThreshold()) {
+                    downloadRanges(uri, path, *blobSize, blob);
+                    printLog( boost::format("Finished download Stream: uri=%s, path=%s") % uri % path,
+                              common::logType::DEBUG);
+                    return blob.getDigest();
+                }
+            }
+
+            web::http::http_request request(methods::GET);
             request.set_request_uri(path);
-            return client.request(request);
-        })
-        // handle response
-        .then([=](http_response response) {
-            if ( response.status_code() != status_codes::OK ) {
-                auto message = boost::format("Received http_response status code (%s): %s, uri=%s, path=%s, filename=%s")
-                    % response.status_code() % response.reason_phrase() % uri % path % filename;
+
+            auto offset = blob.getOffset();
+            if(offset > 0) {
+                request.headers().add(U("Range"), (boost::format("bytes=%d-") % offset).str());
+            }
+
+            auto response = transport->request(uri, request);
+            if ( response.status_code() != status_codes::OK && response.status_code() != 206 && response.status_code() != 416 ) {
+                auto message = boost::format("Received http_response status code (%s): %s, uri=%s, path=%s")
+                    % response.status_code() % response.reason_phrase() % uri % path;
                 SARUS_THROW_ERROR(message.str());
             }
-            return response.body().read_to_end(fileStream->streambuf());
-        })
-        // close stream
-        .then([=](size_t) {
-            return fileStream->close();
-        });
 
-        try {
-            requestTask.wait();
+            receiveBlob(response, blob);
         }
-        catch (const std::exception &e) {
-            boost::filesystem::remove(filename);
+        catch (std::exception &e) {
+            blob.persistState();
             SARUS_RETHROW_ERROR(e, "Download stream error");
         }
 
-        printLog( boost::format("Finished download Stream: uri=%s, path=%s, filename=%s") % uri % path % filename, common::logType::DEBUG);
+        printLog( boost::format("Finished download Stream: uri=%s, path=%s") % uri % path, common::logType::DEBUG);
+
+        return blob.getDigest();
+    }
+
+    /**
+     * Append the body of the response to a (possibly ranged) GET request of the blob.
+     * If the blob was partially downloaded, the request is expected to ask for the
+     * missing bytes ("Range: bytes=<offset>-"). In case of error the bytes received
+     * so far are kept, so that a later attempt can resume the download.
+     *
+     * @param response      The response with status 200, 206 or 416
+     * @param blob          The (partially downloaded) blob where the body is appended
+     * @return              The digest of the downloaded blob (e.g. "sha256:<hex digest>")
+     */
+    std::string Puller::receiveBlob(web::http::http_response &response, PartialBlob &blob)
+    {
+        try {
+            auto offset = blob.getOffset();
+            if (offset > 0 && response.status_code() == status_codes::OK) {
+                // the server ignored the range request and sends the whole blob
+                printLog( boost::format("Server doesn't support range requests, restarting download from byte 0"),
+                          common::logType::DEBUG);
+                blob.reset();
+            }
+            else if (response.status_code() == 416) {
+                // the partial data doesn't match the blob (e.g. it is larger than the blob)
+                blob.reset();
+                SARUS_THROW_ERROR("Received http_response status code 416 (Range Not Satisfiable). Discarded partial data.");
+            }
+            else if (response.status_code() == 206) {
+                auto expectedContentRange = (boost::format("bytes %d-") % offset).str();
+                auto contentRange = response.headers()[U("Content-Range")];
+                if(contentRange.compare(0, expectedContentRange.size(), expectedContentRange) != 0) {
+                    blob.reset();
+                    auto message = boost::format("Received unexpected Content-Range \"%s\" (expected \"%s...\")."
+                                                 " Discarded partial data.") % contentRange % expectedContentRange;
+                    SARUS_THROW_ERROR(message.str());
+                }
+            }
+
+            appendResponseBody(response, blob);
+        }
+        catch (std::exception &e) {
+            blob.persistState();
+            SARUS_RETHROW_ERROR(e, "Failed to receive blob");
+        }
+
+        return blob.getDigest();
+    }
+
+    /**
+     * Stream the http response body to the blob (file + hasher)
+     */
+    void Puller::appendResponseBody(web::http::http_response &response, PartialBlob &blob) {
+        auto body = response.body().streambuf();
+        auto buffer = std::vector<uint8_t>(DOWNLOAD_BUFFER_SIZE);
+        while(true) {
+            throwIfDownloadsCancelled();
+            auto bytesRead = body.getn(buffer.data(), buffer.size()).get();
+            if(bytesRead == 0) {
+                break;
+            }
+            blob.append(buffer.data(), bytesRead);
+        }
+    }
+
+    /**
+     * Download the blob splitting it in byte ranges that are fetched concurrently
+     * (one connection per range) and written at their offset in the preallocated
+     * blob file. The digest of the blob is computed once all the ranges are written.
+     * A blob downloaded this way cannot be resumed.
+     *
+     * @param uri           The base uri location of HTTP client
+     * @param path          The request uri of the download stream
+     * @param blobSize      The size of the blob
+     * @param blob          The blob where the ranges are written
+     */
+    void Puller::downloadRanges(const std::string &uri, const std::string &path, size_t blobSize, PartialBlob &blob)
+    {
+        auto numberOfRanges = getNumberOfDownloadRanges();
+        auto rangeSize = (blobSize + numberOfRanges - 1) / numberOfRanges;
+
+        printLog( boost::format("Downloading %s bytes in %s ranges of %s bytes: uri=%s, path=%s")
+                    % blobSize % numberOfRanges % rangeSize % uri % path, common::logType::DEBUG);
+
+        blob.beginRangedWrite(blobSize);
+
+        auto downloads = std::vector<std::future<void>>{};
+        for(size_t first = 0; first < blobSize; first += rangeSize) {
+            auto last = std::min(first + rangeSize, blobSize) - 1;
+            downloads.push_back(std::async(std::launch::async, &Puller::downloadRange,
+                                           this, uri, path, first, last, std::ref(blob)));
+        }
+
+        // wait for all the ranges, also when one of them fails, because they write to the blob
+        auto error = std::exception_ptr{};
+        for(auto& download : downloads) {
+            try {
+                download.get();
+            }
+            catch(...) {
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if(error) {
+            blob.reset();
+            std::rethrow_exception(error);
+        }
+
+        blob.endRangedWrite();
+    }
+
+    /**
+     * Download the byte range [first, last] of the blob
+     */
+    void Puller::downloadRange(const std::string &uri, const std::string &path, size_t first, size_t last, PartialBlob &blob)
+    {
+        auto response = requestRange(uri, path, first, last);
+
+        auto expectedContentRange = (boost::format("bytes %d-%d/") % first % last).str();
+        auto contentRange = response.headers()[U("Content-Range")];
+        if(response.status_code() != 206
+            || contentRange.compare(0, expectedContentRange.size(), expectedContentRange) != 0) {
+            auto message = boost::format("Failed to download range %d-%d. Received http_response status code (%s): %s,"
+                                         " Content-Range=\"%s\", uri=%s, path=%s")
+                % first % last % response.status_code() % response.reason_phrase() % contentRange % uri % path;
+            SARUS_THROW_ERROR(message.str());
+        }
+
+        auto body = response.body().streambuf();
+        auto buffer = std::vector<uint8_t>(DOWNLOAD_BUFFER_SIZE);
+        auto position = first;
+        while(true) {
+            throwIfDownloadsCancelled();
+            auto bytesRead = body.getn(buffer.data(), buffer.size()).get();
+            if(bytesRead == 0) {
+                break;
+            }
+            if(position + bytesRead > last + 1) {
+                auto message = boost::format("Received more data than requested for range %d-%d") % first % last;
+                SARUS_THROW_ERROR(message.str());
+            }
+            blob.writeRange(buffer.data(), bytesRead, position);
+            position += bytesRead;
+        }
+
+        if(position != last + 1) {
+            auto message = boost::format("Received incomplete data for range %d-%d (%d bytes)")
+                % first % last % (position - first);
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+
+    /**
+     * Request the byte range [first, last] of the resource
+     */
+    web::http::http_response Puller::requestRange(const std::string &uri, const std::string &path,
+                                                  size_t first, size_t last)
+    {
+        web::http::http_request request(methods::GET);
+        request.set_request_uri(path);
+        request.headers().add(U("Range"), (boost::format("bytes=%d-%d") % first % last).str());
+        return transport->request(uri, request);
+    }
+
+    /**
+     * Get the total size of the blob from the Content-Range header of a 206 response
+     * (e.g. "bytes 0-0/1234"). Returns none if the size is not available.
+     */
+    boost::optional<size_t> Puller::getBlobSizeFromContentRange(const web::http::http_response &response)
+    {
+        if(response.status_code() != 206) {
+            return boost::none;
+        }
+
+        auto contentRange = std::string{};
+        if(!response.headers().match(U("Content-Range"), contentRange)) {
+            return boost::none;
+        }
+        boost::smatch matches;
+        if(!boost::regex_match(contentRange, matches, boost::regex{"bytes [0-9]+-[0-9]+/([0-9]+)"})) {
+            return boost::none;
+        }
+        return boost::lexical_cast<size_t>(matches[1]);
+    }
+
+    /**
+     * Get the number of ranges in which a large blob is split (1 = no split)
+     */
+    size_t Puller::getNumberOfDownloadRanges() const {
+        const auto& json = config->json.get();
+        if(json.HasMember("pull") && json["pull"].HasMember("multiRangeDownload")
+            && json["pull"]["multiRangeDownload"].HasMember("numberOfRanges")) {
+            return json["pull"]["multiRangeDownload"]["numberOfRanges"].GetUint();
+        }
+        return DEFAULT_NUMBER_OF_DOWNLOAD_RANGES;
+    }
+
+    /**
+     * Get the min size of a blob to be split in ranges
+     */
+    size_t Puller::getMultiRangeDownloadSizeThreshold() const {
+        const auto& json = config->json.get();
+        if(json.HasMember("pull") && json["pull"].HasMember("multiRangeDownload")
+            && json["pull"]["multiRangeDownload"].HasMember("sizeThreshold")) {
+            return json["pull"]["multiRangeDownload"]["sizeThreshold"].GetUint64();
+        }
+        return DEFAULT_MULTI_RANGE_DOWNLOAD_SIZE_THRESHOLD;
     }
  
     /**
@@ -290,10 +813,62 @@ namespace image_manager {
             printLog( boost::format("Success to get cached manifest."), common::logType::DEBUG);
             return this->manifest;
         }
-        // otherwise, get new token and request manifest
-        std::string newToken = requestAuthToken();
-        token = newToken;
-        this->manifest = getManifest( newToken );
+        endpoints = registryMirrors.getEndpoints(config->imageID.server);
+
+        // otherwise, look for the manifest in the disk cache (e.g. pulled shortly before by another node
+        // of the job) and pull the blobs from the endpoint that served the cached manifest
+        for(const auto& endpoint : endpoints) {
+            auto cachedManifest = registryCache.getManifest(endpoint, config->imageID.getUniqueKey());
+            if(cachedManifest) {
+                this->manifest = web::json::value::parse(U(*cachedManifest));
+                selectEndpoint(endpoint);
+                printLog( boost::format("Success to get manifest of %s from disk cache.") % endpoint,
+                          common::logType::DEBUG);
+                return this->manifest;
+            }
+        }
+
+        // otherwise, request manifest to the mirrors of the registry (if any) and
+        // fall back to the next endpoint if a mirror is unreachable or lacks the image
+        for(size_t i = 0; i < endpoints.size(); ++i) {
+            selectEndpoint(endpoints[i]);
+            try {
+                this->manifest = getManifestFromEndpoint();
+                break;
+            }
+            catch(std::exception& e) {
+                if(i == endpoints.size() - 1) {
+                    throw;
+                }
+                const auto* error = dynamic_cast<const common::Error*>(&e);
+                auto reason = error ? error->getErrorTrace().front().errorMessage : std::string{e.what()};
+                printLog( boost::format("Failed to get manifest from %s, falling back to %s: %s")
+                            % endpoints[i] % endpoints[i+1] % reason,
+                          common::logType::INFO);
+            }
+        }
+
+        registryCache.putManifest(getSelectedEndpoint(), config->imageID.getUniqueKey(), manifest.serialize());
+
+        printLog( boost::format("Success to get manifest."), common::logType::DEBUG);
+        return this->manifest;
+    }
+
+    /**
+     * Get the image manifest from the selected endpoint of the registry
+     */
+    web::json::value Puller::getManifestFromEndpoint()
+    {
+        // request manifest (with a new token if the current one is rejected)
+        auto usedToken = getAuthToken();
+        auto manifest = getManifest( usedToken );
+        if(manifest.is_null()) {
+            manifest = getManifest( refreshAuthToken(usedToken) );
+        }
+        if(manifest.is_null()) {
+            SARUS_THROW_ERROR("Failed to get manifest. Possible reasons: bad image ID specified"
+                              " or access to repository denied (try with --login).");
+        }
 
         // check manifest
         if ( manifest.has_field(U("errors")) ) {
@@ -303,19 +878,17 @@ namespace image_manager {
             SARUS_THROW_ERROR(message.str());
         }
 
-        printLog( boost::format("Success to get manifest."), common::logType::DEBUG);
-        return this->manifest;
+        return manifest;
     }
 
     /**
-     * Get the NEW image manifest
+     * Get the NEW image manifest (null if the registry rejects the token)
      */
     web::json::value Puller::getManifest(const std::string &token)
     {
         printLog(boost::format("Retrieving image manifest."), common::logType::INFO);
 
         // request new image manifest
-        web::http::client::http_client      client( getUri(config->imageID.server) );
         web::http::http_request             request(methods::GET);
         web::http::http_response            response;
         
@@ -323,56 +896,64 @@ namespace image_manager {
         std::string header = (boost::format("Bearer %s") % token).str();
         request.headers().add(header_names::authorization, U(header) );
 
-        printLog( boost::format("server      : %s") % getUri(config->imageID.server), common::logType::DEBUG);
+        printLog( boost::format("server      : %s") % registryUri, common::logType::DEBUG);
         printLog( boost::format("request_uri : %s") % getManifestPath(), common::logType::DEBUG);
         printLog( boost::format("header      : %s") % U(header), common::logType::DEBUG);
         
-        response = client.request(request).get();
+        try {
+            response = transport->request(registryUri, request);
+        }
+        catch (const std::exception& e) {
+            SARUS_RETHROW_ERROR(e, "Failed to get manifest");
+        }
 
+        if(response.status_code() == 401) {
+            printLog(boost::format("Auth token rejected by the registry."), common::logType::DEBUG);
+            return web::json::value{};
+        }
         if(response.status_code() != status_codes::OK) {
             auto message = boost::format("Received http_response status code(%s): %s")
                 % response.status_code() % response.reason_phrase();
             SARUS_THROW_ERROR(message.str());
         }
         
-        this->manifest = response.extract_json(true).get();
-        printLog(   boost::format("Retrieved image manifest:\n%s") % this->manifest.serialize(),
+        auto manifest = response.extract_json(true).get();
+        printLog(   boost::format("Retrieved image manifest:\n%s") % manifest.serialize(),
                     common::logType::DEBUG);
 
         printLog(boost::format("Successfully retrieved image manifest."), common::logType::INFO);
 
-        return this->manifest;
+        return manifest;
     }
 
     /**
-     * Test the checksum of file content and digest
+     * Test the expected digest against the digest actually computed on the downloaded data
      */
-    bool Puller::checkSum(const std::string &digest, const boost::filesystem::path &filename)
+    bool Puller::checkSum(const std::string &expectedDigest, const std::string &actualDigest)
     {
-        /** check target filename sum and return result */
-        printLog( boost::format("checksum: %s") % filename, common::logType::DEBUG);
-        printLog( boost::format("checksum: digest=%s, filename=%s") % digest % filename, common::logType::DEBUG);
+        printLog( boost::format("checksum: expected digest=%s, actual digest=%s") % expectedDigest % actualDigest,
+                  common::logType::DEBUG);
 
         boost::cmatch matches;
         boost::regex re("(.*?):(.*?)");
-        if (!boost::regex_match(digest.c_str(), matches, re)) {
-            printLog( boost::format("Failed to parse filename: %s") % digest, common::logType::ERROR);
+        if (!boost::regex_match(expectedDigest.c_str(), matches, re)) {
+            printLog( boost::format("Failed to parse digest: %s") % expectedDigest, common::logType::ERROR);
+            return false;
+        }
+        std::string hashType = matches[1].str();
+        if(hashType != "sha256") {
+            printLog( boost::format("Unsupported digest algorithm %s (only sha256 is supported)") % hashType,
+                      common::logType::ERROR);
             return false;
         }
-        std::string hash_type = matches[1].str();
-        std::string value     = matches[2].str();
-        std::string command   = hash_type + "sum";
 
-        // checksum
-        std::string result = common::executeCommand(command + " " + filename.string());
-        std::string checksum = result.substr(0, result.find(" "));
-    
-        if(checksum != value) {
-            printLog( boost::format("Failed to test the checksum of layer %s") % filename, common::logType::ERROR);
-            printLog( boost::format("expected checksum=%s, actually computed checksum=%s") % value % checksum, common::logType::DEBUG);
+        if(actualDigest != expectedDigest) {
+            printLog( boost::format("Failed to test the checksum of layer %s") % expectedDigest, common::logType::ERROR);
+            printLog( boost::format("expected digest=%s, actually computed digest=%s") % expectedDigest % actualDigest,
+                      common::logType::DEBUG);
             return false;
         }
-        printLog( boost::format("successfully verified checksum of layer %s") % filename, common::logType::DEBUG);
+        printLog( boost::format("successfully verified checksum of layer %s") % expectedDigest, common::logType::DEBUG);
         return true;
     }
     
@@ -406,22 +987,24 @@ namespace image_manager {
         printLog( boost::format("Request new auth token."), common::logType::DEBUG);
 
         // get unauthorized header
-        std::unique_ptr<web::http::client::http_client> client = setupHttpClientWithCredential(getUri(config->imageID.server));
         web::http::http_request              request(methods::GET);
-        pplx::task<web::http::http_response> responseTask;
         web::http::http_response             response;
 
         request.set_request_uri( getManifestPath() );
-        responseTask = client->request(request);
         
         try {
-            responseTask.wait();
-            response = responseTask.get();
+            response = transport->request(registryUri, request, true);
         }
         catch (const std::exception& e) {
             SARUS_RETHROW_ERROR(e, "Failed to get token");
         }
 
+        // the endpoint (e.g. a pull-through cache) serves the repository without token
+        if(response.status_code() == status_codes::OK) {
+            printLog( boost::format("No auth token needed by %s.") % registryUri, common::logType::DEBUG);
+            return "";
+        }
+
         if(response.status_code() != 401) {
             auto message = boost::format("Received http_response status code(%s): %s") 
                 % response.status_code() %  response.reason_phrase();
@@ -439,7 +1022,6 @@ namespace image_manager {
         printLog( boost::format("scope  : %s") % scope, common::logType::DEBUG);
 
         // get authorized token
-        std::unique_ptr<web::http::client::http_client> tokenClient = setupHttpClientWithCredential( realm );
         web::http::http_request             tokenReq(methods::GET);
         web::uri_builder                    tokenUriBuilder("");
         web::http::http_response            tokenResp;
@@ -449,22 +1031,32 @@ namespace image_manager {
         tokenUriBuilder.append_query(U("service"), service);
         tokenReq.set_request_uri(tokenUriBuilder.to_string());
 
-        tokenResp = tokenClient->request(tokenReq).get();
+        tokenResp = transport->request(realm, tokenReq, true);
         if(tokenResp.status_code() != status_codes::OK) {
             auto message = boost::format("Failed to get token. Received http_response status code(%s): %s")
                 % tokenResp.status_code() %  tokenResp.reason_phrase();
             SARUS_THROW_ERROR(message.str());
         }
 
+        // the token server might not specify the expiration, in which case
+        // the token is valid for 60 seconds (Docker registry token specification)
+        auto expiresIn = std::chrono::seconds{60};
         try {
             json::value respJson = tokenResp.extract_json().get();
             token = respJson[U("token")].serialize();
             token = common::eraseFirstAndLastDoubleQuote(token);
+            if(respJson.has_field(U("expires_in")) && respJson.at(U("expires_in")).is_integer()) {
+                expiresIn = std::chrono::seconds{respJson.at(U("expires_in")).as_integer()};
+            }
         }
         catch (const std::exception& e) {
             SARUS_RETHROW_ERROR(e, "Failed to get Token: %s");
         }
 
+        if(isAuthTokenCacheable()) {
+            registryCache.putToken(getAuthTokenCacheKey(), token, expiresIn);
+        }
+
         printLog( boost::format("Token: %s") % token, common::logType::DEBUG);
         printLog( boost::format("Success to get new token."), common::logType::DEBUG);
     
@@ -472,26 +1064,101 @@ namespace image_manager {
     }
 
     /**
-     *  Setup the http client with credential
+     * Get the current auth token (shared by all the download threads). The first
+     * time, the token is looked up in the disk cache or requested to the registry.
+     */
+    std::string Puller::getAuthToken() {
+        std::lock_guard<std::mutex> lock{authToken->mutex};
+        if(!authToken->isInitialized) {
+            auto cachedToken = isAuthTokenCacheable()
+                ? registryCache.getToken(getAuthTokenCacheKey())
+                : boost::none;
+            authToken->value = cachedToken ? *cachedToken : requestAuthToken();
+            authToken->isInitialized = true;
+        }
+        return authToken->value;
+    }
+
+    /**
+     * Replace the auth token rejected by the registry with a new one. The refresh is
+     * single-flight: when multiple threads find out that the same token expired, only
+     * the first one requests a new token, whereas the others wait for it and use it.
+     *
+     * @param rejectedToken     The token used in the request that the registry rejected
+     * @return                  The new token
      */
-    std::unique_ptr<web::http::client::http_client> Puller::setupHttpClientWithCredential(const std::string& server)
-    {   
-        // if repository is private, add credential configrations
-        if(config->authentication.isAuthenticationNeeded) {
-            web::http::client::http_client_config clientConfig;
-            web::credentials creds( U(config->authentication.username), U(config->authentication.password) );
-            clientConfig.set_credentials(creds);
-            return std::unique_ptr<web::http::client::http_client>( new web::http::client::http_client( server, clientConfig ));
+    std::string Puller::refreshAuthToken(const std::string& rejectedToken) {
+        std::lock_guard<std::mutex> lock{authToken->mutex};
+        if(authToken->value != rejectedToken) {
+            printLog( boost::format("Auth token already refreshed by another thread."), common::logType::DEBUG);
+            return authToken->value;
         }
+        authToken->value = requestAuthToken();
+        authToken->isInitialized = true;
+        return authToken->value;
+    }
 
-        return std::unique_ptr<web::http::client::http_client>( new web::http::client::http_client( server ));
+    /**
+     * Select the endpoint (the registry or one of its mirrors) to pull the image from.
+     * The auth tokens are issued per endpoint, hence the current token is discarded.
+     */
+    void Puller::selectEndpoint(const std::string& endpoint) {
+        std::lock_guard<std::mutex> lock{authToken->mutex};
+        printLog( boost::format("Selected registry endpoint %s") % endpoint, common::logType::DEBUG);
+        registryUri = endpoint;
+        authToken->value.clear();
+        authToken->isInitialized = false;
     }
-    
+
     /**
-     * Get the uri path of host
+     * Get the selected endpoint (the download threads might fall back to the next one)
      */
-    std::string Puller::getUri(const std::string &server) {
-        return "https://" + server;
+    std::string Puller::getSelectedEndpoint() {
+        std::lock_guard<std::mutex> lock{authToken->mutex};
+        return registryUri;
+    }
+
+    /**
+     * Select the endpoint that follows the failed one, e.g. the registry after a mirror
+     * that lacks a blob. When multiple threads fail on the same endpoint, only the first
+     * one selects the next endpoint, whereas the others retry with the one already selected.
+     *
+     * @param failedEndpoint    The endpoint that failed to serve a blob
+     * @return                  false if there is no endpoint left to fall back to
+     */
+    bool Puller::fallBackToNextEndpoint(const std::string& failedEndpoint) {
+        std::lock_guard<std::mutex> lock{authToken->mutex};
+        if(registryUri != failedEndpoint) {
+            return true;
+        }
+        auto failed = std::find(endpoints.cbegin(), endpoints.cend(), failedEndpoint);
+        if(failed == endpoints.cend() || std::next(failed) == endpoints.cend()) {
+            return false;
+        }
+        registryUri = *std::next(failed);
+        printLog( boost::format("Selected registry endpoint %s") % registryUri, common::logType::DEBUG);
+        authToken->value.clear();
+        authToken->isInitialized = false;
+        return true;
+    }
+
+    /**
+     * The tokens obtained with the user's credentials (sarus pull --login) are not
+     * cached on disk, since they grant access to private repositories
+     */
+    bool Puller::isAuthTokenCacheable() const {
+        return !config->authentication.isAuthenticationNeeded;
+    }
+
+    /**
+     * Get the key of the auth token in the disk cache. The key identifies the
+     * endpoint and repository, which determine the realm, service and scope of the token.
+     */
+    std::string Puller::getAuthTokenCacheKey() const {
+        return (boost::format("%s/%s/%s")
+                % registryUri
+                % config->imageID.repositoryNamespace
+                % config->imageID.image).str();
     }
 
     /**
@@ -14,16 +14,27 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include <cpprest/http_client.h>
 #include <cpprest/filestream.h>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
+#include <boost/optional.hpp>
 
 #include "common/Config.hpp"
 #include "common/Utility.hpp"
 #include "common/Logger.hpp"
 #include "image_manager/PulledImage.hpp"
+#include "image_manager/PartialBlob.hpp"
+#include "image_manager/HttpTransport.hpp"
+#include "image_manager/RetryPolicy.hpp"
+#include "image_manager/RegistryCache.hpp"
+#include "image_manager/RegistryMirrors.hpp"
 
 
 namespace sarus {
@@ -32,39 +43,124 @@ namespace image_manager {
 class Puller {
 public:
     Puller(std::shared_ptr<const common::Config> config);
+    Puller(std::shared_ptr<const common::Config> config, std::shared_ptr<HttpTransport> transport);
+    Puller(const Puller&) = delete;
+    Puller(Puller&&) = default; // only allowed while no pull is in progress
+    ~Puller();
     web::json::value getManifest();
     std::string getManifestPath();
     PulledImage pull();
+    PulledImage startPull();
 
 private:    
+    web::json::value getManifestFromEndpoint();
     web::json::value getManifest(const std::string &token);
     std::string getParam(std::string &header, const std::string& param);
-    std::string getUri(const std::string &server);
-    void saveImage(web::json::value fsLayers);
-    void saveLayer(const std::string &digest);
-    void downloadStream(const std::string &uri, const std::string &path, const boost::filesystem::path &filename);
+    PulledImage::LayerDownloads saveImage(web::json::value fsLayers);
+    void waitForDownloads(const PulledImage::LayerDownloads& downloads);
+    std::unordered_map<std::string, size_t> getLayerSizes();
+    size_t getMaxConcurrentDownloads() const;
+    void runDownloadWorker();
+    void joinDownloadWorkers();
+    void throwIfDownloadsCancelled() const;
+    void saveLayer(const std::string &digest, size_t sizeHint);
+    void downloadLayer(const std::string &digest, size_t sizeHint,
+                       const std::string &endpoint, PartialBlob &partialLayer);
+    std::string downloadStream(const std::string &uri, const std::string &path,
+                               size_t sizeHint, PartialBlob &blob);
+    std::string receiveBlob(web::http::http_response &response, PartialBlob &blob);
+    void appendResponseBody(web::http::http_response &response, PartialBlob &blob);
+    void downloadRanges(const std::string &uri, const std::string &path, size_t blobSize, PartialBlob &blob);
+    void downloadRange(const std::string &uri, const std::string &path, size_t first, size_t last, PartialBlob &blob);
+    web::http::http_response requestRange(const std::string &uri, const std::string &path,
+                                          size_t first, size_t last);
+    boost::optional<size_t> getBlobSizeFromContentRange(const web::http::http_response &response);
+    size_t getNumberOfDownloadRanges() const;
+    size_t getMultiRangeDownloadSizeThreshold() const;
+    std::string getAuthToken();
+    std::string refreshAuthToken(const std::string& rejectedToken);
     std::string requestAuthToken();
-    bool checkSum(const std::string &digest, const boost::filesystem::path &filename);
+    void selectEndpoint(const std::string& endpoint);
+    std::string getSelectedEndpoint();
+    bool fallBackToNextEndpoint(const std::string& failedEndpoint);
+    bool isAuthTokenCacheable() const;
+    std::string getAuthTokenCacheKey() const;
+    bool checkSum(const std::string &expectedDigest, const std::string &actualDigest);
     void printLog(const boost::format &message, common::logType logType);
-    std::unique_ptr<web::http::client::http_client> setupHttpClientWithCredential(const std::string& server);
+
+private:
+    struct LayerDownloadJob {
+        std::string digest;
+        size_t size;
+        std::shared_ptr<std::promise<void>> promise;
+    };
+
+    struct LayerDownloadQueue {
+        std::vector<LayerDownloadJob> jobs; // ordered by priority
+        size_t nextJob = 0;
+        std::atomic<bool> isCancelled{false};
+        std::mutex mutex;
+    };
+
+    struct AuthToken {
+        std::string value;
+        bool isInitialized = false;
+        std::mutex mutex;
+    };
 
 private:
     std::shared_ptr<const common::Config> config;
 
+    /** HTTP transport shared by all the requests to the registry */
+    std::shared_ptr<HttpTransport> transport;
+
+    /** disk cache of manifests and auth tokens */
+    RegistryCache registryCache;
+
+    /** mirrors of the registry (if any) and the registry itself */
+    RegistryMirrors registryMirrors;
+
+    /** endpoints (mirrors and registry) in order of preference */
+    std::vector<std::string> endpoints;
+
+    /**
+     * endpoint (registry or mirror) from which the image is pulled, e.g. "https://index.docker.io"
+     * (guarded by the mutex of the auth token, which is issued per endpoint)
+     */
+    std::string registryUri;
+
+    /** retry policy shared by all the download threads */
+    std::shared_ptr<RetryPolicy> retryPolicy;
+
     /** system name for logger */
     const std::string sysname = "Puller";
 
     /** digest when layer tarfile is empty */
     const std::string EMPTY_TAR_SHA256 = "sha256:a3ed95caeb02ffe68cdd9fd84406680ae93d633cb16422d00e8a7c22955b46d4";
 
-    /** max download retry */
-    const int RETRY_MAX = 3;
+    /** size of the buffer used to stream a layer's blob to file */
+    const size_t DOWNLOAD_BUFFER_SIZE = 1 << 20;
+
+    /** max number of layers downloaded at the same time (if not specified in the configuration) */
+    const size_t DEFAULT_MAX_CONCURRENT_DOWNLOADS = 3;
+
+    /** number of ranges in which a large blob is downloaded (if not specified in the configuration) */
+    const size_t DEFAULT_NUMBER_OF_DOWNLOAD_RANGES = 4;
+
+    /** min size of a blob to be downloaded in multiple ranges (if not specified in the configuration) */
+    const size_t DEFAULT_MULTI_RANGE_DOWNLOAD_SIZE_THRESHOLD = size_t{256} << 20;
+
+    /** layer downloads waiting for a worker thread */
+    std::unique_ptr<LayerDownloadQueue> downloadQueue{new LayerDownloadQueue{}};
+
+    /** worker threads that execute the layer downloads */
+    std::vector<std::thread> downloadWorkers;
 
     /** image manifest */
     web::json::value manifest;
 
-    /** authorization token */
-    std::string token;
+    /** authorization token (shared by all the download threads) */
+    std::unique_ptr<AuthToken> authToken{new AuthToken{}};
 
 };
 
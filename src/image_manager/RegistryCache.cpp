@@ -0,0 +1,165 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "RegistryCache.hpp"
+
+#include <ctime>
+#include <sys/stat.h>
+
+#include <rapidjson/document.h>
+
+#include "common/Error.hpp"
+#include "common/Utility.hpp"
+#include "image_manager/Sha256Hasher.hpp"
+
+
+namespace rj = rapidjson;
+
+namespace sarus {
+namespace image_manager {
+
+RegistryCache::RegistryCache(std::shared_ptr<const common::Config> config)
+    : config{config}
+    , manifestsDirectory{config->directories.cache / "manifests"}
+    , tokensDirectory{config->directories.cache / "tokens"}
+    , manifestTimeToLive{readTimeToLive("manifestCacheTTL", std::chrono::seconds{60})}
+    , tokenTimeToLive{readTimeToLive("tokenCacheTTL", std::chrono::seconds{300})}
+{}
+
+boost::optional<std::string> RegistryCache::getManifest(const std::string& endpoint,
+                                                        const std::string& imageReference) const {
+    if(manifestTimeToLive.count() <= 0) {
+        return boost::none;
+    }
+    return get(manifestsDirectory, getManifestKey(endpoint, imageReference));
+}
+
+void RegistryCache::putManifest(const std::string& endpoint, const std::string& imageReference,
+                                const std::string& manifest) const {
+    if(manifestTimeToLive.count() <= 0) {
+        return;
+    }
+    put(manifestsDirectory, getManifestKey(endpoint, imageReference), manifest, manifestTimeToLive);
+}
+
+/**
+ * The manifests are cached per endpoint, so that a pull that finds the manifest
+ * in the cache downloads the blobs from the same endpoint (mirror or registry)
+ * that served the manifest
+ */
+std::string RegistryCache::getManifestKey(const std::string& endpoint, const std::string& imageReference) const {
+    return endpoint + " " + imageReference;
+}
+
+boost::optional<std::string> RegistryCache::getToken(const std::string& key) const {
+    if(tokenTimeToLive.count() <= 0) {
+        return boost::none;
+    }
+    return get(tokensDirectory, key);
+}
+
+/**
+ * Cache the token for the time specified by the token server (minus a safety margin
+ * for the requests that are started right before the expiration), but at most for
+ * the time specified by the configuration
+ */
+void RegistryCache::putToken(const std::string& key, const std::string& token, std::chrono::seconds expiresIn) const {
+    auto timeToLive = std::min(tokenTimeToLive, expiresIn - std::chrono::seconds{10});
+    if(timeToLive.count() <= 0) {
+        return;
+    }
+    put(tokensDirectory, key, token, timeToLive);
+}
+
+boost::optional<std::string> RegistryCache::get(const boost::filesystem::path& directory, const std::string& key) const {
+    auto file = getEntryFile(directory, key);
+    if(!boost::filesystem::exists(file)) {
+        printLog(boost::format("cache miss: %s") % key, common::logType::DEBUG);
+        return boost::none;
+    }
+
+    try {
+        auto entry = common::readJSON(file);
+        if(!entry.IsObject()
+            || !entry.HasMember("key") || !entry["key"].IsString()
+            || !entry.HasMember("expiresAt") || !entry["expiresAt"].IsInt64()
+            || !entry.HasMember("value") || !entry["value"].IsString()) {
+            SARUS_THROW_ERROR("malformed cache entry");
+        }
+        if(entry["key"].GetString() != key) {
+            SARUS_THROW_ERROR("cache entry has a different key (hash collision?)");
+        }
+        if(entry["expiresAt"].GetInt64() <= static_cast<int64_t>(std::time(nullptr))) {
+            printLog(boost::format("cache entry expired: %s") % key, common::logType::DEBUG);
+            return boost::none;
+        }
+        printLog(boost::format("cache hit: %s") % key, common::logType::DEBUG);
+        return std::string{entry["value"].GetString()};
+    }
+    catch(common::Error& e) {
+        printLog(boost::format("ignoring cache entry %s: %s") % file % e.getErrorTrace().front().errorMessage,
+                 common::logType::DEBUG);
+        return boost::none;
+    }
+}
+
+void RegistryCache::put(const boost::filesystem::path& directory, const std::string& key,
+                        const std::string& value, std::chrono::seconds timeToLive) const {
+    auto file = getEntryFile(directory, key);
+    auto fileTemp = common::makeUniquePathWithRandomSuffix(file);
+
+    try {
+        common::createFoldersIfNecessary(directory);
+        boost::filesystem::permissions(directory, boost::filesystem::owner_all);
+
+        auto entry = rj::Document{rj::kObjectType};
+        auto& allocator = entry.GetAllocator();
+        entry.AddMember("key", rj::Value{key.c_str(), allocator}, allocator);
+        entry.AddMember("expiresAt", rj::Value{static_cast<int64_t>(std::time(nullptr) + timeToLive.count())}, allocator);
+        entry.AddMember("value", rj::Value{value.c_str(), allocator}, allocator);
+
+        common::writeJSON(entry, fileTemp);
+        boost::filesystem::permissions(fileTemp, boost::filesystem::owner_read | boost::filesystem::owner_write);
+        boost::filesystem::rename(fileTemp, file); // atomically create/replace entry
+    }
+    catch(std::exception& e) {
+        // the cache is just an optimization, i.e. failing to write it is not an error
+        boost::system::error_code ec;
+        boost::filesystem::remove(fileTemp, ec);
+        printLog(boost::format("failed to write cache entry %s: %s") % file % e.what(), common::logType::DEBUG);
+        return;
+    }
+
+    printLog(boost::format("cached %s (TTL %d sec)") % key % timeToLive.count(), common::logType::DEBUG);
+}
+
+boost::filesystem::path RegistryCache::getEntryFile(const boost::filesystem::path& directory, const std::string& key) const {
+    auto hasher = Sha256Hasher{};
+    hasher.update(key.c_str(), key.size());
+    return directory / (hasher.finalize() + ".json");
+}
+
+/**
+ * Read the time to live of the entries from the "pull" object of the configuration file
+ */
+std::chrono::seconds RegistryCache::readTimeToLive(const char* parameter, std::chrono::seconds defaultValue) const {
+    const auto& json = config->json.get();
+    if(json.HasMember("pull") && json["pull"].HasMember(parameter)) {
+        return std::chrono::seconds{json["pull"][parameter].GetUint()};
+    }
+    return defaultValue;
+}
+
+void RegistryCache::printLog(const boost::format& message, common::logType logType) const {
+    common::Logger::getInstance().log(message.str(), "RegistryCache", logType);
+}
+
+}
+}
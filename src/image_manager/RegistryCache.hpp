@@ -0,0 +1,70 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_RegistryCache_hpp
+#define sarus_image_manager_RegistryCache_hpp
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
+#include <boost/filesystem.hpp>
+
+#include "common/Config.hpp"
+#include "common/Logger.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class caches on disk the responses of the registries that can be
+ * reused by the next pulls for a limited amount of time, i.e. the manifests
+ * of the images (key = endpoint that served the manifest and image reference)
+ * and the auth tokens (key = realm, service and scope of the token).
+ *
+ * Each entry is a JSON file named after the SHA-256 of the key in the folders
+ * <cache>/manifests and <cache>/tokens, readable only by the owner. The entries
+ * are written atomically, hence they can be shared by the concurrent pulls of
+ * the nodes of a job.
+ */
+class RegistryCache {
+public:
+    RegistryCache(std::shared_ptr<const common::Config> config);
+
+    boost::optional<std::string> getManifest(const std::string& endpoint, const std::string& imageReference) const;
+    void putManifest(const std::string& endpoint, const std::string& imageReference,
+                     const std::string& manifest) const;
+    boost::optional<std::string> getToken(const std::string& key) const;
+    void putToken(const std::string& key, const std::string& token, std::chrono::seconds expiresIn) const;
+
+private:
+    boost::optional<std::string> get(const boost::filesystem::path& directory, const std::string& key) const;
+    void put(const boost::filesystem::path& directory, const std::string& key,
+             const std::string& value, std::chrono::seconds timeToLive) const;
+    std::string getManifestKey(const std::string& endpoint, const std::string& imageReference) const;
+    boost::filesystem::path getEntryFile(const boost::filesystem::path& directory, const std::string& key) const;
+    std::chrono::seconds readTimeToLive(const char* parameter, std::chrono::seconds defaultValue) const;
+    void printLog(const boost::format& message, common::logType logType) const;
+
+private:
+    std::shared_ptr<const common::Config> config;
+    boost::filesystem::path manifestsDirectory;
+    boost::filesystem::path tokensDirectory;
+    std::chrono::seconds manifestTimeToLive;
+    std::chrono::seconds tokenTimeToLive;
+};
+
+}
+}
+
+#endif
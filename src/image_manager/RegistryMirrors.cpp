@@ -0,0 +1,124 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "RegistryMirrors.hpp"
+
+#include <algorithm>
+#include <future>
+#include <utility>
+
+
+namespace sarus {
+namespace image_manager {
+
+RegistryMirrors::RegistryMirrors(std::shared_ptr<const common::Config> config, std::shared_ptr<HttpTransport> transport)
+    : config{std::move(config)}
+    , transport{std::move(transport)}
+{}
+
+/**
+ * Get the endpoints of the registry in order of preference (the registry itself is the last one)
+ */
+std::vector<std::string> RegistryMirrors::getEndpoints(const std::string& server) const {
+    auto endpoints = std::vector<std::string>{};
+
+    // the user's credentials (sarus pull --login) are only sent to the registry,
+    // i.e. the images of private repositories are never pulled from mirrors
+    const auto& json = config->json.get();
+    if(!config->authentication.isAuthenticationNeeded
+        && json.HasMember("pull")
+        && json["pull"].HasMember("registryMirrors")
+        && json["pull"]["registryMirrors"].HasMember(server.c_str())) {
+        const auto& registry = json["pull"]["registryMirrors"][server.c_str()];
+
+        for(const auto& mirror : registry["mirrors"].GetArray()) {
+            auto endpoint = std::string{mirror.GetString()};
+            while(!endpoint.empty() && endpoint.back() == '/') {
+                endpoint.pop_back();
+            }
+            endpoints.push_back(endpoint);
+        }
+
+        if(registry.HasMember("selection") && registry["selection"].GetString() == std::string{"latency"}) {
+            endpoints = sortByLatency(endpoints);
+        }
+    }
+
+    endpoints.push_back(getUpstreamEndpoint(server));
+
+    for(const auto& endpoint : endpoints) {
+        printLog(boost::format("endpoint of registry %s: %s") % server % endpoint, common::logType::DEBUG);
+    }
+
+    return endpoints;
+}
+
+std::string RegistryMirrors::getUpstreamEndpoint(const std::string& server) {
+    return "https://" + server;
+}
+
+/**
+ * Sort the mirrors by latency (the mirrors are probed concurrently).
+ * The mirrors that cannot be reached are removed.
+ */
+std::vector<std::string> RegistryMirrors::sortByLatency(const std::vector<std::string>& mirrors) const {
+    auto probes = std::vector<std::future<std::chrono::microseconds>>{};
+    for(const auto& mirror : mirrors) {
+        probes.push_back(std::async(std::launch::async, &RegistryMirrors::measureLatency, this, mirror));
+    }
+
+    auto latencies = std::vector<std::pair<std::chrono::microseconds, std::string>>{};
+    for(size_t i = 0; i < mirrors.size(); ++i) {
+        try {
+            auto latency = probes[i].get();
+            printLog(boost::format("latency of mirror %s: %.3f ms") % mirrors[i] % (latency.count() / 1000.0),
+                     common::logType::DEBUG);
+            latencies.emplace_back(latency, mirrors[i]);
+        }
+        catch(std::exception& e) {
+            printLog(boost::format("skipping unreachable mirror %s: %s") % mirrors[i] % e.what(),
+                     common::logType::DEBUG);
+        }
+    }
+
+    std::stable_sort(latencies.begin(), latencies.end(),
+        [](const std::pair<std::chrono::microseconds, std::string>& lhs,
+           const std::pair<std::chrono::microseconds, std::string>& rhs) {
+            return lhs.first < rhs.first;
+        });
+
+    auto sortedMirrors = std::vector<std::string>{};
+    for(const auto& latency : latencies) {
+        sortedMirrors.push_back(latency.second);
+    }
+    return sortedMirrors;
+}
+
+/**
+ * Measure the time to receive the response to a request to the API's base endpoint
+ * (any response, e.g. also 401 Unauthorized, means that the mirror is reachable)
+ */
+std::chrono::microseconds RegistryMirrors::measureLatency(const std::string& mirror) const {
+    web::http::http_request request(web::http::methods::GET);
+    request.set_request_uri("v2/");
+
+    auto start = std::chrono::steady_clock::now();
+    transport->request(mirror, request, false, LATENCY_PROBE_TIMEOUT);
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+}
+
+void RegistryMirrors::printLog(const boost::format& message, common::logType logType) const {
+    common::Logger::getInstance().log(message.str(), "RegistryMirrors", logType);
+}
+
+}
+}
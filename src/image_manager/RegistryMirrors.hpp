@@ -0,0 +1,62 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_RegistryMirrors_hpp
+#define sarus_image_manager_RegistryMirrors_hpp
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "common/Config.hpp"
+#include "common/Logger.hpp"
+#include "image_manager/HttpTransport.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class provides the endpoints (e.g. "https://index.docker.io") from which
+ * the images of a registry can be pulled: the mirrors (or pull-through caches)
+ * of the registry specified in the configuration file, in order of preference,
+ * followed by the registry itself.
+ *
+ * The mirrors are either used in the order specified in the configuration file
+ * ("ordered" selection) or sorted by the latency measured with a request to the
+ * registry API's base endpoint ("latency" selection). In the latter case, the
+ * mirrors that don't respond within a timeout are skipped.
+ */
+class RegistryMirrors {
+public:
+    RegistryMirrors(std::shared_ptr<const common::Config> config, std::shared_ptr<HttpTransport> transport);
+    std::vector<std::string> getEndpoints(const std::string& server) const;
+    static std::string getUpstreamEndpoint(const std::string& server);
+
+private:
+    std::vector<std::string> sortByLatency(const std::vector<std::string>& mirrors) const;
+    std::chrono::microseconds measureLatency(const std::string& mirror) const;
+    void printLog(const boost::format& message, common::logType logType) const;
+
+private:
+    std::shared_ptr<const common::Config> config;
+    std::shared_ptr<HttpTransport> transport;
+
+    /** max time to wait for the response of a mirror when measuring the latency */
+    const std::chrono::seconds LATENCY_PROBE_TIMEOUT{2};
+};
+
+}
+}
+
+#endif
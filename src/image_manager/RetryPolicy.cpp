@@ -0,0 +1,245 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "RetryPolicy.hpp"
+
+#include <ctime>
+#include <algorithm>
+
+#include <boost/regex.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+namespace sarus {
+namespace image_manager {
+
+RetryPolicy::RetryPolicy(const Parameters& parameters)
+    : parameters(parameters)
+    , randomGenerator{std::random_device{}()}
+{}
+
+/**
+ * Read the parameters from the "pull"/"retry" object of the configuration file
+ * (the parameters not specified in the configuration keep their default value)
+ */
+RetryPolicy::Parameters RetryPolicy::readParameters(const common::Config& config) {
+    auto parameters = Parameters{};
+
+    const auto& json = config.json.get();
+    if(!json.HasMember("pull") || !json["pull"].HasMember("retry")) {
+        return parameters;
+    }
+    const auto& retry = json["pull"]["retry"];
+
+    auto toMilliseconds = [](double seconds) {
+        return std::chrono::milliseconds{static_cast<std::chrono::milliseconds::rep>(seconds * 1000)};
+    };
+
+    if(retry.HasMember("maxAttempts")) {
+        parameters.maxAttempts = retry["maxAttempts"].GetUint();
+    }
+    if(retry.HasMember("initialBackoff")) {
+        parameters.initialBackoff = toMilliseconds(retry["initialBackoff"].GetDouble());
+    }
+    if(retry.HasMember("maxBackoff")) {
+        parameters.maxBackoff = toMilliseconds(retry["maxBackoff"].GetDouble());
+    }
+    if(retry.HasMember("circuitBreakerThreshold")) {
+        parameters.circuitBreakerThreshold = retry["circuitBreakerThreshold"].GetUint();
+    }
+    if(retry.HasMember("circuitBreakerCooldown")) {
+        parameters.circuitBreakerCooldown = toMilliseconds(retry["circuitBreakerCooldown"].GetDouble());
+    }
+
+    return parameters;
+}
+
+/**
+ * Get the delay before the next attempt: a random value between zero and
+ * initialBackoff * 2^(failedAttempts-1), capped at maxBackoff, but never
+ * shorter than the delay requested by the server (if any, also capped at
+ * maxBackoff so that a server cannot stall the pull for hours)
+ */
+std::chrono::milliseconds RetryPolicy::getBackoff(size_t failedAttempts,
+                                                  const boost::optional<std::chrono::milliseconds>& retryAfter) {
+    auto backoff = parameters.initialBackoff;
+    for(size_t i = 1; i < failedAttempts && backoff < parameters.maxBackoff; ++i) {
+        backoff *= 2;
+    }
+    backoff = std::min(backoff, parameters.maxBackoff);
+
+    auto jitteredBackoff = std::chrono::milliseconds{0};
+    if(backoff.count() > 0) {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto distribution = std::uniform_int_distribution<std::chrono::milliseconds::rep>{0, backoff.count()};
+        jitteredBackoff = std::chrono::milliseconds{distribution(randomGenerator)};
+    }
+
+    if(retryAfter) {
+        return std::max(jitteredBackoff, std::min(*retryAfter, parameters.maxBackoff));
+    }
+    return jitteredBackoff;
+}
+
+/**
+ * Sleep before retrying a request that failed the specified number of times
+ */
+void RetryPolicy::waitBeforeRetry(const std::string& server, size_t failedAttempts,
+                                  const boost::optional<std::chrono::milliseconds>& retryAfter) {
+    auto backoff = getBackoff(failedAttempts, retryAfter);
+    printLog(boost::format("Retrying request to %s in %d ms (failed attempts: %d)") % server % backoff.count() % failedAttempts,
+             common::logType::DEBUG);
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        ++statistics.numberOfRetries;
+    }
+    sleep(backoff);
+}
+
+/**
+ * Sleep while the circuit breaker of the server is open
+ */
+void RetryPolicy::waitUntilCircuitIsClosed(const std::string& server) {
+    auto openUntil = std::chrono::steady_clock::time_point{};
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto it = circuitBreakers.find(server);
+        if(it == circuitBreakers.cend()) {
+            return;
+        }
+        openUntil = it->second.openUntil;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if(openUntil > now) {
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(openUntil - now);
+        printLog(boost::format("Circuit breaker of %s is open. Waiting %d ms") % server % duration.count(),
+                 common::logType::DEBUG);
+        sleep(duration);
+    }
+}
+
+/**
+ * Interrupt the current waits and skip the next ones, e.g. when the downloads are cancelled
+ */
+void RetryPolicy::cancelWaits() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        areWaitsCancelled = true;
+    }
+    waitsCancelled.notify_all();
+}
+
+void RetryPolicy::resumeWaits() {
+    std::lock_guard<std::mutex> lock{mutex};
+    areWaitsCancelled = false;
+}
+
+void RetryPolicy::recordSuccess(const std::string& server) {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto it = circuitBreakers.find(server);
+    if(it != circuitBreakers.end()) {
+        it->second.consecutiveFailures = 0;
+    }
+}
+
+void RetryPolicy::recordFailure(const std::string& server, const std::string& reason,
+                                const boost::optional<std::chrono::milliseconds>& retryAfter) {
+    std::lock_guard<std::mutex> lock{mutex};
+    ++statistics.numberOfFailuresByReason[reason];
+
+    auto& circuitBreaker = circuitBreakers[server];
+    ++circuitBreaker.consecutiveFailures;
+
+    auto now = std::chrono::steady_clock::now();
+    auto openUntil = circuitBreaker.openUntil;
+    if(retryAfter) {
+        openUntil = std::max(openUntil, now + std::min(*retryAfter, parameters.maxBackoff));
+    }
+    if(parameters.circuitBreakerThreshold > 0
+        && circuitBreaker.consecutiveFailures >= parameters.circuitBreakerThreshold) {
+        openUntil = std::max(openUntil, now + parameters.circuitBreakerCooldown);
+        circuitBreaker.consecutiveFailures = 0; // half-open: the next failure doesn't re-trip immediately
+    }
+
+    if(openUntil > circuitBreaker.openUntil && openUntil > now) {
+        if(circuitBreaker.openUntil <= now) {
+            ++statistics.numberOfCircuitBreakerTrips;
+        }
+        circuitBreaker.openUntil = openUntil;
+        printLog(boost::format("Opened circuit breaker of %s for %d ms (last failure: %s)")
+                    % server % std::chrono::duration_cast<std::chrono::milliseconds>(openUntil - now).count() % reason,
+                 common::logType::DEBUG);
+    }
+}
+
+RetryPolicy::Statistics RetryPolicy::getStatistics() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return statistics;
+}
+
+void RetryPolicy::logStatistics() const {
+    auto statistics = getStatistics();
+    if(statistics.numberOfRetries == 0 && statistics.numberOfFailuresByReason.empty()) {
+        return;
+    }
+
+    auto failures = std::string{};
+    for(const auto& failure : statistics.numberOfFailuresByReason) {
+        failures += (boost::format(" %s=%d") % failure.first % failure.second).str();
+    }
+    printLog(boost::format("Retry statistics: retries=%d, circuit breaker trips=%d, wait time=%.3f [sec], failures:%s")
+                % statistics.numberOfRetries
+                % statistics.numberOfCircuitBreakerTrips
+                % (statistics.totalWaitTime.count() / 1000.0)
+                % failures,
+             common::logType::INFO);
+}
+
+/**
+ * Parse the value of the Retry-After header, which is either
+ * a number of seconds or an HTTP date (RFC 7231, section 7.1.3)
+ */
+boost::optional<std::chrono::milliseconds> RetryPolicy::parseRetryAfter(const std::string& headerValue) {
+    if(boost::regex_match(headerValue, boost::regex{"[0-9]+"})) {
+        try {
+            return std::chrono::milliseconds{boost::lexical_cast<long>(headerValue) * 1000};
+        }
+        catch(boost::bad_lexical_cast&) {
+            return boost::none;
+        }
+    }
+
+    auto time = std::tm{};
+    auto* end = strptime(headerValue.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &time);
+    if(end == nullptr || *end != '\0') {
+        return boost::none;
+    }
+    auto seconds = static_cast<long>(timegm(&time) - std::time(nullptr));
+    return std::chrono::milliseconds{std::max(seconds, 0L) * 1000};
+}
+
+void RetryPolicy::sleep(std::chrono::milliseconds duration) {
+    if(duration.count() <= 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock{mutex};
+    auto start = std::chrono::steady_clock::now();
+    waitsCancelled.wait_for(lock, duration, [this]() { return areWaitsCancelled; });
+    statistics.totalWaitTime += std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+}
+
+void RetryPolicy::printLog(const boost::format& message, common::logType logType) const {
+    common::Logger::getInstance().log(message.str(), "RetryPolicy", logType);
+}
+
+}
+}
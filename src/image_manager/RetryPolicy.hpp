@@ -0,0 +1,108 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_RetryPolicy_hpp
+#define sarus_image_manager_RetryPolicy_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
+
+#include "common/Config.hpp"
+#include "common/Logger.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class decides when a failed request to a registry (or to the storage
+ * service the registry redirects to) is retried. It is shared by all the
+ * download threads.
+ *
+ * - The delay before each retry grows exponentially with the number of failed
+ *   attempts and is randomized ("full jitter"), so that the threads (and the
+ *   many Sarus processes of a job) don't retry in lockstep.
+ * - The delay requested by the server through the Retry-After header (e.g.
+ *   with a 429 Too Many Requests response) is honoured.
+ * - Each server has a circuit breaker: after a number of consecutive failures,
+ *   or when the server sends Retry-After, all the threads stop sending requests
+ *   to that server for a cooldown period, instead of each of them consuming its
+ *   own retries against a server that is rejecting requests.
+ */
+class RetryPolicy {
+public:
+    struct Parameters {
+        Parameters() {} // needed by the default argument of RetryPolicy's constructor
+        size_t maxAttempts = 5;
+        std::chrono::milliseconds initialBackoff{500};
+        std::chrono::milliseconds maxBackoff{30000};
+        size_t circuitBreakerThreshold = 5;
+        std::chrono::milliseconds circuitBreakerCooldown{30000};
+    };
+
+    struct Statistics {
+        size_t numberOfRetries = 0;
+        size_t numberOfCircuitBreakerTrips = 0;
+        std::chrono::milliseconds totalWaitTime{0};
+        std::map<std::string, size_t> numberOfFailuresByReason;
+    };
+
+public:
+    RetryPolicy(const Parameters& parameters = Parameters{});
+    static Parameters readParameters(const common::Config& config);
+
+    size_t getMaxAttempts() const { return parameters.maxAttempts; }
+    std::chrono::milliseconds getBackoff(size_t failedAttempts,
+                                         const boost::optional<std::chrono::milliseconds>& retryAfter);
+    void waitBeforeRetry(const std::string& server, size_t failedAttempts,
+                         const boost::optional<std::chrono::milliseconds>& retryAfter);
+    void waitUntilCircuitIsClosed(const std::string& server);
+    void cancelWaits();
+    void resumeWaits();
+    void recordSuccess(const std::string& server);
+    void recordFailure(const std::string& server, const std::string& reason,
+                       const boost::optional<std::chrono::milliseconds>& retryAfter = boost::none);
+    Statistics getStatistics() const;
+    void logStatistics() const;
+
+    static boost::optional<std::chrono::milliseconds> parseRetryAfter(const std::string& headerValue);
+
+private:
+    struct CircuitBreaker {
+        size_t consecutiveFailures = 0;
+        std::chrono::steady_clock::time_point openUntil;
+    };
+
+private:
+    void sleep(std::chrono::milliseconds duration);
+    void printLog(const boost::format& message, common::logType logType) const;
+
+private:
+    Parameters parameters;
+    std::unordered_map<std::string, CircuitBreaker> circuitBreakers;
+    Statistics statistics;
+    std::mt19937 randomGenerator;
+    mutable std::mutex mutex;
+    std::condition_variable waitsCancelled;
+    bool areWaitsCancelled = false;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,855 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "RootfsWriter.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "common/Error.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+RootfsWriter::RootfsWriter( const boost::filesystem::path& rootDirectory,
+                            size_t numberOfWriterThreads,
+                            bool deduplicateFiles)
+    : rootDirectory{rootDirectory}
+    , rootFd{open(rootDirectory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)}
+    , deduplicator{deduplicateFiles ? new FileDeduplicator{} : nullptr}
+{
+    if(rootFd.get() < 0) {
+        auto message = boost::format("Failed to open directory %s: %s") % rootDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    for(size_t i = 0; i < numberOfWriterThreads; ++i) {
+        writers.emplace_back(&RootfsWriter::runWriter, this);
+    }
+}
+
+// The files not yet written are dropped (the writer is destroyed without calling
+// finish() only if the extraction failed)
+RootfsWriter::~RootfsWriter() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        queue.clear();
+        stop = true;
+    }
+    queueChangedOrStop.notify_all();
+    for(auto& writer : writers) {
+        writer.join();
+    }
+}
+
+/**
+ * Write the archive entry (and its data, read from the archive) into the root directory.
+ * The missing parent directories are created and the existing entries are replaced.
+ */
+void RootfsWriter::writeEntry(::archive* in, ::archive_entry* entry) {
+    auto pathInRoot = std::string{archive_entry_pathname(entry)};
+    std::string filename;
+    auto parent = openParentDirectory(pathInRoot, true, filename);
+
+    rethrowWriteError();
+
+    // the entry is the root directory itself (e.g. "./")
+    if(filename.empty()) {
+        if(archive_entry_filetype(entry) == AE_IFDIR) {
+            auto fixup = DirectoryFixup{};
+            fixup.mode = getPermissions(entry);
+            getTimes(entry, fixup.times);
+            directoryFixups.push_back(fixup);
+        }
+        return;
+    }
+
+    waitForPendingWrite(parent.get(), filename);
+    if(archive_entry_filetype(entry) != AE_IFDIR || archive_entry_hardlink(entry)) {
+        waitForPendingWritesInDirectory(parent.get(), filename);
+    }
+
+    if(archive_entry_hardlink(entry)) {
+        writeHardlink(parent.get(), filename, in, entry);
+        return;
+    }
+
+    switch(archive_entry_filetype(entry)) {
+    case AE_IFDIR: {
+        writeDirectory(parent.get(), filename, entry);
+        auto fixup = DirectoryFixup{};
+        fixup.path = pathInRoot;
+        fixup.mode = getPermissions(entry);
+        getTimes(entry, fixup.times);
+        directoryFixups.push_back(fixup);
+        break;
+    }
+    case AE_IFREG:
+        if(isWrittenAsynchronously(entry)) {
+            writeRegularFileAsynchronously(std::move(parent), filename, in, entry);
+        }
+        else {
+            writeRegularFile(parent.get(), filename, in, entry);
+        }
+        break;
+    case AE_IFLNK:
+        writeSymlink(parent.get(), filename, entry);
+        break;
+    case AE_IFCHR:
+    case AE_IFBLK:
+    case AE_IFIFO:
+        writeSpecialFile(parent.get(), filename, entry);
+        break;
+    case AE_IFSOCK:
+        log(boost::format("skipping socket %s") % pathInRoot, common::logType::DEBUG);
+        break;
+    default:
+        auto message = boost::format("Failed to write entry %s: unsupported file type") % pathInRoot;
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+/**
+ * Remove the specified path (recursively) from the root directory. The last
+ * component of the path is not followed if it is a symbolic link.
+ * Returns false if the path doesn't exist.
+ */
+bool RootfsWriter::remove(const boost::filesystem::path& pathInRoot) {
+    waitForPendingWrites();
+    std::string filename;
+    auto parent = openParentDirectory(pathInRoot, false, filename);
+    if(parent.get() < 0 || filename.empty()) {
+        return false;
+    }
+    return removeRecursively(parent.get(), filename);
+}
+
+/**
+ * Get the names of the entries of the specified directory, or none if the path is
+ * not a directory. The last component of the path is not followed if it is a symbolic link.
+ */
+boost::optional<std::vector<std::string>> RootfsWriter::listDirectory(const boost::filesystem::path& pathInRoot) const {
+    waitForPendingWrites();
+    auto directory = openDirectory(splitPath(pathInRoot.string()), false, false);
+    if(directory.get() < 0) {
+        return boost::none;
+    }
+    return readDirectory(directory.get());
+}
+
+/**
+ * Defer the setting of the permissions and the times of a directory that is not
+ * written by this writer (e.g. a directory restored from a layer snapshot)
+ */
+void RootfsWriter::addDirectoryFixup(const std::string& pathInRoot, mode_t mode, const struct timespec times[2]) {
+    auto fixup = DirectoryFixup{};
+    fixup.path = pathInRoot;
+    fixup.mode = mode;
+    fixup.times[0] = times[0];
+    fixup.times[1] = times[1];
+    directoryFixups.push_back(fixup);
+}
+
+/**
+ * Set the permissions and the times of the directories of a copy of the root directory
+ * (the directories of this root directory keep their temporary permissions)
+ */
+void RootfsWriter::applyDirectoryFixups(const boost::filesystem::path& otherRootDirectory) const {
+    RootfsWriter other{otherRootDirectory};
+    other.directoryFixups = directoryFixups;
+    other.finish();
+}
+
+/**
+ * Wait for the pending writes (the directories keep their temporary permissions)
+ */
+void RootfsWriter::flush() {
+    waitForPendingWrites();
+}
+
+/**
+ * Wait for the pending writes and deduplicate the files (if enabled), then restore the permissions
+ * and the times of the directories, which are modified while their contents are written (deepest
+ * directories first)
+ */
+void RootfsWriter::finish() {
+    waitForPendingWrites();
+
+    if(deduplicator) {
+        deduplicator->deduplicate(rootDirectory);
+    }
+
+    std::stable_sort(directoryFixups.begin(), directoryFixups.end(),
+        [](const DirectoryFixup& lhs, const DirectoryFixup& rhs) {
+            return lhs.path > rhs.path;
+        });
+
+    for(const auto& fixup : directoryFixups) {
+        auto directory = openDirectory(splitPath(fixup.path), false, false);
+        if(directory.get() < 0) {
+            continue; // removed by a later entry
+        }
+        if(fchmod(directory.get(), fixup.mode) != 0 || futimens(directory.get(), fixup.times) != 0) {
+            auto message = boost::format("Failed to set permissions and times of directory %s: %s")
+                % (rootDirectory / fixup.path) % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+    directoryFixups.clear();
+}
+
+RootfsWriter::FileDescriptor RootfsWriter::openParentDirectory( const boost::filesystem::path& pathInRoot,
+                                                                bool createMissingDirectories,
+                                                                std::string& filename) const {
+    auto components = splitPath(pathInRoot.string());
+    if(components.empty()) {
+        filename.clear();
+        return openDirectory(components, false, true);
+    }
+    filename = components.back();
+    components.pop_back();
+    if(filename == "..") {
+        auto message = boost::format("Invalid path %s: the last component cannot be \"..\"") % pathInRoot;
+        SARUS_THROW_ERROR(message.str());
+    }
+    return openDirectory(std::move(components), createMissingDirectories, true);
+}
+
+/**
+ * Open the directory at the specified path components, resolving the symbolic links found
+ * on disk within the root directory. Returns an invalid file descriptor if the directory
+ * doesn't exist and the missing directories are not created.
+ */
+RootfsWriter::FileDescriptor RootfsWriter::openDirectory(   std::deque<std::string> components,
+                                                            bool createMissingDirectories,
+                                                            bool followLastSymlink) const {
+    auto current = FileDescriptor{openat(rootFd.get(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if(current.get() < 0) {
+        auto message = boost::format("Failed to open directory %s: %s") % rootDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    auto ancestors = std::vector<FileDescriptor>{};
+    size_t numberOfSymlinks = 0;
+
+    while(!components.empty()) {
+        auto component = components.front();
+        components.pop_front();
+
+        // ".." never moves above the root directory
+        if(component == "..") {
+            if(!ancestors.empty()) {
+                current = std::move(ancestors.back());
+                ancestors.pop_back();
+            }
+            continue;
+        }
+
+        auto next = FileDescriptor{openat(current.get(), component.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)};
+        if(next.get() >= 0) {
+            ancestors.push_back(std::move(current));
+            current = std::move(next);
+            continue;
+        }
+
+        auto errorCode = errno;
+        struct stat st;
+        auto exists = fstatat(current.get(), component.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+
+        if(exists && S_ISLNK(st.st_mode) && (followLastSymlink || !components.empty())) {
+            if(++numberOfSymlinks > MAX_SYMLINKS) {
+                auto message = boost::format("Failed to resolve path in %s: too many levels of symbolic links")
+                    % rootDirectory;
+                SARUS_THROW_ERROR(message.str());
+            }
+            auto target = readSymlink(current.get(), component);
+            auto targetComponents = splitPath(target);
+            components.insert(components.begin(), targetComponents.begin(), targetComponents.end());
+            // absolute symbolic links are relative to the root directory
+            if(target.compare(0, 1, "/") == 0) {
+                current = FileDescriptor{openat(rootFd.get(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+                ancestors.clear();
+            }
+        }
+        else if(!createMissingDirectories) {
+            if(exists || errorCode == ENOENT) {
+                return FileDescriptor{};
+            }
+            auto message = boost::format("Failed to open directory %s in %s: %s")
+                % component % rootDirectory % strerror(errorCode);
+            SARUS_THROW_ERROR(message.str());
+        }
+        else {
+            // a pending write would replace the directory with a file
+            waitForPendingWrite(current.get(), component);
+
+            // replace the non-directory in the way with a directory
+            if(exists) {
+                removeRecursively(current.get(), component);
+            }
+            if(mkdirat(current.get(), component.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0
+               && errno != EEXIST) {
+                auto message = boost::format("Failed to create directory %s in %s: %s")
+                    % component % rootDirectory % strerror(errno);
+                SARUS_THROW_ERROR(message.str());
+            }
+            components.push_front(component);
+        }
+    }
+
+    return current;
+}
+
+// Split the path into its components (the empty and "." components are dropped)
+std::deque<std::string> RootfsWriter::splitPath(const std::string& path) const {
+    auto components = std::deque<std::string>{};
+    size_t begin = 0;
+    while(begin <= path.size()) {
+        auto end = path.find('/', begin);
+        if(end == std::string::npos) {
+            end = path.size();
+        }
+        auto component = path.substr(begin, end - begin);
+        if(!component.empty() && component != ".") {
+            components.push_back(component);
+        }
+        begin = end + 1;
+    }
+    return components;
+}
+
+std::string RootfsWriter::readSymlink(int parent, const std::string& filename) const {
+    auto buffer = std::vector<char>(PATH_MAX);
+    auto size = readlinkat(parent, filename.c_str(), buffer.data(), buffer.size());
+    if(size < 0 || static_cast<size_t>(size) >= buffer.size()) {
+        auto message = boost::format("Failed to read symbolic link %s in %s: %s")
+            % filename % rootDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    return std::string(buffer.data(), size);
+}
+
+std::vector<std::string> RootfsWriter::readDirectory(int directory) const {
+    auto fd = dup(directory);
+    auto* stream = fd >= 0 ? fdopendir(fd) : nullptr;
+    if(stream == nullptr) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        auto message = boost::format("Failed to read directory in %s: %s") % rootDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    rewinddir(stream);
+
+    auto names = std::vector<std::string>{};
+    while(auto* dirEntry = readdir(stream)) {
+        auto name = std::string{dirEntry->d_name};
+        if(name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    closedir(stream);
+    return names;
+}
+
+void RootfsWriter::writeDirectory(int parent, const std::string& filename, ::archive_entry* entry) {
+    struct stat st;
+    if(fstatat(parent, filename.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        if(S_ISDIR(st.st_mode)) {
+            return; // the permissions and times are restored by finish()
+        }
+        removeRecursively(parent, filename);
+    }
+    // the directory must be writable while its contents are written
+    if(mkdirat(parent, filename.c_str(), S_IRWXU) != 0) {
+        auto message = boost::format("Failed to create directory %s: %s")
+            % archive_entry_pathname(entry) % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+void RootfsWriter::writeRegularFile(int parent,
+                                    const std::string& filename,
+                                    ::archive* in,
+                                    ::archive_entry* entry) const {
+    removeRecursively(parent, filename);
+
+    auto file = createFile(parent, filename, archive_entry_pathname(entry));
+
+    auto hasher = Sha256Hasher{};
+    auto isHashed = writeData(file.get(), in, entry, deduplicator ? &hasher : nullptr);
+
+    struct timespec times[2];
+    getTimes(entry, times);
+    setPermissionsAndTimes(file.get(), getPermissions(entry), times, archive_entry_pathname(entry));
+
+    if(deduplicator) {
+        recordDigestOfFile(file.get(), isHashed ? hasher.finalize() : "", archive_entry_pathname(entry));
+    }
+}
+
+// Read the data of the file into memory and queue the file for the writer threads
+// (waits while too many files or bytes are already queued)
+void RootfsWriter::writeRegularFileAsynchronously(  FileDescriptor parent,
+                                                    const std::string& filename,
+                                                    ::archive* in,
+                                                    ::archive_entry* entry) {
+    auto file = BufferedFile{};
+    file.filename = filename;
+    file.pathInRoot = archive_entry_pathname(entry);
+    file.data = readData(in, entry);
+    file.mode = getPermissions(entry);
+    getTimes(entry, file.times);
+    file.key = getFileKey(parent.get(), filename);
+    file.parent = std::move(parent);
+
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        fileWritten.wait(lock, [this, &file]() {
+            return pendingFiles.empty()
+                || (pendingFiles.size() < MAX_PENDING_FILES
+                    && bufferedBytes + file.data.size() <= MAX_BUFFERED_BYTES);
+        });
+        pendingFiles.insert(file.key);
+        bufferedBytes += file.data.size();
+        queue.push_back(std::move(file));
+    }
+    queueChangedOrStop.notify_one();
+}
+
+void RootfsWriter::writeBufferedFile(const BufferedFile& file) const {
+    removeRecursively(file.parent.get(), file.filename);
+
+    auto fd = createFile(file.parent.get(), file.filename, file.pathInRoot);
+
+    auto data = file.data.data();
+    auto size = file.data.size();
+    while(size > 0) {
+        auto written = write(fd.get(), data, size);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            auto message = boost::format("Failed to write data of entry %s: %s") % file.pathInRoot % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        data += written;
+        size -= written;
+    }
+
+    setPermissionsAndTimes(fd.get(), file.mode, file.times, file.pathInRoot);
+
+    if(deduplicator) {
+        auto hasher = Sha256Hasher{};
+        hasher.update(file.data.data(), file.data.size());
+        recordDigestOfFile(fd.get(), hasher.finalize(), file.pathInRoot);
+    }
+}
+
+RootfsWriter::FileDescriptor RootfsWriter::createFile(  int parent,
+                                                        const std::string& filename,
+                                                        const std::string& pathInRoot) const {
+    auto file = FileDescriptor{openat(parent, filename.c_str(),
+                                      O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                                      S_IRUSR | S_IWUSR)};
+    if(file.get() < 0) {
+        auto message = boost::format("Failed to create file %s: %s") % pathInRoot % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    return file;
+}
+
+void RootfsWriter::setPermissionsAndTimes(  int fd,
+                                            mode_t mode,
+                                            const struct timespec times[2],
+                                            const std::string& pathInRoot) const {
+    if(fchmod(fd, mode) != 0 || futimens(fd, times) != 0) {
+        auto message = boost::format("Failed to set permissions and times of file %s: %s")
+            % pathInRoot % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+void RootfsWriter::writeSymlink(int parent, const std::string& filename, ::archive_entry* entry) const {
+    removeRecursively(parent, filename);
+
+    if(symlinkat(archive_entry_symlink(entry), parent, filename.c_str()) != 0) {
+        auto message = boost::format("Failed to create symbolic link %s: %s")
+            % archive_entry_pathname(entry) % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    struct timespec times[2];
+    getTimes(entry, times);
+    if(utimensat(parent, filename.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) {
+        auto message = boost::format("Failed to set times of symbolic link %s: %s")
+            % archive_entry_pathname(entry) % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+void RootfsWriter::writeHardlink(   int parent,
+                                    const std::string& filename,
+                                    ::archive* in,
+                                    ::archive_entry* entry) const {
+    std::string targetFilename;
+    auto targetParent = openParentDirectory(archive_entry_hardlink(entry), false, targetFilename);
+    if(targetParent.get() < 0 || targetFilename.empty()) {
+        auto message = boost::format("Failed to create hard link %s: target %s doesn't exist")
+            % archive_entry_pathname(entry) % archive_entry_hardlink(entry);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    waitForPendingWrite(targetParent.get(), targetFilename);
+    removeRecursively(parent, filename);
+
+    if(linkat(targetParent.get(), targetFilename.c_str(), parent, filename.c_str(), 0) != 0) {
+        auto message = boost::format("Failed to create hard link %s to %s: %s")
+            % archive_entry_pathname(entry) % archive_entry_hardlink(entry) % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    // some archive formats store the data with the hard link
+    if(archive_entry_size_is_set(entry) && archive_entry_size(entry) > 0) {
+        auto file = FileDescriptor{openat(parent, filename.c_str(), O_WRONLY | O_TRUNC | O_NOFOLLOW | O_CLOEXEC)};
+        if(file.get() < 0) {
+            auto message = boost::format("Failed to open hard link %s: %s")
+                % archive_entry_pathname(entry) % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        writeData(file.get(), in, entry);
+
+        // the content of the linked file changed: it is no longer deduplicated
+        if(deduplicator) {
+            recordDigestOfFile(file.get(), "", archive_entry_pathname(entry));
+        }
+    }
+}
+
+void RootfsWriter::writeSpecialFile(int parent, const std::string& filename, ::archive_entry* entry) const {
+    removeRecursively(parent, filename);
+
+    auto mode = archive_entry_filetype(entry) | getPermissions(entry);
+    struct timespec times[2];
+    getTimes(entry, times);
+    if(mknodat(parent, filename.c_str(), mode, archive_entry_rdev(entry)) != 0
+       || fchmodat(parent, filename.c_str(), getPermissions(entry), 0) != 0
+       || utimensat(parent, filename.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) {
+        auto message = boost::format("Failed to create special file %s: %s")
+            % archive_entry_pathname(entry) % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+// Write the data of the entry into the file and pass the data to the hasher (if any).
+// Returns false if the data has holes (sparse file), which are not hashed.
+bool RootfsWriter::writeData(int fd, ::archive* in, ::archive_entry* entry, Sha256Hasher* hasher) const {
+    const void* buffer;
+    size_t size;
+    la_int64_t offset;
+    la_int64_t endOfData = 0;
+    bool hasHoles = false;
+
+    while(true) {
+        auto r = archive_read_data_block(in, &buffer, &size, &offset);
+        if(r == ARCHIVE_EOF) {
+            break;
+        }
+        else if(r < ARCHIVE_WARN) {
+            auto message = boost::format("Failed to read data of entry %s: %s")
+                % archive_entry_pathname(entry) % archive_error_string(in);
+            SARUS_THROW_ERROR(message.str());
+        }
+        else if(r < ARCHIVE_OK) {
+            log(boost::format("Failed to read data of entry %s: %s")
+                % archive_entry_pathname(entry) % archive_error_string(in),
+                common::logType::INFO);
+            break;
+        }
+
+        hasHoles = hasHoles || offset != endOfData;
+        endOfData = offset + size;
+        if(hasher) {
+            hasher->update(buffer, size);
+        }
+
+        // the blocks of sparse files are written at their offset
+        auto data = static_cast<const char*>(buffer);
+        while(size > 0) {
+            auto written = pwrite(fd, data, size, offset);
+            if(written < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                auto message = boost::format("Failed to write data of entry %s: %s")
+                    % archive_entry_pathname(entry) % strerror(errno);
+                SARUS_THROW_ERROR(message.str());
+            }
+            data += written;
+            size -= written;
+            offset += written;
+        }
+    }
+
+    // extend the file to its full size (a sparse file might end with a hole)
+    if(archive_entry_size_is_set(entry) && ftruncate(fd, archive_entry_size(entry)) != 0) {
+        auto message = boost::format("Failed to set size of entry %s: %s")
+            % archive_entry_pathname(entry) % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    return !hasHoles && (!archive_entry_size_is_set(entry) || archive_entry_size(entry) == endOfData);
+}
+
+void RootfsWriter::recordDigestOfFile(int fd, const std::string& digest, const std::string& pathInRoot) const {
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        auto message = boost::format("Failed to stat file %s: %s") % pathInRoot % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    deduplicator->addFile(st, digest);
+}
+
+// Read the data of the entry into memory (the holes of a sparse file are zeros)
+std::vector<char> RootfsWriter::readData(::archive* in, ::archive_entry* entry) const {
+    auto data = std::vector<char>(archive_entry_size(entry));
+    const void* buffer;
+    size_t size;
+    la_int64_t offset;
+
+    while(true) {
+        auto r = archive_read_data_block(in, &buffer, &size, &offset);
+        if(r == ARCHIVE_EOF) {
+            break;
+        }
+        else if(r < ARCHIVE_WARN) {
+            auto message = boost::format("Failed to read data of entry %s: %s")
+                % archive_entry_pathname(entry) % archive_error_string(in);
+            SARUS_THROW_ERROR(message.str());
+        }
+        else if(r < ARCHIVE_OK) {
+            log(boost::format("Failed to read data of entry %s: %s")
+                % archive_entry_pathname(entry) % archive_error_string(in),
+                common::logType::INFO);
+            break;
+        }
+
+        if(static_cast<size_t>(offset) + size > data.size()) {
+            data.resize(static_cast<size_t>(offset) + size);
+        }
+        std::copy_n(static_cast<const char*>(buffer), size, data.begin() + offset);
+    }
+
+    return data;
+}
+
+bool RootfsWriter::isWrittenAsynchronously(::archive_entry* entry) const {
+    return !writers.empty()
+        && archive_entry_size_is_set(entry)
+        && static_cast<size_t>(archive_entry_size(entry)) <= MAX_ASYNCHRONOUS_FILE_SIZE;
+}
+
+RootfsWriter::FileKey RootfsWriter::getFileKey(int parent, const std::string& filename) const {
+    struct stat st;
+    if(fstat(parent, &st) != 0) {
+        auto message = boost::format("Failed to stat parent directory of %s in %s: %s")
+            % filename % rootDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    return FileKey{st.st_dev, st.st_ino, filename};
+}
+
+// Wait until the specified file is written, if it is pending
+void RootfsWriter::waitForPendingWrite(int parent, const std::string& filename) const {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if(pendingFiles.empty()) {
+            return;
+        }
+    }
+
+    auto key = getFileKey(parent, filename);
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        fileWritten.wait(lock, [this, &key]() {
+            return pendingFiles.count(key) == 0;
+        });
+    }
+    rethrowWriteError();
+}
+
+// Wait for all the pending writes if the specified file is a directory, which is
+// about to be replaced (the pending files might be inside the directory)
+void RootfsWriter::waitForPendingWritesInDirectory(int parent, const std::string& filename) const {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if(pendingFiles.empty()) {
+            return;
+        }
+    }
+
+    struct stat st;
+    if(fstatat(parent, filename.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) {
+        waitForPendingWrites();
+    }
+}
+
+void RootfsWriter::waitForPendingWrites() const {
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        fileWritten.wait(lock, [this]() {
+            return pendingFiles.empty();
+        });
+    }
+    rethrowWriteError();
+}
+
+// Rethrow the first error of the writer threads (if any)
+void RootfsWriter::rethrowWriteError() const {
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        std::swap(error, writeError);
+    }
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void RootfsWriter::runWriter() {
+    while(true) {
+        BufferedFile file;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            queueChangedOrStop.wait(lock, [this]() {
+                return stop || !queue.empty();
+            });
+            if(stop) {
+                return;
+            }
+            file = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        std::exception_ptr error;
+        try {
+            writeBufferedFile(file);
+        }
+        catch(...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if(error && !writeError) {
+                writeError = error;
+            }
+            pendingFiles.erase(file.key);
+            bufferedBytes -= file.data.size();
+        }
+        fileWritten.notify_all();
+    }
+}
+
+// Remove the entry of the parent directory (recursively, without following symbolic links)
+bool RootfsWriter::removeRecursively(int parent, const std::string& filename) const {
+    struct stat st;
+    if(fstatat(parent, filename.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        if(errno == ENOENT) {
+            return false;
+        }
+        auto message = boost::format("Failed to stat %s in %s: %s") % filename % rootDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    if(S_ISDIR(st.st_mode)) {
+        auto directory = FileDescriptor{openat(parent, filename.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)};
+        // the directory's contents can be removed only if the directory is writable
+        if(directory.get() < 0 || fchmod(directory.get(), st.st_mode | S_IRWXU) != 0) {
+            auto message = boost::format("Failed to open directory %s in %s: %s")
+                % filename % rootDirectory % strerror(errno);
+            SARUS_THROW_ERROR(message.str());
+        }
+        for(const auto& child : readDirectory(directory.get())) {
+            removeRecursively(directory.get(), child);
+        }
+    }
+
+    if(unlinkat(parent, filename.c_str(), S_ISDIR(st.st_mode) ? AT_REMOVEDIR : 0) != 0) {
+        auto message = boost::format("Failed to remove %s in %s: %s") % filename % rootDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    return true;
+}
+
+// Get the permissions of the entry. As with the extraction of libarchive, the
+// setuid and setgid bits are dropped if the owner of the entry is another user.
+mode_t RootfsWriter::getPermissions(::archive_entry* entry) const {
+    auto permissions = archive_entry_perm(entry) & 07777;
+    if(static_cast<uid_t>(archive_entry_uid(entry)) != geteuid()) {
+        permissions &= ~S_ISUID;
+    }
+    if(static_cast<gid_t>(archive_entry_gid(entry)) != getegid()) {
+        permissions &= ~S_ISGID;
+    }
+    return permissions;
+}
+
+void RootfsWriter::getTimes(::archive_entry* entry, struct timespec times[2]) const {
+    times[0].tv_sec = archive_entry_atime_is_set(entry) ? archive_entry_atime(entry) : 0;
+    times[0].tv_nsec = archive_entry_atime_is_set(entry) ? archive_entry_atime_nsec(entry) : UTIME_OMIT;
+    times[1].tv_sec = archive_entry_mtime_is_set(entry) ? archive_entry_mtime(entry) : 0;
+    times[1].tv_nsec = archive_entry_mtime_is_set(entry) ? archive_entry_mtime_nsec(entry) : UTIME_OMIT;
+}
+
+void RootfsWriter::log(const boost::format& message, common::logType level) const {
+    common::Logger::getInstance().log(message.str(), "RootfsWriter", level);
+}
+
+RootfsWriter::FileDescriptor::FileDescriptor(int fd)
+    : fd{fd}
+{}
+
+RootfsWriter::FileDescriptor::FileDescriptor(FileDescriptor&& rhs)
+    : fd{rhs.fd}
+{
+    rhs.fd = -1;
+}
+
+RootfsWriter::FileDescriptor& RootfsWriter::FileDescriptor::operator=(FileDescriptor&& rhs) {
+    if(this != &rhs) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        fd = rhs.fd;
+        rhs.fd = -1;
+    }
+    return *this;
+}
+
+RootfsWriter::FileDescriptor::~FileDescriptor() {
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+int RootfsWriter::FileDescriptor::get() const {
+    return fd;
+}
+
+}
+}
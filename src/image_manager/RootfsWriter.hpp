@@ -0,0 +1,185 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_RootfsWriter_hpp
+#define sarus_image_manager_RootfsWriter_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <sys/stat.h>
+#include <archive.h> // libarchive
+#include <archive_entry.h> // libarchive
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
+
+#include "common/Logger.hpp"
+#include "image_manager/FileDeduplicator.hpp"
+#include "image_manager/Sha256Hasher.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class writes archive entries into a root directory. All the file system
+ * operations are performed relative to a file descriptor of the root directory
+ * (openat, mkdirat, symlinkat, ...), hence the process' working directory is
+ * never changed and multiple instances can write concurrently from different threads.
+ *
+ * The paths are resolved as if the root directory was the root of the file system:
+ * the symbolic links found on disk are followed within the root directory and ".."
+ * never moves above the root directory, so that an entry never escapes from it.
+ *
+ * With writer threads, the small regular files are read from the archive into memory
+ * and created by a pool of threads, so that the latency of creating many small files
+ * (e.g. on a network filesystem) overlaps with the decoding of the archive. An entry
+ * that replaces or links to a file that is still being written waits for that write,
+ * and remove(), listDirectory() and finish() wait for all the pending writes.
+ *
+ * With file deduplication, the digests of the regular files are computed while the
+ * files are written and finish() replaces the identical files with hard links
+ * (see FileDeduplicator).
+ *
+ * The permissions and the times of the directories are set by finish(), so that the
+ * entries of the later layers can still be written into read-only directories. flush()
+ * only waits for the pending writes, e.g. to copy the root directory in the middle of
+ * the extraction.
+ */
+class RootfsWriter {
+public:
+    RootfsWriter(   const boost::filesystem::path& rootDirectory,
+                    size_t numberOfWriterThreads = 0,
+                    bool deduplicateFiles = false);
+    RootfsWriter(const RootfsWriter&) = delete;
+    RootfsWriter& operator=(const RootfsWriter&) = delete;
+    ~RootfsWriter();
+
+    void writeEntry(::archive* in, ::archive_entry* entry);
+    bool remove(const boost::filesystem::path& pathInRoot);
+    boost::optional<std::vector<std::string>> listDirectory(const boost::filesystem::path& pathInRoot) const;
+    void addDirectoryFixup(const std::string& pathInRoot, mode_t mode, const struct timespec times[2]);
+    void applyDirectoryFixups(const boost::filesystem::path& otherRootDirectory) const;
+    void flush();
+    void finish();
+
+private:
+    // RAII wrapper for a file descriptor
+    class FileDescriptor {
+    public:
+        FileDescriptor() = default;
+        explicit FileDescriptor(int fd);
+        FileDescriptor(const FileDescriptor&) = delete;
+        FileDescriptor(FileDescriptor&&);
+        FileDescriptor& operator=(const FileDescriptor&) = delete;
+        FileDescriptor& operator=(FileDescriptor&&);
+        ~FileDescriptor();
+        int get() const;
+
+    private:
+        int fd = -1;
+    };
+
+    struct DirectoryFixup {
+        std::string path;
+        mode_t mode;
+        struct timespec times[2];
+    };
+
+    // identifies a file by the device and the inode of its parent directory and by its name
+    using FileKey = std::tuple<dev_t, ino_t, std::string>;
+
+    // a regular file whose data was read into memory, to be written by a writer thread
+    struct BufferedFile {
+        FileKey key;
+        FileDescriptor parent;
+        std::string filename;
+        std::string pathInRoot;
+        std::vector<char> data;
+        mode_t mode;
+        struct timespec times[2];
+    };
+
+private:
+    FileDescriptor openParentDirectory( const boost::filesystem::path& pathInRoot,
+                                        bool createMissingDirectories,
+                                        std::string& filename) const;
+    FileDescriptor openDirectory(   std::deque<std::string> components,
+                                    bool createMissingDirectories,
+                                    bool followLastSymlink) const;
+    std::deque<std::string> splitPath(const std::string& path) const;
+    std::string readSymlink(int parent, const std::string& filename) const;
+    std::vector<std::string> readDirectory(int directory) const;
+    void writeDirectory(int parent, const std::string& filename, ::archive_entry* entry);
+    void writeRegularFile(int parent, const std::string& filename, ::archive* in, ::archive_entry* entry) const;
+    void writeRegularFileAsynchronously(FileDescriptor parent,
+                                        const std::string& filename,
+                                        ::archive* in,
+                                        ::archive_entry* entry);
+    void writeBufferedFile(const BufferedFile& file) const;
+    FileDescriptor createFile(int parent, const std::string& filename, const std::string& pathInRoot) const;
+    void setPermissionsAndTimes(int fd, mode_t mode, const struct timespec times[2], const std::string& pathInRoot) const;
+    void writeSymlink(int parent, const std::string& filename, ::archive_entry* entry) const;
+    void writeHardlink(int parent, const std::string& filename, ::archive* in, ::archive_entry* entry) const;
+    void writeSpecialFile(int parent, const std::string& filename, ::archive_entry* entry) const;
+    bool writeData(int fd, ::archive* in, ::archive_entry* entry, Sha256Hasher* hasher = nullptr) const;
+    void recordDigestOfFile(int fd, const std::string& digest, const std::string& pathInRoot) const;
+    std::vector<char> readData(::archive* in, ::archive_entry* entry) const;
+    bool isWrittenAsynchronously(::archive_entry* entry) const;
+    FileKey getFileKey(int parent, const std::string& filename) const;
+    void waitForPendingWrite(int parent, const std::string& filename) const;
+    void waitForPendingWritesInDirectory(int parent, const std::string& filename) const;
+    void waitForPendingWrites() const;
+    void rethrowWriteError() const;
+    void runWriter();
+    bool removeRecursively(int parent, const std::string& filename) const;
+    mode_t getPermissions(::archive_entry* entry) const;
+    void getTimes(::archive_entry* entry, struct timespec times[2]) const;
+    void log(const boost::format& message, common::logType level) const;
+
+private:
+    boost::filesystem::path rootDirectory;
+    FileDescriptor rootFd;
+    std::vector<DirectoryFixup> directoryFixups;
+    std::unique_ptr<FileDeduplicator> deduplicator;
+
+    // the state shared with the writer threads (the pending files are the files
+    // queued or being written, which the other operations might have to wait for)
+    std::vector<std::thread> writers;
+    mutable std::mutex mutex;
+    mutable std::condition_variable queueChangedOrStop;
+    mutable std::condition_variable fileWritten;
+    std::deque<BufferedFile> queue;
+    std::set<FileKey> pendingFiles;
+    size_t bufferedBytes = 0;
+    mutable std::exception_ptr writeError;
+    bool stop = false;
+
+    /** max number of symbolic links followed while resolving a path (same as the kernel) */
+    static const size_t MAX_SYMLINKS = 40;
+    /** max size of a file written by the writer threads (larger files are written directly) */
+    static const size_t MAX_ASYNCHRONOUS_FILE_SIZE = 1 << 20;
+    /** max number of files and of bytes waiting to be written by the writer threads */
+    static const size_t MAX_PENDING_FILES = 512;
+    static const size_t MAX_BUFFERED_BYTES = 64 << 20;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "ScratchDirectorySelector.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <sys/statvfs.h>
+
+#include "common/Error.hpp"
+#include "common/SarusImage.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+ScratchDirectorySelector::ScratchDirectorySelector(std::shared_ptr<const common::Config> config)
+    : config{std::move(config)}
+{}
+
+boost::filesystem::path ScratchDirectorySelector::select(const boost::optional<uintmax_t>& requiredSpace) const {
+    if(!requiredSpace) {
+        printLog(boost::format("space needed by the expansion is unknown: selected temporary directory %s")
+            % config->directories.temp, common::logType::DEBUG);
+        return config->directories.temp;
+    }
+
+    auto requiredSpaceString = common::SarusImage::createSizeString(*requiredSpace);
+    std::stringstream rejectedCandidates;
+
+    for(const auto& candidate : getCandidates()) {
+        auto availableSpace = getAvailableSpace(candidate.path);
+        if(candidate.maxSize && *candidate.maxSize < availableSpace) {
+            availableSpace = *candidate.maxSize;
+        }
+
+        if(*requiredSpace <= availableSpace) {
+            printLog(boost::format("selected scratch directory %s (needed %s, available %s)")
+                % candidate.path % requiredSpaceString % common::SarusImage::createSizeString(availableSpace),
+                common::logType::INFO);
+            return candidate.path;
+        }
+
+        rejectedCandidates << "\n  " << candidate.path.string()
+                           << " (available " << common::SarusImage::createSizeString(availableSpace) << ")";
+    }
+
+    auto message = boost::format("Failed to select a directory to expand the image: the expansion needs an"
+                                 " estimated %s, but none of the scratch directories has enough space:%s")
+        % requiredSpaceString % rejectedCandidates.str();
+    SARUS_THROW_ERROR(message.str());
+}
+
+std::vector<ScratchDirectorySelector::Candidate> ScratchDirectorySelector::getCandidates() const {
+    auto candidates = std::vector<Candidate>{};
+
+    const auto& json = config->json.get();
+    auto isTempDirSpecifiedThroughCLI = !config->directories.tempFromCLI.empty();
+    if(!isTempDirSpecifiedThroughCLI
+       && json.HasMember("expansion")
+       && json["expansion"].HasMember("scratchDirectories")) {
+        for(const auto& directory : json["expansion"]["scratchDirectories"].GetArray()) {
+            auto candidate = Candidate{};
+            candidate.path = directory["path"].GetString();
+            if(directory.HasMember("maxSize")) {
+                candidate.maxSize = uintmax_t{directory["maxSize"].GetUint64()} << 20;
+            }
+            candidates.push_back(candidate);
+        }
+    }
+
+    candidates.push_back(Candidate{config->directories.temp, boost::none});
+    return candidates;
+}
+
+// Get the space available to unprivileged users on the filesystem of the directory
+// (or of its nearest existing ancestor, if the directory doesn't exist yet)
+uintmax_t ScratchDirectorySelector::getAvailableSpace(const boost::filesystem::path& directory) const {
+    auto existingDirectory = boost::filesystem::absolute(directory);
+    while(!boost::filesystem::exists(existingDirectory) && existingDirectory.has_parent_path()) {
+        existingDirectory = existingDirectory.parent_path();
+    }
+
+    struct statvfs fs;
+    if(statvfs(existingDirectory.c_str(), &fs) != 0) {
+        printLog(boost::format("Failed to get available space of scratch directory %s: %s")
+            % directory % strerror(errno), common::logType::WARN);
+        return 0;
+    }
+    return uintmax_t{fs.f_bavail} * fs.f_frsize;
+}
+
+void ScratchDirectorySelector::printLog(const boost::format& message, common::logType logType) const {
+    common::Logger::getInstance().log(message.str(), "ScratchDirectorySelector", logType);
+}
+
+}
+}
@@ -0,0 +1,66 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_ScratchDirectorySelector_hpp
+#define sarus_image_manager_ScratchDirectorySelector_hpp
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
+
+#include "common/Config.hpp"
+#include "common/Logger.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class selects the directory where an image is expanded among a list of
+ * candidate scratch directories (e.g. /dev/shm, then a local SSD, then tempDir),
+ * so that the expansion runs on the fastest storage that can hold the image.
+ *
+ * A candidate is selected if the estimated space needed by the expansion is
+ * available on its filesystem and doesn't exceed the candidate's max size. If no
+ * candidate fits, the selection fails before any layer is downloaded or expanded.
+ * If the space needed is unknown, the temporary directory is selected.
+ *
+ * The candidates are the "expansion.scratchDirectories" of the configuration,
+ * followed by the temporary directory. A temporary directory specified through
+ * the CLI is the only candidate.
+ */
+class ScratchDirectorySelector {
+public:
+    ScratchDirectorySelector(std::shared_ptr<const common::Config> config);
+    boost::filesystem::path select(const boost::optional<uintmax_t>& requiredSpace) const;
+
+private:
+    struct Candidate {
+        boost::filesystem::path path;
+        boost::optional<uintmax_t> maxSize;
+    };
+
+private:
+    std::vector<Candidate> getCandidates() const;
+    uintmax_t getAvailableSpace(const boost::filesystem::path& directory) const;
+    void printLog(const boost::format& message, common::logType logType) const;
+
+private:
+    std::shared_ptr<const common::Config> config;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "Sha256Hasher.hpp"
+
+// the low-level SHA256 API is deprecated since OpenSSL 3.0, but it is the only one
+// whose context can be inspected and restored (EVP contexts are opaque)
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <boost/format.hpp>
+
+#include "common/Error.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+static SHA256_CTX& toContext(void* storage) {
+    return *static_cast<SHA256_CTX*>(storage);
+}
+
+static const SHA256_CTX& toContext(const void* storage) {
+    return *static_cast<const SHA256_CTX*>(storage);
+}
+
+Sha256Hasher::Sha256Hasher() {
+    static_assert(sizeof(SHA256_CTX) == CONTEXT_SIZE && alignof(SHA256_CTX) <= 8,
+                  "The storage of the context doesn't fit SHA256_CTX");
+    if(SHA256_Init(&toContext(&context)) != 1) {
+        SARUS_THROW_ERROR("Failed to initialize SHA256 context");
+    }
+}
+
+/**
+ * Restores a hasher from the state previously returned by getState(),
+ * e.g. in order to resume the computation of a digest in a later process.
+ * The state is validated against the number of bytes hashed so far, since
+ * a corrupted state would make the context inconsistent.
+ */
+Sha256Hasher::Sha256Hasher(const std::string& state, size_t numberOfHashedBytes) {
+    if(state.size() != 2*sizeof(context)) {
+        auto message = boost::format("Failed to restore SHA256 context: expected state of %d characters"
+                                     " but got %d characters") % (2*sizeof(context)) % state.size();
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    auto* bytes = reinterpret_cast<unsigned char*>(&context);
+    for(size_t i=0; i<sizeof(context); ++i) {
+        try {
+            bytes[i] = static_cast<unsigned char>(std::stoul(state.substr(2*i, 2), nullptr, 16));
+        }
+        catch(std::exception& e) {
+            SARUS_RETHROW_ERROR(e, "Failed to restore SHA256 context: state is not a valid hexadecimal string");
+        }
+    }
+
+    const auto& restoredContext = toContext(&context);
+    auto numberOfHashedBits = (static_cast<uint64_t>(restoredContext.Nh) << 32) | restoredContext.Nl;
+    if(restoredContext.md_len != SHA256_DIGEST_LENGTH
+        || restoredContext.num != numberOfHashedBytes % SHA256_CBLOCK
+        || numberOfHashedBits != static_cast<uint64_t>(numberOfHashedBytes) * 8) {
+        auto message = boost::format("Failed to restore SHA256 context: state is inconsistent with"
+                                     " the number of hashed bytes (%d)") % numberOfHashedBytes;
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+void Sha256Hasher::update(const void* data, size_t size) {
+    if(SHA256_Update(&toContext(&context), data, size) != 1) {
+        SARUS_THROW_ERROR("Failed to update SHA256 context");
+    }
+}
+
+/**
+ * Returns the hexadecimal representation of the digest. The hasher
+ * cannot be updated anymore after the digest is finalized.
+ */
+std::string Sha256Hasher::finalize() {
+    auto digest = std::array<unsigned char, SHA256_DIGEST_LENGTH>{};
+    if(SHA256_Final(digest.data(), &toContext(&context)) != 1) {
+        SARUS_THROW_ERROR("Failed to finalize SHA256 digest");
+    }
+
+    auto hexDigest = std::string{};
+    hexDigest.reserve(2*digest.size());
+    for(auto byte : digest) {
+        hexDigest += (boost::format("%02x") % static_cast<unsigned int>(byte)).str();
+    }
+    return hexDigest;
+}
+
+/**
+ * Returns the hexadecimal representation of the internal context, i.e. the
+ * state of a computation that is still in progress.
+ */
+std::string Sha256Hasher::getState() const {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(&context);
+    auto state = std::string{};
+    state.reserve(2*sizeof(context));
+    for(size_t i=0; i<sizeof(context); ++i) {
+        state += (boost::format("%02x") % static_cast<unsigned int>(bytes[i])).str();
+    }
+    return state;
+}
+
+}
+}
@@ -0,0 +1,46 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_Sha256Hasher_hpp
+#define sarus_image_manager_Sha256Hasher_hpp
+
+#include <string>
+#include <cstddef>
+#include <type_traits>
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class incrementally computes the SHA-256 digest of a stream of bytes,
+ * e.g. the digest of a layer's blob while the blob is being downloaded.
+ */
+class Sha256Hasher {
+public:
+    Sha256Hasher();
+    Sha256Hasher(const std::string& state, size_t numberOfHashedBytes);
+    void update(const void* data, size_t size);
+    std::string finalize();
+    std::string getState() const;
+
+private:
+    /**
+     * storage of OpenSSL's SHA256_CTX, which is kept out of the header because
+     * its API is deprecated (the size is checked against SHA256_CTX at compile time)
+     */
+    static const size_t CONTEXT_SIZE = 112;
+    std::aligned_storage<CONTEXT_SIZE, 8>::type context;
+};
+
+}
+}
+
+#endif
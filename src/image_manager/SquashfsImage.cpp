@@ -11,11 +11,18 @@
 #include "SquashfsImage.hpp"
 
 #include <chrono>
+#include <fstream>
+#include <sstream>
+#include <csignal>
+#include <cstring>
+#include <sys/wait.h>
 #include <boost/format.hpp>
 
+#include "common/Error.hpp"
 #include "common/Utility.hpp"
 #include "common/Logger.hpp"
 #include "common/PathRAII.hpp"
+#include "image_manager/SquashfsOptions.hpp"
 
 
 namespace sarus {
@@ -35,9 +42,13 @@ SquashfsImage::SquashfsImage(   const common::Config& config,
 
     auto start = std::chrono::system_clock::now();
 
-    
+
     boost::filesystem::path mksquashfsPath(config.json.get()["mksquashfsPath"].GetString());
     auto mksquashfsCommand = mksquashfsPath.string() + " " + expandedImage.string() + " " + pathTemp.getPath().string();
+    auto options = SquashfsOptions{config}.getCommandLine();
+    if(!options.empty()) {
+        mksquashfsCommand += " " + options;
+    }
     common::executeCommand(mksquashfsCommand);
     boost::filesystem::rename(pathTemp.getPath(), pathOfImage); // atomically create/replace squashfs file
     pathTemp.release();
@@ -49,6 +60,76 @@ SquashfsImage::SquashfsImage(   const common::Config& config,
     log(boost::format("successfully created squashfs file"), common::logType::INFO);
 }
 
+SquashfsImage::SquashfsImage(   const common::Config& config,
+                                const TarStreamWriter& writeTarStream,
+                                const boost::filesystem::path& pathOfImage)
+    : pathOfImage{pathOfImage}
+{
+    auto pathTemp = common::PathRAII{common::makeUniquePathWithRandomSuffix(pathOfImage)};
+    common::createFoldersIfNecessary(pathTemp.getPath().parent_path());
+    auto logFile = common::PathRAII{common::makeUniquePathWithRandomSuffix(config.directories.temp / "mksquashfs.log")};
+
+    log(boost::format("> make squashfs image: %s") % pathOfImage, common::logType::GENERAL);
+    log(boost::format("creating squashfs image %s from tar stream") % pathOfImage, common::logType::INFO);
+
+    auto start = std::chrono::system_clock::now();
+
+    boost::filesystem::path mksquashfsPath(config.json.get()["mksquashfsPath"].GetString());
+    auto mksquashfsCommand = boost::format("%s - %s -tar %s > %s 2>&1") % mksquashfsPath.string() % pathTemp.getPath().string()
+        % SquashfsOptions{config}.getCommandLine() % logFile.getPath().string();
+    runMksquashfsWithTarStream(mksquashfsCommand.str(), writeTarStream, logFile.getPath());
+    boost::filesystem::rename(pathTemp.getPath(), pathOfImage); // atomically create/replace squashfs file
+    pathTemp.release();
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / double(1000);
+    log(boost::format("Elapsed time mksquashfs: %s [s]") % elapsedTime, common::logType::INFO);
+
+    log(boost::format("successfully created squashfs file"), common::logType::INFO);
+}
+
+/**
+ * Run mksquashfs and write the tar stream to its standard input
+ */
+void SquashfsImage::runMksquashfsWithTarStream( const std::string& command,
+                                                const TarStreamWriter& writeTarStream,
+                                                const boost::filesystem::path& logFile) const {
+    log(boost::format("running %s") % command, common::logType::DEBUG);
+
+    // if mksquashfs exits prematurely, the write to the pipe has to fail
+    // (and the error has to be reported) instead of killing this process.
+    // SIGPIPE stays ignored for the rest of the command: the disposition is
+    // process-wide, hence restoring it would race with the other threads.
+    struct sigaction ignoreSignal{};
+    ignoreSignal.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignoreSignal, nullptr);
+
+    FILE* pipe = popen(command.c_str(), "w");
+    if(!pipe) {
+        auto message = boost::format("Failed to execute command \"%s\". Call to popen() failed (%s)")
+            % command % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    try {
+        writeTarStream(pipe);
+    }
+    catch(std::exception& e) {
+        pclose(pipe);
+        SARUS_RETHROW_ERROR(e, "Failed to write tar stream to mksquashfs");
+    }
+
+    auto status = pclose(pipe);
+
+    if(status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::stringstream output;
+        output << std::ifstream{logFile.string()}.rdbuf();
+        auto message = boost::format("Failed to execute command \"%s\" (status %s). Output:\n%s")
+            % command % status % output.str();
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
 boost::filesystem::path SquashfsImage::getPathOfImage() const {
     return pathOfImage;
 }
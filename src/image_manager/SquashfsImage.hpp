@@ -11,6 +11,9 @@
 #ifndef sarus_image_manger_SquashfsImage_hpp
 #define sarus_image_manger_SquashfsImage_hpp
 
+#include <cstdio>
+#include <functional>
+#include <string>
 #include <boost/filesystem.hpp>
 
 #include "common/Config.hpp"
@@ -21,15 +24,27 @@ namespace image_manager {
 
 /**
  * This class builds and represents the squashfs image.
+ *
+ * The image is built either from an expanded image (a directory) or from a tar
+ * stream, which mksquashfs reads from its standard input (tar mode, available
+ * since squashfs-tools 4.6).
  */
 class SquashfsImage {
 public:
+    using TarStreamWriter = std::function<void(FILE*)>;
+
     SquashfsImage(  const common::Config& config,
                     const boost::filesystem::path& expandedImage,
                     const boost::filesystem::path& pathOfImage);
+    SquashfsImage(  const common::Config& config,
+                    const TarStreamWriter& writeTarStream,
+                    const boost::filesystem::path& pathOfImage);
     boost::filesystem::path getPathOfImage() const;
 
 private:
+    void runMksquashfsWithTarStream(const std::string& command,
+                                    const TarStreamWriter& writeTarStream,
+                                    const boost::filesystem::path& logFile) const;
     void log(const boost::format &message, common::logType level) const;
 
 private:
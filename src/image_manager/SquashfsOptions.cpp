@@ -0,0 +1,142 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "SquashfsOptions.hpp"
+
+#include <boost/format.hpp>
+#include <boost/algorithm/string/join.hpp>
+
+#include "common/Error.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+SquashfsOptions::SquashfsOptions(const common::Config& config)
+    : config{config}
+    , compressor{readString(config.squashfs.compressor, "compressor")}
+    , compressionLevel{readSize(config.squashfs.compressionLevel, "compressionLevel")}
+    , blockSize{readSize(config.squashfs.blockSize, "blockSize")}
+    , processors{readSize(config.squashfs.processors, "processors")}
+    , memory{readSize(config.squashfs.memory, "memory")}
+{}
+
+/**
+ * Check the settings of the configuration, e.g. in order to fail before the
+ * image is downloaded rather than when the squashfs image is built
+ */
+void SquashfsOptions::validate(const common::Config& config) {
+    SquashfsOptions{config}.checkSettings();
+}
+
+std::vector<std::string> SquashfsOptions::getArguments() const {
+    checkSettings();
+
+    auto arguments = std::vector<std::string>{};
+    if(compressor) {
+        arguments.push_back("-comp");
+        arguments.push_back(*compressor);
+    }
+    if(compressionLevel) {
+        arguments.push_back("-Xcompression-level");
+        arguments.push_back(std::to_string(*compressionLevel));
+    }
+    if(blockSize) {
+        arguments.push_back("-b");
+        arguments.push_back(std::to_string(*blockSize * 1024));
+    }
+    if(processors) {
+        arguments.push_back("-processors");
+        arguments.push_back(std::to_string(*processors));
+    }
+    if(memory) {
+        arguments.push_back("-mem");
+        arguments.push_back(std::to_string(*memory) + "M");
+    }
+    return arguments;
+}
+
+std::string SquashfsOptions::getCommandLine() const {
+    return boost::algorithm::join(getArguments(), " ");
+}
+
+boost::optional<std::string> SquashfsOptions::readString(const std::string& cliValue, const char* member) const {
+    if(!cliValue.empty()) {
+        return cliValue;
+    }
+    const auto& json = config.json.get();
+    if(json.HasMember("squashfs") && json["squashfs"].HasMember(member)) {
+        return std::string{json["squashfs"][member].GetString()};
+    }
+    return boost::none;
+}
+
+boost::optional<size_t> SquashfsOptions::readSize(size_t cliValue, const char* member) const {
+    if(cliValue > 0) {
+        return cliValue;
+    }
+    const auto& json = config.json.get();
+    if(json.HasMember("squashfs") && json["squashfs"].HasMember(member)) {
+        return size_t{json["squashfs"][member].GetUint()};
+    }
+    return boost::none;
+}
+
+// The settings from the CLI are not validated by the JSON schema
+void SquashfsOptions::checkSettings() const {
+    if(compressor
+       && *compressor != "gzip" && *compressor != "lz4" && *compressor != "zstd" && *compressor != "xz") {
+        auto message = boost::format("Invalid squashfs compressor \"%s\" (expected gzip, lz4, zstd or xz)")
+            % *compressor;
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    if(compressionLevel) {
+        // mksquashfs' default compressor is gzip
+        auto actualCompressor = compressor ? *compressor : std::string{"gzip"};
+        auto maxLevel = size_t{0};
+        if(actualCompressor == "gzip") {
+            maxLevel = 9;
+        }
+        else if(actualCompressor == "zstd") {
+            maxLevel = 22;
+        }
+        else {
+            auto message = boost::format("Invalid squashfs compression level: the compressor %s has no compression level")
+                % actualCompressor;
+            SARUS_THROW_ERROR(message.str());
+        }
+        if(*compressionLevel < 1 || *compressionLevel > maxLevel) {
+            auto message = boost::format("Invalid squashfs compression level %d (expected 1-%d for compressor %s)")
+                % *compressionLevel % maxLevel % actualCompressor;
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+
+    if(blockSize) {
+        bool isPowerOfTwo = (*blockSize & (*blockSize - 1)) == 0;
+        if(*blockSize < 4 || *blockSize > 1024 || !isPowerOfTwo) {
+            auto message = boost::format("Invalid squashfs block size %dK (expected a power of two between 4K and 1024K)")
+                % *blockSize;
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+
+    if(processors && *processors == 0) {
+        SARUS_THROW_ERROR("Invalid number of squashfs processors (expected at least 1)");
+    }
+
+    if(memory && *memory == 0) {
+        SARUS_THROW_ERROR("Invalid squashfs memory (expected at least 1 MB)");
+    }
+}
+
+}
+}
@@ -0,0 +1,58 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_SquashfsOptions_hpp
+#define sarus_image_manager_SquashfsOptions_hpp
+
+#include <string>
+#include <vector>
+#include <boost/optional.hpp>
+
+#include "common/Config.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class represents the build profile of the squashfs images (compressor,
+ * compression level, block size, number of processors and memory of mksquashfs).
+ *
+ * Each setting is read from the CLI options of the command (if specified) or from
+ * the "squashfs" object of the configuration file. The settings that are not
+ * specified are not passed to mksquashfs, i.e. the defaults of mksquashfs apply.
+ * The settings are checked when the arguments of mksquashfs are generated, or
+ * in advance through validate().
+ */
+class SquashfsOptions {
+public:
+    SquashfsOptions(const common::Config& config);
+    static void validate(const common::Config& config);
+    std::vector<std::string> getArguments() const;
+    std::string getCommandLine() const;
+
+private:
+    boost::optional<std::string> readString(const std::string& cliValue, const char* member) const;
+    boost::optional<size_t> readSize(size_t cliValue, const char* member) const;
+    void checkSettings() const;
+
+private:
+    const common::Config& config;
+    boost::optional<std::string> compressor;
+    boost::optional<size_t> compressionLevel;
+    boost::optional<size_t> blockSize; // KB
+    boost::optional<size_t> processors;
+    boost::optional<size_t> memory; // MB
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include "TrashDirectory.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "common/Error.hpp"
+#include "common/Utility.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+TrashDirectory::TrashDirectory(std::shared_ptr<const common::Config> config)
+    : config{std::move(config)}
+    , trashDirectory{this->config->directories.repository / "trash"}
+{}
+
+bool TrashDirectory::isEnabled() const {
+    const auto& json = config->json.get();
+    if(json.HasMember("expansion") && json["expansion"].HasMember("asynchronousCleanup")) {
+        return json["expansion"]["asynchronousCleanup"].GetBool();
+    }
+    return true;
+}
+
+bool TrashDirectory::isEmpty() const {
+    boost::system::error_code ec;
+    for(auto it = boost::filesystem::directory_iterator{trashDirectory, ec};
+        !ec && it != boost::filesystem::directory_iterator{};
+        it.increment(ec)) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Discard the path of the RAII object: the path is moved to the trash directory
+ * (or removed right away, if the asynchronous cleanup is disabled)
+ */
+void TrashDirectory::discard(common::PathRAII& path) const {
+    if(!path.hasPath()) {
+        return;
+    }
+
+    if(!isEnabled()) {
+        auto removedPath = std::move(path);
+        return;
+    }
+
+    try {
+        moveToTrash(path.getPath());
+        path.release();
+    }
+    catch(common::Error& e) {
+        printLog(boost::format("%s: removing it synchronously") % e.getErrorTrace().front().errorMessage,
+                 common::logType::WARN);
+        auto removedPath = std::move(path);
+    }
+}
+
+/**
+ * Remove the content of the trash directory in a background process, which is detached
+ * from the current process (the current process doesn't wait for its completion).
+ *
+ * The current process might have other threads (e.g. the download workers), hence the
+ * forked child only performs async-signal-safe calls before executing rm (the arguments
+ * are prepared before forking) and closes the inherited file descriptors (e.g. the
+ * descriptors locking the partial blobs of the cache).
+ */
+void TrashDirectory::emptyInBackground() const {
+    auto pathsToRemove = getPathsToRemove();
+    if(pathsToRemove.empty()) {
+        return;
+    }
+
+    printLog(boost::format("emptying trash directory %s in background") % trashDirectory, common::logType::DEBUG);
+
+    auto arguments = std::vector<std::string>{"rm", "-rf", "--"};
+    for(const auto& path : pathsToRemove) {
+        arguments.push_back(path.string());
+    }
+    auto argv = std::vector<char*>{};
+    for(auto& argument : arguments) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+    auto maxFd = sysconf(_SC_OPEN_MAX);
+
+    auto pid = fork();
+    if(pid == -1) {
+        printLog(boost::format("Failed to fork to empty trash directory %s: %s") % trashDirectory % strerror(errno),
+                 common::logType::WARN);
+        return;
+    }
+
+    bool isChild = pid == 0;
+    if(isChild) {
+        // fork again, so that the background process is not a child of the current process,
+        // and detach it from the terminal and from the streams of the current process
+        setsid();
+        if(fork() != 0) {
+            _exit(0);
+        }
+        auto devNull = open("/dev/null", O_RDWR);
+        if(devNull >= 0) {
+            dup2(devNull, STDIN_FILENO);
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+        }
+        for(long fd = STDERR_FILENO + 1; fd < maxFd; ++fd) {
+            close(fd);
+        }
+        setpriority(PRIO_PROCESS, 0, 10);
+        execv("/bin/rm", argv.data());
+        _exit(1);
+    }
+
+    waitpid(pid, nullptr, 0);
+}
+
+// Rename the path into the trash directory, or create a marker file with the path
+// if the path is on another filesystem. The marker file also records the host, because
+// the path might be node-local (e.g. under /dev/shm) while the repository is shared.
+void TrashDirectory::moveToTrash(const boost::filesystem::path& path) const {
+    common::createFoldersIfNecessary(trashDirectory);
+
+    auto entry = common::makeUniquePathWithRandomSuffix(trashDirectory / path.filename());
+    if(rename(path.c_str(), entry.c_str()) == 0) {
+        printLog(boost::format("moved %s to trash directory") % path, common::logType::DEBUG);
+        return;
+    }
+    if(errno != EXDEV) {
+        auto message = boost::format("Failed to move %s to trash directory %s: %s")
+            % path % trashDirectory % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+
+    // the marker file is renamed into place once complete, so that an incomplete
+    // marker file is never read (it is just removed)
+    auto temporaryMarker = boost::filesystem::path{entry.string() + ".tmp"};
+    auto marker = boost::filesystem::path{entry.string() + ".path"};
+    {
+        std::ofstream stream{temporaryMarker.string()};
+        stream << common::getHostname() << "\n" << path.string();
+        if(!stream) {
+            auto message = boost::format("Failed to write marker file %s") % temporaryMarker;
+            SARUS_THROW_ERROR(message.str());
+        }
+    }
+    if(rename(temporaryMarker.c_str(), marker.c_str()) != 0) {
+        auto message = boost::format("Failed to create marker file %s: %s") % marker % strerror(errno);
+        SARUS_THROW_ERROR(message.str());
+    }
+    printLog(boost::format("marked %s for removal in trash directory") % path, common::logType::DEBUG);
+}
+
+// The entries of the trash directory and the paths of the marker files. The marker files
+// being written (*.tmp) are skipped, as well as the marker files created on other hosts
+// (together with their paths), which are left for those hosts to remove. Concurrent
+// removals of the same paths are harmless.
+std::vector<boost::filesystem::path> TrashDirectory::getPathsToRemove() const {
+    auto paths = std::vector<boost::filesystem::path>{};
+    auto hostname = common::getHostname();
+    boost::system::error_code ec;
+    for(auto it = boost::filesystem::directory_iterator{trashDirectory, ec};
+        !ec && it != boost::filesystem::directory_iterator{};
+        it.increment(ec)) {
+        const auto& entry = it->path();
+        if(entry.extension() == ".tmp") {
+            continue;
+        }
+        if(entry.extension() == ".path" && boost::filesystem::is_regular_file(entry)) {
+            auto content = common::readFile(entry);
+            auto newline = content.find('\n');
+            if(newline != std::string::npos) { // no newline if already removed by another process
+                if(content.substr(0, newline) != hostname) {
+                    continue;
+                }
+                paths.push_back(content.substr(newline + 1));
+            }
+        }
+        paths.push_back(entry);
+    }
+    return paths;
+}
+
+void TrashDirectory::printLog(const boost::format& message, common::logType logType) const {
+    common::Logger::getInstance().log(message.str(), "TrashDirectory", logType);
+}
+
+}
+}
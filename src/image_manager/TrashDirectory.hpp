@@ -0,0 +1,62 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef sarus_image_manager_TrashDirectory_hpp
+#define sarus_image_manager_TrashDirectory_hpp
+
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include "common/Config.hpp"
+#include "common/Logger.hpp"
+#include "common/PathRAII.hpp"
+
+
+namespace sarus {
+namespace image_manager {
+
+/**
+ * This class defers the removal of large directory trees (e.g. the expanded root
+ * filesystem of an image), so that the removal doesn't delay the completion of a command.
+ *
+ * A discarded tree is renamed into the trash directory of the repository. If the tree
+ * is on another filesystem, a marker file with the host and the path of the tree is
+ * created in the trash directory instead (only the host that created a marker file
+ * removes its tree, because the tree might be on a node-local filesystem). The trash directory is emptied by a detached rm process, hence
+ * the trees left behind by an interrupted removal are removed the next time the trash
+ * directory is emptied.
+ *
+ * If the asynchronous cleanup is disabled, the discarded trees are removed right away.
+ */
+class TrashDirectory {
+public:
+    TrashDirectory(std::shared_ptr<const common::Config> config);
+    bool isEnabled() const;
+    bool isEmpty() const;
+    void discard(common::PathRAII& path) const;
+    void emptyInBackground() const;
+
+private:
+    void moveToTrash(const boost::filesystem::path& path) const;
+    std::vector<boost::filesystem::path> getPathsToRemove() const;
+    void printLog(const boost::format& message, common::logType logType) const;
+
+private:
+    std::shared_ptr<const common::Config> config;
+    boost::filesystem::path trashDirectory;
+};
+
+}
+}
+
+#endif
@@ -43,12 +43,15 @@ TEST(ImageStoreTestGroup, test_ImageStore) {
     boost::filesystem::remove_all(config->directories.repository);
     common::createFoldersIfNecessary(config->directories.repository);
     CHECK(imageStore.listImages().empty());
+    CHECK(!imageStore.findImage(config->imageID));
 
     // add image
     imageStore.addImage(image);
     CHECK(boost::filesystem::exists(imageStore.getMetadataFile()));
     auto expectedImages = std::vector<common::SarusImage>{ image };
     CHECK(imageStore.listImages() == expectedImages);
+    CHECK(imageStore.findImage(config->imageID) == image);
+    CHECK(!imageStore.findImage(common::ImageID{"index.docker.io", "library", "hello-world", "other-tag"}));
 
     // add same image another time
     imageStore.addImage(image);
@@ -58,6 +61,7 @@ TEST(ImageStoreTestGroup, test_ImageStore) {
     // remove image
     imageStore.removeImage(config->imageID);
     CHECK(imageStore.listImages().empty());
+    CHECK(!imageStore.findImage(config->imageID));
 
     // cleanup
     boost::filesystem::remove_all(config->directories.repository);
@@ -9,8 +9,13 @@
  */
 
 #include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <rapidjson/document.h>
 
+#include "common/Utility.hpp"
 #include "image_manager/LoadedImage.hpp"
+#include "test_utility/archive.hpp"
 #include "test_utility/config.hpp"
 #include "test_utility/unittest_main_function.hpp"
 
@@ -18,9 +23,102 @@ namespace sarus {
 namespace image_manager {
 namespace test {
 
+/**
+ * Image made of synthetic layers (the layers are expanded as they are)
+ */
+class SyntheticImage : public InputImage {
+public:
+    SyntheticImage(std::shared_ptr<const common::Config> config)
+        : InputImage{std::move(config)}
+    {}
+    std::tuple<common::PathRAII, common::ImageMetadata, std::string> expand() const override {
+        SARUS_THROW_ERROR("not implemented");
+    }
+    std::tuple<common::ImageMetadata, std::string> expandToSquashfs(const boost::filesystem::path&) const override {
+        SARUS_THROW_ERROR("not implemented");
+    }
+    using InputImage::expandLayers;
+};
+
+static void createLayerWithInaccessibleEntries(const boost::filesystem::path& layerArchive) {
+    test_utility::archive::ArchiveWriter layer{layerArchive};
+    layer.addDirectory("dir/", 0);
+    layer.addFile("dir/file", "", 0);
+    layer.addSymlink("dir/link", "file");
+    layer.close();
+}
+
+// Create a layer whose entries are listed without their parent directories,
+// followed by an opaque whiteout of the top parent directory
+static void createLayerWithImplicitParentsAndOpaqueWhiteout(const boost::filesystem::path& layerArchive) {
+    test_utility::archive::ArchiveWriter layer{layerArchive};
+    layer.addFile("dir/subdir/file");
+    layer.addFile("dir/.wh..wh..opq");
+    layer.close();
+}
+
+static void createLayerWithFileInDirectory(const boost::filesystem::path& layerArchive) {
+    test_utility::archive::ArchiveWriter layer{layerArchive};
+    layer.addDirectory("dir/");
+    layer.addFile("dir/file-of-parent-layer");
+    layer.close();
+}
+
 TEST_GROUP(InputImageTestGroup) {
 };
 
+TEST(InputImageTestGroup, image_with_whiteouts_top_down_merge) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    test_utility::config::setExpansionMember(*config, "mergeStrategy", rapidjson::Value{"topDown"});
+
+    auto archive = boost::filesystem::path{__FILE__}.parent_path() / "saved_image_with_whiteouts.tar";
+    auto loadedImage = LoadedImage(config, archive);
+    common::PathRAII expandedImage;
+    std::tie(expandedImage, std::ignore, std::ignore) = loadedImage.expand();
+
+    CHECK(boost::filesystem::is_empty(expandedImage.getPath() / "dir-with-whiteout"));
+    CHECK(boost::filesystem::is_regular_file(expandedImage.getPath() / "dir-with-artificial-whiteout/file"));
+    CHECK(boost::filesystem::is_empty(expandedImage.getPath() / "dir-with-artificial-opaque-whiteout"));
+    CHECK(boost::filesystem::is_regular_file(expandedImage.getPath() / "dir-removed-and-recreated-as-file-on-same-layer"));
+    CHECK(boost::filesystem::is_directory(expandedImage.getPath() / "file-removed-and-recreated-as-dir-on-same-layer"));
+    CHECK(!boost::filesystem::exists(expandedImage.getPath() / "file-in-root-folder"));
+}
+
+TEST(InputImageTestGroup, layer_with_inaccessible_entries) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    auto repository = common::PathRAII{config->directories.repository};
+    auto layerArchive = config->directories.temp / "layer.tar";
+    auto expansionDir = config->directories.temp / "expansion";
+    common::createFoldersIfNecessary(expansionDir);
+    createLayerWithInaccessibleEntries(layerArchive);
+
+    // the same layer twice: the second extraction must be able to overwrite the first one
+    SyntheticImage{config}.expandLayers({layerArchive, layerArchive}, expansionDir);
+
+    struct stat st;
+    CHECK(stat((expansionDir / "dir").c_str(), &st) == 0);
+    CHECK((st.st_mode & S_IRWXU) == S_IRWXU);
+    CHECK(stat((expansionDir / "dir/file").c_str(), &st) == 0);
+    CHECK((st.st_mode & (S_IRUSR | S_IWUSR)) == (S_IRUSR | S_IWUSR));
+    CHECK(boost::filesystem::is_symlink(expansionDir / "dir/link"));
+}
+
+TEST(InputImageTestGroup, opaque_whiteout_keeps_implicit_parents_of_same_layer) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    auto repository = common::PathRAII{config->directories.repository};
+    auto parentLayer = config->directories.temp / "parent-layer.tar";
+    auto layer = config->directories.temp / "layer.tar";
+    auto expansionDir = config->directories.temp / "expansion";
+    common::createFoldersIfNecessary(expansionDir);
+    createLayerWithFileInDirectory(parentLayer);
+    createLayerWithImplicitParentsAndOpaqueWhiteout(layer);
+
+    SyntheticImage{config}.expandLayers({parentLayer, layer}, expansionDir);
+
+    CHECK(!boost::filesystem::exists(expansionDir / "dir/file-of-parent-layer"));
+    CHECK(boost::filesystem::is_regular_file(expansionDir / "dir/subdir/file"));
+}
+
 TEST(InputImageTestGroup, image_with_nonexecutable_directory) {
     auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
     auto archive = boost::filesystem::path{__FILE__}.parent_path() / "saved_image_with_non-executable_dir.tar";
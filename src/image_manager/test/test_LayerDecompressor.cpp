@@ -0,0 +1,128 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <archive.h>
+#include <boost/filesystem.hpp>
+
+#include "common/Error.hpp"
+#include "common/PathRAII.hpp"
+#include "common/Utility.hpp"
+#include "image_manager/ArchiveFilters.hpp"
+#include "image_manager/LayerDecompressor.hpp"
+#include "test_utility/archive.hpp"
+#include "test_utility/config.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+static void createLayer(const boost::filesystem::path& layerArchive, int filterCode) {
+    test_utility::archive::ArchiveWriter layer{layerArchive, filterCode};
+    layer.addFile("file", "content of the file");
+    layer.close();
+}
+
+static bool isCompressed(const boost::filesystem::path& archivePath) {
+    auto* arc = archive_read_new();
+    supportDecompressionFilters(arc);
+    archive_read_support_format_all(arc);
+    archive_read_open_filename(arc, archivePath.c_str(), 10240);
+    ::archive_entry* entry;
+    archive_read_next_header(arc, &entry);
+    auto isCompressed = archive_filter_code(arc, 0) != ARCHIVE_FILTER_NONE;
+    archive_read_free(arc);
+    return isCompressed;
+}
+
+TEST_GROUP(LayerDecompressorTestGroup) {
+};
+
+TEST(LayerDecompressorTestGroup, decompress_layers) {
+    auto config = test_utility::config::makeConfig();
+    auto repository = common::PathRAII{config.directories.repository};
+    auto testDir = config.directories.temp;
+    common::createFoldersIfNecessary(testDir);
+    auto layers = std::vector<boost::filesystem::path>{
+        testDir / "compressed-layer0.tar",
+        testDir / "uncompressed-layer.tar"
+    };
+    createLayer(layers[0], ARCHIVE_FILTER_GZIP);
+    createLayer(layers[1], ARCHIVE_FILTER_NONE);
+
+    // zstd is supported since libarchive 3.3.3 (and only if libarchive was built with it)
+#if ARCHIVE_VERSION_NUMBER >= 3003003
+    if(test_utility::archive::isFilterSupported(ARCHIVE_FILTER_ZSTD)) {
+        layers.push_back(testDir / "zstd-compressed-layer1.tar");
+        createLayer(layers.back(), ARCHIVE_FILTER_ZSTD);
+    }
+#endif
+
+    auto waitedLayers = std::vector<boost::filesystem::path>{};
+    auto stagingDir = testDir / "staging";
+    LayerDecompressor decompressor{layers, stagingDir, 1, 1, [&](const boost::filesystem::path& layer, std::chrono::milliseconds) {
+        waitedLayers.push_back(layer);
+        return true;
+    }};
+
+    for(size_t layer = 0; layer < layers.size(); ++layer) {
+        auto decompressedLayer = decompressor.getDecompressedLayer(layer);
+        CHECK(!isCompressed(decompressedLayer));
+        if(layer == 1) {
+            CHECK(decompressedLayer == layers[1]); // not staged
+        }
+        else {
+            CHECK(decompressedLayer.parent_path() == stagingDir);
+        }
+        decompressor.releaseDecompressedLayer(layer);
+        CHECK(boost::filesystem::exists(layers[layer]));
+        CHECK(layer == 1 || !boost::filesystem::exists(decompressedLayer));
+    }
+
+    // the layers were decompressed in order (the max number of staged layers is one)
+    CHECK(waitedLayers == layers);
+}
+
+TEST(LayerDecompressorTestGroup, missing_layer) {
+    auto config = test_utility::config::makeConfig();
+    auto repository = common::PathRAII{config.directories.repository};
+    auto testDir = config.directories.temp;
+    auto layers = std::vector<boost::filesystem::path>{ testDir / "missing-layer.tar" };
+    LayerDecompressor decompressor{layers, testDir / "staging", 2, 2,
+                                   [](const boost::filesystem::path&, std::chrono::milliseconds) { return true; }};
+    CHECK_THROWS(common::Error, decompressor.getDecompressedLayer(0));
+}
+
+TEST(LayerDecompressorTestGroup, destruction_interrupts_wait_for_layer) {
+    auto config = test_utility::config::makeConfig();
+    auto repository = common::PathRAII{config.directories.repository};
+    auto testDir = config.directories.temp;
+    auto layers = std::vector<boost::filesystem::path>{ testDir / "layer-never-downloaded.tar" };
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        // e.g. the extraction failed while the layer is still being downloaded
+        LayerDecompressor decompressor{layers, testDir / "staging", 1, 1,
+                                       [](const boost::filesystem::path&, std::chrono::milliseconds timeout) {
+                                           std::this_thread::sleep_for(timeout);
+                                           return false;
+                                       }};
+        std::this_thread::sleep_for(std::chrono::milliseconds{200});
+    }
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds{5});
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
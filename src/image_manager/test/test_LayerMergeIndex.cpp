@@ -0,0 +1,91 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <string>
+
+#include "image_manager/LayerMergeIndex.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+TEST_GROUP(LayerMergeIndexTestGroup) {
+};
+
+TEST(LayerMergeIndexTestGroup, upper_layers_replace_lower_layers) {
+    auto index = LayerMergeIndex{};
+    index.addEntry(0, "usr", true);
+    index.addEntry(0, "usr/lib", true);
+    index.addEntry(0, "usr/lib/libfoo.so", false);
+    index.addEntry(0, "dir-replaced-by-file", true);
+    index.addEntry(0, "dir-replaced-by-file/file", false);
+    index.addEntry(1, "usr/lib/libfoo.so", false);
+    index.addEntry(1, "dir-replaced-by-file", false);
+    index.finalize();
+
+    CHECK(index.isOwnedBy("usr", 0));
+    CHECK(index.isOwnedBy("usr/lib", 0));
+    CHECK(index.isOwnedBy("usr/lib/libfoo.so", 1));
+    CHECK(!index.isOwnedBy("usr/lib/libfoo.so", 0));
+    CHECK(index.isOwnedBy("dir-replaced-by-file", 1));
+    CHECK(!index.isOwnedBy("dir-replaced-by-file/file", 0));
+    CHECK_EQUAL(index.getNumberOfEntries(), 4);
+}
+
+TEST(LayerMergeIndexTestGroup, whiteouts) {
+    auto index = LayerMergeIndex{};
+    index.addEntry(0, "file", false);
+    index.addEntry(0, "dir", true);
+    index.addEntry(0, "dir/file", false);
+    index.addEntry(0, "opaque-dir", true);
+    index.addEntry(0, "opaque-dir/file0", false);
+    index.addEntry(0, "opaque-dir/subdir", true);
+    index.addEntry(0, "opaque-dir/subdir/file", false);
+
+    // the whiteouts don't apply to the entries of the same layer
+    index.addEntry(1, "opaque-dir/subdir", true);
+    index.addEntry(1, "opaque-dir/file1", false);
+    index.addWhiteout(1, "opaque-dir/.wh..wh..opq");
+    index.addWhiteout(1, ".wh.dir");
+    index.addEntry(1, "dir", true);
+    index.addWhiteout(1, ".wh.file");
+    index.finalize();
+
+    CHECK(!index.isOwnedBy("file", 0));
+    CHECK(index.isOwnedBy("dir", 1));
+    CHECK(!index.isOwnedBy("dir/file", 0));
+    CHECK(index.isOwnedBy("opaque-dir", 0));
+    CHECK(!index.isOwnedBy("opaque-dir/file0", 0));
+    CHECK(index.isOwnedBy("opaque-dir/file1", 1));
+    CHECK(index.isOwnedBy("opaque-dir/subdir", 1));
+    CHECK(!index.isOwnedBy("opaque-dir/subdir/file", 0));
+    CHECK_EQUAL(index.getNumberOfEntries(), 4);
+}
+
+TEST(LayerMergeIndexTestGroup, hardlinks) {
+    auto index = LayerMergeIndex{};
+    index.addEntry(0, "bin/target", false);
+    index.addHardlink(0, "bin/link0", "bin/target");
+    index.addHardlink(0, "bin/link1", "bin/target");
+    index.addEntry(0, "bin/untouched-target", false);
+    index.addHardlink(0, "bin/untouched-link", "bin/untouched-target");
+    index.addWhiteout(1, "bin/.wh.target");
+    index.finalize();
+
+    // the data of the whited out target is extracted to the first link
+    CHECK(!index.isOwnedBy("bin/target", 0));
+    CHECK(index.getRedirectedHardlinkTarget(0, "bin/target") == std::string{"bin/link0"});
+    CHECK(!index.getRedirectedHardlinkTarget(0, "bin/untouched-target"));
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
@@ -0,0 +1,124 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "common/Config.hpp"
+#include "common/PathRAII.hpp"
+#include "common/Utility.hpp"
+#include "test_utility/config.hpp"
+#include "image_manager/LayerSnapshotCache.hpp"
+#include "image_manager/RootfsWriter.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+static void createExpandedLayers(const boost::filesystem::path& expandDir, size_t sizeOfFile) {
+    common::createFoldersIfNecessary(expandDir / "dir");
+    std::ofstream{(expandDir / "dir/file").string()} << std::string(sizeOfFile, 'x');
+    boost::filesystem::create_symlink("dir/file", expandDir / "link");
+}
+
+TEST_GROUP(LayerSnapshotCacheTestGroup) {
+};
+
+TEST(LayerSnapshotCacheTestGroup, chain_ids) {
+    auto chainIDs = LayerSnapshotCache::computeChainIDs({"sha256:base", "sha256:app"});
+    CHECK_EQUAL(chainIDs.size(), 2);
+    CHECK(chainIDs[0] == "sha256:base");
+    CHECK(chainIDs[1].compare(0, 7, "sha256:") == 0);
+
+    // the chain ID depends on the parent layers
+    auto otherChainIDs = LayerSnapshotCache::computeChainIDs({"sha256:other-base", "sha256:app"});
+    CHECK(chainIDs[1] != otherChainIDs[1]);
+}
+
+TEST(LayerSnapshotCacheTestGroup, disabled_by_default) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    auto repository = common::PathRAII{config->directories.repository};
+    auto cache = LayerSnapshotCache{config};
+    CHECK(!cache.isEnabled());
+}
+
+TEST(LayerSnapshotCacheTestGroup, store_restore_and_evict) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    test_utility::config::setExpansionMember(*config, "layerSnapshotCacheQuota", rapidjson::Value{uint64_t{1}});
+    auto repository = common::PathRAII{config->directories.repository};
+    auto cache = LayerSnapshotCache{config};
+    auto chainIDs = LayerSnapshotCache::computeChainIDs({"sha256:layer0", "sha256:layer1", "sha256:layer2"});
+
+    auto expandDir = config->directories.temp / "expansion";
+    createExpandedLayers(expandDir, 600*1024);
+    RootfsWriter rootfs{expandDir};
+    cache.store(chainIDs[1], expandDir, rootfs);
+
+    // the longest chain in the cache is restored
+    auto restoreDir = config->directories.temp / "restore";
+    common::createFoldersIfNecessary(restoreDir);
+    RootfsWriter restoredRootfs{restoreDir};
+    CHECK_EQUAL(cache.restoreLongestChain(chainIDs, restoreDir, restoredRootfs), 2);
+    CHECK_EQUAL(boost::filesystem::file_size(restoreDir / "dir/file"), 600*1024);
+    CHECK(boost::filesystem::read_symlink(restoreDir / "link") == "dir/file");
+
+    // the second snapshot exceeds the quota: the least recently used snapshot is evicted
+    auto otherChainIDs = LayerSnapshotCache::computeChainIDs({"sha256:other-layer0", "sha256:other-layer1"});
+    cache.store(otherChainIDs[0], expandDir, rootfs);
+
+    auto otherRestoreDir = config->directories.temp / "other-restore";
+    common::createFoldersIfNecessary(otherRestoreDir);
+    RootfsWriter otherRestoredRootfs{otherRestoreDir};
+    CHECK_EQUAL(cache.restoreLongestChain(chainIDs, otherRestoreDir, otherRestoredRootfs), 0);
+    CHECK(boost::filesystem::is_empty(otherRestoreDir));
+    CHECK_EQUAL(cache.restoreLongestChain(otherChainIDs, otherRestoreDir, otherRestoredRootfs), 1);
+}
+
+TEST(LayerSnapshotCacheTestGroup, restored_snapshot_is_independent_of_the_cache) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    test_utility::config::setExpansionMember(*config, "layerSnapshotCacheQuota", rapidjson::Value{uint64_t{1}});
+    auto repository = common::PathRAII{config->directories.repository};
+    auto cache = LayerSnapshotCache{config};
+    auto chainIDs = LayerSnapshotCache::computeChainIDs({"sha256:layer0", "sha256:layer1"});
+
+    // the permissions of the directories are set when the extraction is finished
+    auto expandDir = config->directories.temp / "expansion";
+    createExpandedLayers(expandDir, 1024);
+    RootfsWriter rootfs{expandDir};
+    struct timespec times[2] = {{0, 0}, {0, 0}};
+    rootfs.addDirectoryFixup("dir", 0555, times);
+    cache.store(chainIDs[0], expandDir, rootfs);
+
+    auto restoreDir = config->directories.temp / "restore";
+    common::createFoldersIfNecessary(restoreDir);
+    RootfsWriter restoredRootfs{restoreDir};
+    CHECK_EQUAL(cache.restoreLongestChain(chainIDs, restoreDir, restoredRootfs), 1);
+
+    // the restored files are not hard links to the files of the snapshot
+    CHECK_EQUAL(boost::filesystem::hard_link_count(restoreDir / "dir/file"), 1);
+
+    // the restored directories are writable until the extraction is finished
+    CHECK((boost::filesystem::status(restoreDir / "dir").permissions() & 0777) == 0700);
+    restoredRootfs.finish();
+    CHECK((boost::filesystem::status(restoreDir / "dir").permissions() & 0777) == 0555);
+
+    // make the read-only directories removable
+    boost::filesystem::permissions(restoreDir / "dir", boost::filesystem::owner_all);
+    boost::filesystem::permissions(config->directories.repository / "layer-snapshots" / chainIDs[0] / "dir",
+                                   boost::filesystem::owner_all);
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
@@ -9,8 +9,15 @@
  */
 
 #include <memory>
+#include <string>
+#include <archive.h>
+#include <archive_entry.h>
+#include <boost/filesystem.hpp>
 
+#include "common/PathRAII.hpp"
+#include "common/Utility.hpp"
 #include "image_manager/LoadedImage.hpp"
+#include "test_utility/archive.hpp"
 #include "test_utility/config.hpp"
 #include "test_utility/unittest_main_function.hpp"
 
@@ -18,9 +25,94 @@ namespace sarus {
 namespace image_manager {
 namespace test {
 
+static void createLayerArchive(const boost::filesystem::path& layerArchive) {
+    test_utility::archive::ArchiveWriter layer{layerArchive};
+    layer.addDirectory("etc");
+    layer.addFile("etc/os-release", "NAME=test");
+    layer.close();
+}
+
+static void writeImageArchiveIndex(test_utility::archive::ArchiveWriter& image) {
+    image.addFile("image-digest.json", R"({"config": {"Cmd": ["/bin/sh"]}})");
+    image.addFile("manifest.json",
+        R"([{"Config": "image-digest.json", "RepoTags": ["test:latest"], "Layers": ["layer-id/layer.tar"]}])");
+}
+
+// Create an archive with the same structure as the output of "docker save"
+static void createImageArchive(const common::Config& config, const boost::filesystem::path& imageArchive, bool isCompressed) {
+    auto layerArchive = config.directories.temp / "layer.tar";
+    createLayerArchive(layerArchive);
+    test_utility::archive::ArchiveWriter image{imageArchive, isCompressed ? ARCHIVE_FILTER_GZIP : ARCHIVE_FILTER_NONE};
+    image.addDirectory("layer-id");
+    image.addFile("layer-id/layer.tar", common::readFile(layerArchive));
+    writeImageArchiveIndex(image);
+    image.close();
+    boost::filesystem::remove(layerArchive);
+}
+
+// Create an archive whose layer is a link to the layer of another image, as the
+// legacy "docker save" does for the layers shared by multiple images
+static void createImageArchiveWithLinkedLayer(const common::Config& config, const boost::filesystem::path& imageArchive, mode_t linkType) {
+    auto layerArchive = config.directories.temp / "layer.tar";
+    createLayerArchive(layerArchive);
+    test_utility::archive::ArchiveWriter image{imageArchive};
+    image.addDirectory("shared-layer-id");
+    image.addFile("shared-layer-id/layer.tar", common::readFile(layerArchive));
+    image.addDirectory("layer-id");
+    if(linkType == AE_IFLNK) {
+        image.addSymlink("layer-id/layer.tar", "../shared-layer-id/layer.tar");
+    }
+    else {
+        image.addHardlink("layer-id/layer.tar", "shared-layer-id/layer.tar");
+    }
+    writeImageArchiveIndex(image);
+    image.close();
+    boost::filesystem::remove(layerArchive);
+}
+
 TEST_GROUP(LoadedImageTestGroup) {
 };
 
+TEST(LoadedImageTestGroup, uncompressed_and_compressed_image_archives) {
+    for(auto isCompressed : {false, true}) {
+        auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+        auto repository = common::PathRAII{config->directories.repository};
+        common::createFoldersIfNecessary(config->directories.temp);
+
+        // the layers of an uncompressed archive are read directly from the archive,
+        // those of a compressed archive are extracted into the temporary directory first
+        auto archive = config->directories.repository / "image.tar";
+        createImageArchive(*config, archive, isCompressed);
+        auto loadedImage = LoadedImage(config, archive);
+        common::PathRAII expandedImage;
+        common::ImageMetadata metadata;
+        std::string digest;
+        std::tie(expandedImage, metadata, digest) = loadedImage.expand();
+
+        CHECK(common::readFile(expandedImage.getPath() / "etc/os-release") == "NAME=test");
+        CHECK(metadata.cmd == common::CLIArguments{"/bin/sh"});
+        CHECK(digest == "image-digest");
+    }
+}
+
+TEST(LoadedImageTestGroup, image_archive_with_linked_layer) {
+    for(auto linkType : {AE_IFLNK, AE_IFREG}) {
+        auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+        auto repository = common::PathRAII{config->directories.repository};
+        common::createFoldersIfNecessary(config->directories.temp);
+
+        auto archive = config->directories.repository / "image.tar";
+        createImageArchiveWithLinkedLayer(*config, archive, linkType);
+        auto loadedImage = LoadedImage(config, archive);
+        common::PathRAII expandedImage;
+        common::ImageMetadata metadata;
+        std::string digest;
+        std::tie(expandedImage, metadata, digest) = loadedImage.expand();
+
+        CHECK(common::readFile(expandedImage.getPath() / "etc/os-release") == "NAME=test");
+    }
+}
+
 TEST(LoadedImageTestGroup, test) {
     auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
 
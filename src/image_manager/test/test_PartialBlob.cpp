@@ -0,0 +1,93 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "common/PathRAII.hpp"
+#include "common/Utility.hpp"
+#include "image_manager/PartialBlob.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+TEST_GROUP(PartialBlobTestGroup) {
+};
+
+TEST(PartialBlobTestGroup, resume_download) {
+    auto directory = common::PathRAII{common::makeUniquePathWithRandomSuffix("/tmp/sarus-test-partialblob")};
+    common::createFoldersIfNecessary(directory.getPath());
+    auto blobFile = directory.getPath() / "blob.tar";
+
+    auto data = std::string{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+    auto expectedDigest = std::string{"sha256:248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"};
+
+    // interrupted download
+    {
+        PartialBlob blob{blobFile};
+        CHECK(blob.isResumable());
+        CHECK_EQUAL(blob.getOffset(), 0);
+        blob.append(data.c_str(), 10);
+    }
+    CHECK(!boost::filesystem::exists(blobFile));
+
+    // resumed download
+    {
+        PartialBlob blob{blobFile};
+        CHECK_EQUAL(blob.getOffset(), 10);
+        blob.append(data.c_str() + 10, data.size() - 10);
+        CHECK_EQUAL(blob.getDigest(), expectedDigest);
+        blob.commit();
+    }
+    CHECK_EQUAL(boost::filesystem::file_size(blobFile), data.size());
+    CHECK(!boost::filesystem::exists(blobFile.string() + ".partial"));
+    CHECK(!boost::filesystem::exists(blobFile.string() + ".partial.state"));
+}
+
+TEST(PartialBlobTestGroup, ranged_write) {
+    auto directory = common::PathRAII{common::makeUniquePathWithRandomSuffix("/tmp/sarus-test-partialblob")};
+    common::createFoldersIfNecessary(directory.getPath());
+    auto blobFile = directory.getPath() / "blob.tar";
+
+    auto data = std::string{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+    auto expectedDigest = std::string{"sha256:248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"};
+
+    PartialBlob blob{blobFile};
+    blob.append("garbage", 7); // discarded when the ranged write begins
+    blob.beginRangedWrite(data.size());
+    blob.writeRange(data.c_str() + 30, data.size() - 30, 30);
+    blob.writeRange(data.c_str(), 30, 0);
+    blob.endRangedWrite();
+    CHECK_EQUAL(blob.getOffset(), data.size());
+    CHECK_EQUAL(blob.getDigest(), expectedDigest);
+    blob.commit();
+    CHECK_EQUAL(boost::filesystem::file_size(blobFile), data.size());
+}
+
+TEST(PartialBlobTestGroup, concurrent_download) {
+    auto directory = common::PathRAII{common::makeUniquePathWithRandomSuffix("/tmp/sarus-test-partialblob")};
+    common::createFoldersIfNecessary(directory.getPath());
+    auto blobFile = directory.getPath() / "blob.tar";
+
+    PartialBlob blob{blobFile};
+    CHECK(blob.isResumable());
+
+    // the partial file is locked, hence the second blob falls back to a private temporary file
+    PartialBlob concurrentBlob{blobFile};
+    CHECK(!concurrentBlob.isResumable());
+    CHECK_EQUAL(concurrentBlob.getOffset(), 0);
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
@@ -51,6 +51,23 @@ TEST(PulledImageTestGroup, test) {
     boost::filesystem::remove_all(config->directories.repository);
 }
 
+TEST(PulledImageTestGroup, expansion_while_pulling) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    config->imageID = {"index.docker.io", "library", "alpine", "3.8"};
+
+    // start pull and expand while the layers are being downloaded
+    auto puller = image_manager::Puller{config};
+    auto pulledImage = puller.startPull();
+    common::PathRAII expandedImage;
+    std::tie(expandedImage, std::ignore, std::ignore) = pulledImage.expand();
+
+    // check
+    CHECK(boost::filesystem::exists(expandedImage.getPath() / "etc/os-release"));
+
+    // cleanup
+    boost::filesystem::remove_all(config->directories.repository);
+}
+
 }}} // namespace
 
 SARUS_UNITTEST_MAIN_FUNCTION();
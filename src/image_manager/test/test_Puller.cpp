@@ -8,14 +8,90 @@
  *
  */
 
+#include <mutex>
+#include <string>
 #include <boost/filesystem.hpp>
 
 #include "test_utility/config.hpp"
+#include "common/PathRAII.hpp"
 #include "image_manager/Puller.hpp" 
+#include "image_manager/Sha256Hasher.hpp"
 #include "test_utility/unittest_main_function.hpp"
 
 using namespace sarus;
 
+/**
+ * Transport that simulates a registry redirecting the blob requests to a storage service
+ */
+class FakeRegistryTransport : public image_manager::HttpTransport {
+public:
+    FakeRegistryTransport(const std::string& blob, bool isSizeInManifest)
+        : blob{blob}
+        , isSizeInManifest{isSizeInManifest}
+    {
+        auto hasher = image_manager::Sha256Hasher{};
+        hasher.update(blob.c_str(), blob.size());
+        digest = "sha256:" + hasher.finalize();
+    }
+
+    web::http::http_response request(const std::string& baseUri,
+                                     web::http::http_request request,
+                                     bool,
+                                     std::chrono::seconds) override {
+        auto path = request.request_uri().to_string();
+        if(baseUri == "https://storage.example.com") {
+            std::lock_guard<std::mutex> lock{mutex};
+            ++numberOfStorageRequests;
+            if(request.headers().has(U("Range"))) {
+                auto response = web::http::http_response{206};
+                response.headers().add(U("Content-Range"), (boost::format("bytes 0-0/%d") % blob.size()).str());
+                response.set_body(blob.substr(0, 1));
+                return response;
+            }
+            auto response = web::http::http_response{web::http::status_codes::OK};
+            response.set_body(blob);
+            return response;
+        }
+        if(path.find("/blobs/") != std::string::npos) {
+            auto response = web::http::http_response{307};
+            response.headers().add(U("Location"), "https://storage.example.com/blobs/" + digest);
+            return response;
+        }
+        auto response = web::http::http_response{web::http::status_codes::OK};
+        response.set_body(getManifest());
+        return response;
+    }
+
+    size_t getNumberOfStorageRequests() const {
+        std::lock_guard<std::mutex> lock{mutex};
+        return numberOfStorageRequests;
+    }
+
+private:
+    web::json::value getManifest() const {
+        auto layer = web::json::value::object();
+        layer[U("blobSum")] = web::json::value::string(digest);
+        auto history = web::json::value::object();
+        auto v1Compatibility = isSizeInManifest ? (boost::format(R"({"Size": %d})") % blob.size()).str() : "{}";
+        history[U("v1Compatibility")] = web::json::value::string(v1Compatibility);
+
+        auto manifest = web::json::value::object();
+        manifest[U("schemaVersion")] = web::json::value::number(1);
+        manifest[U("name")] = web::json::value::string("library/test");
+        manifest[U("tag")] = web::json::value::string("latest");
+        manifest[U("fsLayers")] = web::json::value::array({layer});
+        manifest[U("history")] = web::json::value::array({history});
+        return manifest;
+    }
+
+private:
+    std::string blob;
+    bool isSizeInManifest;
+    std::string digest;
+    size_t numberOfStorageRequests = 0;
+    mutable std::mutex mutex;
+};
+
 TEST_GROUP(PullerTestGroup) {
     
 };
@@ -40,4 +116,21 @@ TEST(PullerTestGroup, testGetManifest) {
     boost::filesystem::remove_all(config->directories.repository);
 }
 
+TEST(PullerTestGroup, small_layer_is_downloaded_with_one_request) {
+    for(auto isSizeInManifest : {true, false}) {
+        auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+        config->imageID = common::ImageID{"index.docker.io", "library", "test", "latest"};
+        auto repository = common::PathRAII{config->directories.repository};
+
+        auto transport = std::make_shared<FakeRegistryTransport>("layer data", isSizeInManifest);
+        auto puller = image_manager::Puller{config, transport};
+        puller.pull();
+
+        // the size of a layer that is unknown (or above the threshold of the
+        // multi-range download) is probed with a range request
+        auto expectedNumberOfRequests = isSizeInManifest ? size_t{1} : size_t{2};
+        CHECK_EQUAL(transport->getNumberOfStorageRequests(), expectedNumberOfRequests);
+    }
+}
+
 SARUS_UNITTEST_MAIN_FUNCTION();
@@ -0,0 +1,62 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <chrono>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+#include "image_manager/RegistryCache.hpp"
+#include "test_utility/config.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+TEST_GROUP(RegistryCacheTestGroup) {
+};
+
+TEST(RegistryCacheTestGroup, manifests_and_tokens) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    auto cache = RegistryCache{config};
+
+    // manifests
+    auto upstream = std::string{"https://index.docker.io"};
+    auto mirror = std::string{"https://mirror.example.com"};
+    CHECK(!cache.getManifest(upstream, "index.docker.io/library/alpine/latest"));
+    cache.putManifest(upstream, "index.docker.io/library/alpine/latest", "{\"schemaVersion\": 1}");
+    CHECK(cache.getManifest(upstream, "index.docker.io/library/alpine/latest") == std::string{"{\"schemaVersion\": 1}"});
+    CHECK(!cache.getManifest(upstream, "index.docker.io/library/alpine/3.9"));
+
+    // manifests are cached per endpoint
+    CHECK(!cache.getManifest(mirror, "index.docker.io/library/alpine/latest"));
+
+    // tokens
+    cache.putToken("index.docker.io/library/alpine", "token", std::chrono::seconds{300});
+    CHECK(cache.getToken("index.docker.io/library/alpine") == std::string{"token"});
+
+    // tokens about to expire are not cached
+    cache.putToken("index.docker.io/library/debian", "token", std::chrono::seconds{5});
+    CHECK(!cache.getToken("index.docker.io/library/debian"));
+
+    // entries are readable only by the owner
+    for(const auto& entry : boost::filesystem::directory_iterator(config->directories.cache / "tokens")) {
+        auto status = boost::filesystem::status(entry.path());
+        CHECK(status.permissions() == (boost::filesystem::owner_read | boost::filesystem::owner_write));
+    }
+
+    // cleanup
+    boost::filesystem::remove_all(config->directories.repository);
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
@@ -0,0 +1,112 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rapidjson/document.h>
+
+#include "image_manager/RegistryMirrors.hpp"
+#include "test_utility/config.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+/**
+ * Transport that simulates the latency of the mirrors (an unknown mirror is unreachable)
+ */
+class FakeHttpTransport : public HttpTransport {
+public:
+    web::http::http_response request(const std::string& baseUri,
+                                     web::http::http_request,
+                                     bool,
+                                     std::chrono::seconds) override {
+        if(baseUri == "https://slow-mirror.example.com") {
+            std::this_thread::sleep_for(std::chrono::milliseconds{200});
+        }
+        else if(baseUri != "https://fast-mirror.example.com") {
+            throw std::runtime_error("connection refused");
+        }
+        return web::http::http_response{web::http::status_codes::OK};
+    }
+};
+
+static std::shared_ptr<common::Config> makeConfig(const std::string& selection) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    auto& json = config->json.get();
+    auto& allocator = json.GetAllocator();
+
+    auto mirrors = rapidjson::Value{rapidjson::kArrayType};
+    mirrors.PushBack(rapidjson::Value{"https://slow-mirror.example.com/"}, allocator);
+    mirrors.PushBack(rapidjson::Value{"https://unreachable-mirror.example.com"}, allocator);
+    mirrors.PushBack(rapidjson::Value{"https://fast-mirror.example.com"}, allocator);
+
+    auto registry = rapidjson::Value{rapidjson::kObjectType};
+    registry.AddMember("mirrors", mirrors, allocator);
+    registry.AddMember("selection", rapidjson::Value{selection.c_str(), allocator}, allocator);
+
+    auto registryMirrors = rapidjson::Value{rapidjson::kObjectType};
+    registryMirrors.AddMember("index.docker.io", registry, allocator);
+
+    auto pull = rapidjson::Value{rapidjson::kObjectType};
+    pull.AddMember("registryMirrors", registryMirrors, allocator);
+    json.AddMember("pull", pull, allocator);
+
+    return config;
+}
+
+TEST_GROUP(RegistryMirrorsTestGroup) {
+};
+
+TEST(RegistryMirrorsTestGroup, ordered_selection) {
+    auto mirrors = RegistryMirrors{makeConfig("ordered"), std::make_shared<FakeHttpTransport>()};
+
+    auto expected = std::vector<std::string>{
+        "https://slow-mirror.example.com",
+        "https://unreachable-mirror.example.com",
+        "https://fast-mirror.example.com",
+        "https://index.docker.io"
+    };
+    CHECK(mirrors.getEndpoints("index.docker.io") == expected);
+
+    // registry without mirrors
+    expected = std::vector<std::string>{ "https://quay.io" };
+    CHECK(mirrors.getEndpoints("quay.io") == expected);
+}
+
+TEST(RegistryMirrorsTestGroup, latency_selection) {
+    auto mirrors = RegistryMirrors{makeConfig("latency"), std::make_shared<FakeHttpTransport>()};
+
+    auto expected = std::vector<std::string>{
+        "https://fast-mirror.example.com",
+        "https://slow-mirror.example.com",
+        "https://index.docker.io"
+    };
+    CHECK(mirrors.getEndpoints("index.docker.io") == expected);
+}
+
+TEST(RegistryMirrorsTestGroup, no_mirrors_with_credentials) {
+    auto config = makeConfig("ordered");
+    config->authentication.isAuthenticationNeeded = true;
+    auto mirrors = RegistryMirrors{config, std::make_shared<FakeHttpTransport>()};
+
+    auto expected = std::vector<std::string>{ "https://index.docker.io" };
+    CHECK(mirrors.getEndpoints("index.docker.io") == expected);
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
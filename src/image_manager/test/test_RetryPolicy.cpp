@@ -0,0 +1,122 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "image_manager/RetryPolicy.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+TEST_GROUP(RetryPolicyTestGroup) {
+};
+
+TEST(RetryPolicyTestGroup, backoff) {
+    auto parameters = RetryPolicy::Parameters{};
+    parameters.initialBackoff = std::chrono::milliseconds{100};
+    parameters.maxBackoff = std::chrono::milliseconds{1000};
+    RetryPolicy policy{parameters};
+
+    // exponential growth (with jitter) capped at maxBackoff
+    for(size_t failedAttempts = 1; failedAttempts < 10; ++failedAttempts) {
+        auto expectedMax = std::min(100 << (failedAttempts-1), 1000);
+        auto backoff = policy.getBackoff(failedAttempts, boost::none);
+        CHECK(backoff.count() >= 0);
+        CHECK(backoff.count() <= expectedMax);
+    }
+
+    // the delay requested by the server is honoured, up to maxBackoff
+    auto backoff = policy.getBackoff(1, std::chrono::milliseconds{800});
+    CHECK_EQUAL(backoff.count(), 800);
+    backoff = policy.getBackoff(1, std::chrono::milliseconds{5000});
+    CHECK_EQUAL(backoff.count(), 1000);
+}
+
+TEST(RetryPolicyTestGroup, parseRetryAfter) {
+    CHECK(RetryPolicy::parseRetryAfter("120") == std::chrono::milliseconds{120000});
+    CHECK(RetryPolicy::parseRetryAfter("Wed, 21 Oct 2015 07:28:00 GMT") == std::chrono::milliseconds{0}); // in the past
+    CHECK(!RetryPolicy::parseRetryAfter("invalid"));
+    CHECK(!RetryPolicy::parseRetryAfter(""));
+}
+
+TEST(RetryPolicyTestGroup, circuit_breaker) {
+    auto parameters = RetryPolicy::Parameters{};
+    parameters.circuitBreakerThreshold = 2;
+    parameters.circuitBreakerCooldown = std::chrono::milliseconds{200};
+    RetryPolicy policy{parameters};
+
+    // one failure doesn't open the circuit
+    policy.recordFailure("https://registry", "503");
+    auto start = std::chrono::steady_clock::now();
+    policy.waitUntilCircuitIsClosed("https://registry");
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{100});
+
+    // consecutive failures open the circuit (only for the failing server)
+    policy.recordFailure("https://registry", "503");
+    start = std::chrono::steady_clock::now();
+    policy.waitUntilCircuitIsClosed("https://other-registry");
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{100});
+    policy.waitUntilCircuitIsClosed("https://registry");
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds{150});
+
+    auto statistics = policy.getStatistics();
+    CHECK_EQUAL(statistics.numberOfCircuitBreakerTrips, 1);
+    CHECK_EQUAL(statistics.numberOfFailuresByReason["503"], 2);
+}
+
+TEST(RetryPolicyTestGroup, circuit_breaker_with_long_retry_after) {
+    auto parameters = RetryPolicy::Parameters{};
+    parameters.maxBackoff = std::chrono::milliseconds{200};
+    RetryPolicy policy{parameters};
+
+    // the delay requested by the server is capped at maxBackoff
+    policy.recordFailure("https://registry", "429", std::chrono::milliseconds{3600000});
+    auto start = std::chrono::steady_clock::now();
+    policy.waitUntilCircuitIsClosed("https://registry");
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(elapsed >= std::chrono::milliseconds{150});
+    CHECK(elapsed < std::chrono::milliseconds{5000});
+}
+
+TEST(RetryPolicyTestGroup, cancel_waits) {
+    auto parameters = RetryPolicy::Parameters{};
+    parameters.circuitBreakerThreshold = 1;
+    parameters.circuitBreakerCooldown = std::chrono::milliseconds{10000};
+    RetryPolicy policy{parameters};
+    policy.recordFailure("https://registry", "503");
+
+    // cancellation interrupts the current waits
+    auto start = std::chrono::steady_clock::now();
+    auto canceller = std::thread{[&policy]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        policy.cancelWaits();
+    }};
+    policy.waitUntilCircuitIsClosed("https://registry");
+    canceller.join();
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{5000});
+
+    // and skips the next ones until the waits are resumed
+    start = std::chrono::steady_clock::now();
+    policy.waitBeforeRetry("https://registry", 1, boost::none);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{100});
+
+    policy.resumeWaits();
+    start = std::chrono::steady_clock::now();
+    policy.waitBeforeRetry("https://registry", 1, std::chrono::milliseconds{200});
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds{150});
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
@@ -0,0 +1,140 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <archive.h>
+#include <boost/filesystem.hpp>
+
+#include "common/PathRAII.hpp"
+#include "common/Utility.hpp"
+#include "image_manager/RootfsWriter.hpp"
+#include "test_utility/archive.hpp"
+#include "test_utility/config.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+static void extractArchive(const boost::filesystem::path& archivePath, RootfsWriter& rootfs) {
+    auto* arc = archive_read_new();
+    archive_read_support_format_all(arc);
+    archive_read_open_filename(arc, archivePath.c_str(), 10240);
+    ::archive_entry* entry;
+    while(archive_read_next_header(arc, &entry) == ARCHIVE_OK) {
+        rootfs.writeEntry(arc, entry);
+    }
+    archive_read_free(arc);
+    rootfs.finish();
+}
+
+TEST_GROUP(RootfsWriterTestGroup) {
+};
+
+TEST(RootfsWriterTestGroup, entries_do_not_escape_from_root_directory) {
+    auto config = test_utility::config::makeConfig();
+    auto repository = common::PathRAII{config.directories.repository};
+    auto testDir = config.directories.temp;
+    auto rootDir = testDir / "rootfs";
+    auto outsideDir = testDir / "outside";
+    common::createFoldersIfNecessary(rootDir);
+    common::createFoldersIfNecessary(outsideDir);
+
+    auto archivePath = testDir / "layer.tar";
+    test_utility::archive::ArchiveWriter layer{archivePath};
+    layer.addDirectory("dir");
+    layer.addFile("dir/file", "content");
+    layer.addSymlink("absolute-link", outsideDir.string());
+    layer.addFile("absolute-link/file", "content");
+    layer.addSymlink("relative-link", "../../../../..");
+    layer.addFile("relative-link/file", "content");
+    layer.close();
+
+    auto workingDir = boost::filesystem::current_path();
+    RootfsWriter rootfs{rootDir};
+    extractArchive(archivePath, rootfs);
+
+    // the working directory is never changed
+    CHECK(boost::filesystem::current_path() == workingDir);
+
+    CHECK(common::readFile(rootDir / "dir/file") == "content");
+    CHECK(boost::filesystem::is_empty(outsideDir));
+    CHECK(boost::filesystem::is_regular_file(rootDir / outsideDir / "file"));
+    CHECK(boost::filesystem::is_regular_file(rootDir / "file"));
+
+    // the last component of the path is not followed
+    CHECK(!rootfs.listDirectory("absolute-link"));
+    CHECK(rootfs.remove("absolute-link"));
+    CHECK(boost::filesystem::is_regular_file(rootDir / outsideDir / "file"));
+    CHECK(!rootfs.remove("absolute-link"));
+
+    CHECK(rootfs.listDirectory("dir")->size() == 1);
+    CHECK(rootfs.remove("dir"));
+    CHECK(!boost::filesystem::exists(rootDir / "dir"));
+}
+
+TEST(RootfsWriterTestGroup, writer_threads_preserve_order_of_entries) {
+    auto config = test_utility::config::makeConfig();
+    auto repository = common::PathRAII{config.directories.repository};
+    auto testDir = config.directories.temp;
+    auto rootDir = testDir / "rootfs";
+    common::createFoldersIfNecessary(rootDir);
+
+    auto archivePath = testDir / "layer.tar";
+    test_utility::archive::ArchiveWriter layer{archivePath};
+    layer.addDirectory("dir");
+    for(size_t i = 0; i < 100; ++i) {
+        layer.addFile("dir/file" + std::to_string(i), std::to_string(i));
+    }
+    layer.addFile("overwritten", "first");
+    layer.addFile("overwritten", "second");
+    layer.addFile("file-replaced-by-directory", "content");
+    layer.addFile("file-replaced-by-directory/file", "content");
+    layer.addFile("dir", "directory replaced by file");
+    layer.close();
+
+    RootfsWriter rootfs{rootDir, 4};
+    extractArchive(archivePath, rootfs);
+
+    CHECK(common::readFile(rootDir / "overwritten") == "second");
+    CHECK(common::readFile(rootDir / "file-replaced-by-directory/file") == "content");
+    CHECK(common::readFile(rootDir / "dir") == "directory replaced by file");
+}
+
+TEST(RootfsWriterTestGroup, identical_files_are_hard_linked) {
+    auto config = test_utility::config::makeConfig();
+    auto repository = common::PathRAII{config.directories.repository};
+    auto testDir = config.directories.temp;
+    auto rootDir = testDir / "rootfs";
+    common::createFoldersIfNecessary(rootDir);
+
+    auto archivePath = testDir / "layer.tar";
+    test_utility::archive::ArchiveWriter layer{archivePath};
+    layer.addDirectory("env0");
+    layer.addFile("env0/lib.so", "content of library");
+    layer.addDirectory("env1");
+    layer.addFile("env1/lib.so", "content of library");
+    layer.addFile("env1/other.so", "content of other library");
+    layer.close();
+
+    RootfsWriter rootfs{rootDir, 2, true};
+    extractArchive(archivePath, rootfs);
+
+    CHECK(boost::filesystem::equivalent(rootDir / "env0/lib.so", rootDir / "env1/lib.so"));
+    CHECK(!boost::filesystem::equivalent(rootDir / "env0/lib.so", rootDir / "env1/other.so"));
+    CHECK(common::readFile(rootDir / "env1/lib.so") == "content of library");
+    CHECK_EQUAL(rootfs.listDirectory("env1")->size(), 2); // no leftover temporary links
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
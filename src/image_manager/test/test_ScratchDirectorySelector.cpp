@@ -0,0 +1,71 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <boost/filesystem.hpp>
+
+#include "common/Config.hpp"
+#include "common/Error.hpp"
+#include "common/PathRAII.hpp"
+#include "test_utility/config.hpp"
+#include "image_manager/ScratchDirectorySelector.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+static void setScratchDirectory(common::Config& config, const boost::filesystem::path& directory, size_t maxSizeMB) {
+    auto& allocator = config.json.get().GetAllocator();
+    auto scratchDirectory = rapidjson::Value{rapidjson::kObjectType};
+    scratchDirectory.AddMember("path", rapidjson::Value{directory.c_str(), allocator}, allocator);
+    scratchDirectory.AddMember("maxSize", rapidjson::Value{static_cast<uint64_t>(maxSizeMB)}, allocator);
+    auto scratchDirectories = rapidjson::Value{rapidjson::kArrayType};
+    scratchDirectories.PushBack(scratchDirectory, allocator);
+    test_utility::config::setExpansionMember(config, "scratchDirectories", std::move(scratchDirectories));
+}
+
+TEST_GROUP(ScratchDirectorySelectorTestGroup) {
+};
+
+TEST(ScratchDirectorySelectorTestGroup, select_first_candidate_that_fits) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    setScratchDirectory(*config, "/tmp/sarus-test-scratch-directory", 1);
+    auto repository = common::PathRAII{config->directories.repository};
+    auto selector = ScratchDirectorySelector{config};
+
+    // unknown space: the temporary directory
+    CHECK(selector.select(boost::none) == config->directories.temp);
+
+    // the scratch directory fits
+    CHECK(selector.select(uintmax_t{1} << 19) == "/tmp/sarus-test-scratch-directory");
+
+    // the scratch directory exceeds its max size: spill to the temporary directory
+    CHECK(selector.select(uintmax_t{2} << 20) == config->directories.temp);
+
+    // nothing fits: fail before the expansion
+    CHECK_THROWS(common::Error, selector.select(std::numeric_limits<uintmax_t>::max()));
+}
+
+TEST(ScratchDirectorySelectorTestGroup, temp_dir_of_cli_is_the_only_candidate) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    setScratchDirectory(*config, "/tmp/sarus-test-scratch-directory", 1);
+    auto repository = common::PathRAII{config->directories.repository};
+    config->directories.tempFromCLI = config->directories.temp.string();
+    auto selector = ScratchDirectorySelector{config};
+
+    CHECK(selector.select(uintmax_t{1} << 19) == config->directories.temp);
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
@@ -0,0 +1,81 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <string>
+
+#include "image_manager/Sha256Hasher.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+TEST_GROUP(Sha256HasherTestGroup) {
+};
+
+TEST(Sha256HasherTestGroup, empty_input) {
+    auto hasher = Sha256Hasher{};
+    CHECK_EQUAL(hasher.finalize(),
+                std::string{"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"});
+}
+
+TEST(Sha256HasherTestGroup, incremental_input) {
+    auto data = std::string{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+    auto expectedDigest = std::string{"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"};
+
+    // whole input at once
+    {
+        auto hasher = Sha256Hasher{};
+        hasher.update(data.c_str(), data.size());
+        CHECK_EQUAL(hasher.finalize(), expectedDigest);
+    }
+    // input split in chunks
+    {
+        auto hasher = Sha256Hasher{};
+        hasher.update(data.c_str(), 5);
+        hasher.update(data.c_str() + 5, 0);
+        hasher.update(data.c_str() + 5, data.size() - 5);
+        CHECK_EQUAL(hasher.finalize(), expectedDigest);
+    }
+}
+
+TEST(Sha256HasherTestGroup, save_and_restore_state) {
+    auto data = std::string{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+    auto expectedDigest = std::string{"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"};
+
+    auto hasher = Sha256Hasher{};
+    hasher.update(data.c_str(), 10);
+
+    auto restoredHasher = Sha256Hasher{hasher.getState(), 10};
+    restoredHasher.update(data.c_str() + 10, data.size() - 10);
+    CHECK_EQUAL(restoredHasher.finalize(), expectedDigest);
+
+    CHECK_THROWS(common::Error, Sha256Hasher("invalid state", 10));
+}
+
+TEST(Sha256HasherTestGroup, restore_inconsistent_state) {
+    auto hasher = Sha256Hasher{};
+    hasher.update("abcdefghij", 10);
+    auto state = hasher.getState();
+
+    // state of a different number of hashed bytes
+    CHECK_THROWS(common::Error, Sha256Hasher(state, 9));
+    CHECK_THROWS(common::Error, Sha256Hasher(state, 10 + 64));
+
+    // corrupted state (e.g. the number of buffered bytes exceeds the block size)
+    for(auto& c : state) {
+        c = 'f';
+    }
+    CHECK_THROWS(common::Error, Sha256Hasher(state, 10));
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
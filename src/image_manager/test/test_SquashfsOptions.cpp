@@ -0,0 +1,83 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <string>
+
+#include "common/Config.hpp"
+#include "common/Error.hpp"
+#include "test_utility/config.hpp"
+#include "image_manager/SquashfsOptions.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+static void setSquashfsConfig(common::Config& config, const std::string& compressor, size_t blockSize) {
+    auto& json = config.json.get();
+    auto& allocator = json.GetAllocator();
+    auto squashfs = rapidjson::Value{rapidjson::kObjectType};
+    squashfs.AddMember("compressor", rapidjson::Value{compressor.c_str(), allocator}, allocator);
+    squashfs.AddMember("blockSize", rapidjson::Value{static_cast<unsigned>(blockSize)}, allocator);
+    json.AddMember("squashfs", squashfs, allocator);
+}
+
+TEST_GROUP(SquashfsOptionsTestGroup) {
+};
+
+TEST(SquashfsOptionsTestGroup, defaults_of_mksquashfs) {
+    auto config = test_utility::config::makeConfig();
+    CHECK(SquashfsOptions{config}.getCommandLine().empty());
+}
+
+TEST(SquashfsOptionsTestGroup, options_from_config_file) {
+    auto config = test_utility::config::makeConfig();
+    setSquashfsConfig(config, "lz4", 1024);
+    CHECK_EQUAL(SquashfsOptions{config}.getCommandLine(), std::string{"-comp lz4 -b 1048576"});
+}
+
+TEST(SquashfsOptionsTestGroup, options_from_cli_override_config_file) {
+    auto config = test_utility::config::makeConfig();
+    setSquashfsConfig(config, "lz4", 1024);
+    config.squashfs.compressor = "zstd";
+    config.squashfs.compressionLevel = 15;
+    config.squashfs.processors = 4;
+    config.squashfs.memory = 512;
+    CHECK_EQUAL(SquashfsOptions{config}.getCommandLine(),
+                std::string{"-comp zstd -Xcompression-level 15 -b 1048576 -processors 4 -mem 512M"});
+}
+
+TEST(SquashfsOptionsTestGroup, invalid_options) {
+    auto config = test_utility::config::makeConfig();
+
+    config.squashfs.compressor = "lzma";
+    CHECK_THROWS(common::Error, SquashfsOptions::validate(config));
+
+    // xz has no compression level
+    config.squashfs.compressor = "xz";
+    config.squashfs.compressionLevel = 6;
+    CHECK_THROWS(common::Error, SquashfsOptions::validate(config));
+
+    // the default compressor (gzip) has max level 9
+    config.squashfs.compressor = "";
+    config.squashfs.compressionLevel = 10;
+    CHECK_THROWS(common::Error, SquashfsOptions::validate(config));
+
+    config.squashfs.compressionLevel = 0;
+    config.squashfs.blockSize = 96;
+    CHECK_THROWS(common::Error, SquashfsOptions::validate(config));
+
+    // the arguments of mksquashfs are never generated from invalid settings
+    CHECK_THROWS(common::Error, SquashfsOptions{config}.getArguments());
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
@@ -0,0 +1,138 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+
+#include "common/Config.hpp"
+#include "common/PathRAII.hpp"
+#include "common/Utility.hpp"
+#include "test_utility/config.hpp"
+#include "image_manager/TrashDirectory.hpp"
+#include "test_utility/unittest_main_function.hpp"
+
+namespace sarus {
+namespace image_manager {
+namespace test {
+
+static common::PathRAII makeTree(const boost::filesystem::path& directory) {
+    common::createFoldersIfNecessary(directory / "dir");
+    common::createFileIfNecessary(directory / "dir/file");
+    return common::PathRAII{directory};
+}
+
+static bool isOnSameFilesystem(const boost::filesystem::path& lhs, const boost::filesystem::path& rhs) {
+    struct stat lhsStat, rhsStat;
+    CHECK(stat(lhs.c_str(), &lhsStat) == 0);
+    CHECK(stat(rhs.c_str(), &rhsStat) == 0);
+    return lhsStat.st_dev == rhsStat.st_dev;
+}
+
+static void waitUntilEmpty(const TrashDirectory& trash) {
+    for(size_t i = 0; i < 100 && !trash.isEmpty(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+TEST_GROUP(TrashDirectoryTestGroup) {
+};
+
+TEST(TrashDirectoryTestGroup, synchronous_cleanup) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    test_utility::config::setExpansionMember(*config, "asynchronousCleanup", rapidjson::Value{false});
+    auto repository = common::PathRAII{config->directories.repository};
+    auto tree = makeTree(config->directories.temp / "expansion-directory");
+    auto path = tree.getPath();
+
+    TrashDirectory{config}.discard(tree);
+    CHECK(!tree.hasPath());
+    CHECK(!boost::filesystem::exists(path));
+}
+
+TEST(TrashDirectoryTestGroup, asynchronous_cleanup) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    test_utility::config::setExpansionMember(*config, "asynchronousCleanup", rapidjson::Value{true});
+    auto repository = common::PathRAII{config->directories.repository};
+    auto trash = TrashDirectory{config};
+    auto tree = makeTree(config->directories.temp / "expansion-directory");
+    auto path = tree.getPath();
+
+    // the tree is moved to the trash directory
+    trash.discard(tree);
+    CHECK(!tree.hasPath());
+    CHECK(!boost::filesystem::exists(path));
+    CHECK(!trash.isEmpty());
+
+    // the trash directory is emptied by a background process
+    trash.emptyInBackground();
+    waitUntilEmpty(trash);
+    CHECK(trash.isEmpty());
+}
+
+TEST(TrashDirectoryTestGroup, asynchronous_cleanup_of_tree_on_another_filesystem) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    test_utility::config::setExpansionMember(*config, "asynchronousCleanup", rapidjson::Value{true});
+    auto repository = common::PathRAII{config->directories.repository};
+    common::createFoldersIfNecessary(config->directories.repository);
+    auto otherFilesystem = boost::filesystem::path{"/dev/shm"};
+    if(!boost::filesystem::is_directory(otherFilesystem)
+        || isOnSameFilesystem(otherFilesystem, config->directories.repository)) {
+        return; // the marker files cannot be exercised on this system
+    }
+    auto trash = TrashDirectory{config};
+    auto tree = makeTree(common::makeUniquePathWithRandomSuffix(otherFilesystem / "sarus-test-trash"));
+    auto path = tree.getPath();
+
+    // a marker file with the host and the path of the tree is created in the trash directory
+    trash.discard(tree);
+    CHECK(!tree.hasPath());
+    CHECK(boost::filesystem::exists(path));
+    auto markers = std::vector<boost::filesystem::path>{};
+    for(const auto& entry : boost::filesystem::directory_iterator{config->directories.repository / "trash"}) {
+        markers.push_back(entry.path());
+    }
+    CHECK_EQUAL(markers.size(), size_t{1});
+    CHECK_EQUAL(markers[0].extension().string(), std::string{".path"});
+    CHECK_EQUAL(common::readFile(markers[0]), common::getHostname() + "\n" + path.string());
+
+    // the tree and the marker file are removed by the background process
+    trash.emptyInBackground();
+    waitUntilEmpty(trash);
+    CHECK(trash.isEmpty());
+    CHECK(!boost::filesystem::exists(path));
+}
+
+TEST(TrashDirectoryTestGroup, marker_of_another_host_is_skipped) {
+    auto config = std::make_shared<common::Config>(test_utility::config::makeConfig());
+    test_utility::config::setExpansionMember(*config, "asynchronousCleanup", rapidjson::Value{true});
+    auto repository = common::PathRAII{config->directories.repository};
+    auto trash = TrashDirectory{config};
+    auto tree = makeTree(config->directories.temp / "expansion-directory");
+    auto marker = config->directories.repository / "trash/expansion-directory.path";
+    common::createFoldersIfNecessary(marker.parent_path());
+    {
+        std::ofstream stream{marker.string()};
+        stream << "not-" << common::getHostname() << "\n" << tree.getPath().string();
+    }
+
+    // nothing to remove on this host: the marker file and the tree are left in place
+    trash.emptyInBackground();
+    CHECK(boost::filesystem::exists(marker));
+    CHECK(boost::filesystem::exists(tree.getPath()));
+}
+
+}}} // namespace
+
+SARUS_UNITTEST_MAIN_FUNCTION();
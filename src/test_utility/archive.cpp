@@ -0,0 +1,102 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/**
+ * @brief Archive utility functions to be used in the tests.
+ */
+
+#include "archive.hpp"
+
+#include <boost/format.hpp>
+
+#include "common/Error.hpp"
+
+
+namespace test_utility {
+namespace archive {
+
+ArchiveWriter::ArchiveWriter(const boost::filesystem::path& archivePath, int filterCode)
+    : arc{archive_write_new()}
+{
+    archive_write_set_format_pax_restricted(arc);
+    if(archive_write_add_filter(arc, filterCode) != ARCHIVE_OK
+        || archive_write_open_filename(arc, archivePath.c_str()) != ARCHIVE_OK) {
+        auto message = boost::format("Failed to create archive %s: %s") % archivePath % archive_error_string(arc);
+        archive_write_free(arc);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+ArchiveWriter::~ArchiveWriter() {
+    archive_write_free(arc); // also closes the archive
+}
+
+void ArchiveWriter::addDirectory(const std::string& path, mode_t permissions) {
+    auto* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, path.c_str());
+    archive_entry_set_filetype(entry, AE_IFDIR);
+    archive_entry_set_perm(entry, permissions);
+    writeEntry(entry);
+}
+
+void ArchiveWriter::addFile(const std::string& path, const std::string& data, mode_t permissions) {
+    auto* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, path.c_str());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, permissions);
+    archive_entry_set_size(entry, data.size());
+    writeEntry(entry, data);
+}
+
+void ArchiveWriter::addSymlink(const std::string& path, const std::string& target, mode_t permissions) {
+    auto* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, path.c_str());
+    archive_entry_set_filetype(entry, AE_IFLNK);
+    archive_entry_set_perm(entry, permissions);
+    archive_entry_set_symlink(entry, target.c_str());
+    writeEntry(entry);
+}
+
+void ArchiveWriter::addHardlink(const std::string& path, const std::string& target) {
+    auto* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, path.c_str());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_entry_set_hardlink(entry, target.c_str());
+    writeEntry(entry);
+}
+
+void ArchiveWriter::close() {
+    archive_write_close(arc);
+}
+
+void ArchiveWriter::writeEntry(::archive_entry* entry, const std::string& data) {
+    auto status = archive_write_header(arc, entry);
+    archive_entry_free(entry);
+    if(status != ARCHIVE_OK) {
+        auto message = boost::format("Failed to write archive entry: %s") % archive_error_string(arc);
+        SARUS_THROW_ERROR(message.str());
+    }
+    if(!data.empty() && archive_write_data(arc, data.c_str(), data.size()) < 0) {
+        auto message = boost::format("Failed to write archive data: %s") % archive_error_string(arc);
+        SARUS_THROW_ERROR(message.str());
+    }
+}
+
+// Whether the libarchive at hand can compress with the specified filter
+bool isFilterSupported(int filterCode) {
+    auto* arc = archive_write_new();
+    auto isSupported = archive_write_add_filter(arc, filterCode) == ARCHIVE_OK;
+    archive_write_free(arc);
+    return isSupported;
+}
+
+}
+}
@@ -0,0 +1,56 @@
+/*
+ * Sarus
+ *
+ * Copyright (c) 2018-2019, ETH Zurich. All rights reserved.
+ *
+ * Please, refer to the LICENSE file in the root directory.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/**
+ * @brief Archive utility functions to be used in the tests.
+ */
+
+#ifndef sarus_test_utility_archive_hpp
+#define sarus_test_utility_archive_hpp
+
+#include <string>
+#include <sys/types.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <boost/filesystem.hpp>
+
+
+namespace test_utility {
+namespace archive {
+
+/**
+ * Writes a tar archive (e.g. a synthetic layer or image) entry by entry.
+ * The archive is complete once closed (or destroyed).
+ */
+class ArchiveWriter {
+public:
+    ArchiveWriter(const boost::filesystem::path& archivePath, int filterCode = ARCHIVE_FILTER_NONE);
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+    ~ArchiveWriter();
+    void addDirectory(const std::string& path, mode_t permissions = 0755);
+    void addFile(const std::string& path, const std::string& data = "", mode_t permissions = 0644);
+    void addSymlink(const std::string& path, const std::string& target, mode_t permissions = 0777);
+    void addHardlink(const std::string& path, const std::string& target);
+    void close();
+
+private:
+    void writeEntry(::archive_entry* entry, const std::string& data = "");
+
+private:
+    ::archive* arc;
+};
+
+bool isFilterSupported(int filterCode);
+
+}
+}
+
+#endif
@@ -100,5 +100,22 @@ sarus::common::Config makeConfig() {
     return config;
 }
 
+// Set a member of the "expansion" object of the configuration (the object
+// is created if missing, the member is replaced if already set)
+void setExpansionMember(sarus::common::Config& config, const char* member, rapidjson::Value value) {
+    auto& json = config.json.get();
+    auto& allocator = json.GetAllocator();
+    if(!json.HasMember("expansion")) {
+        json.AddMember("expansion", rapidjson::Value{rapidjson::kObjectType}, allocator);
+    }
+    auto& expansion = json["expansion"];
+    if(expansion.HasMember(member)) {
+        expansion[member] = value;
+    }
+    else {
+        expansion.AddMember(rapidjson::Value{member, allocator}, value, allocator);
+    }
+}
+
 }
 }
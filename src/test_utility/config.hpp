@@ -21,6 +21,7 @@ namespace test_utility {
 namespace config {
 
 sarus::common::Config makeConfig();
+void setExpansionMember(sarus::common::Config& config, const char* member, rapidjson::Value value);
 
 }
 }